@@ -2,6 +2,7 @@
 
 #include <string>
 #include <iostream>
+#include <algorithm>
 #include <unordered_map>
 
 #include "snet/Acceptor.h"
@@ -129,6 +130,55 @@ private:
   bool enable_send_;
 };
 
+// Packs records into buffers of about batch bytes, so many records go to
+// the frontend as one snet::Buffer and one write. Records are not split, a
+// record larger than a batch is sent on its own after the pending ones.
+class SendBatch final {
+public:
+  SendBatch(Frontend *frontend, size_t batch)
+      : frontend_(frontend), batch_(std::max<size_t>(batch, 1)) {}
+
+  ~SendBatch() { delete[] data_; }
+
+  SendBatch(const SendBatch &) = delete;
+  void operator=(const SendBatch &) = delete;
+
+  void Append(const char *data, size_t size);
+  void Append(const std::string &data) { Append(data.data(), data.size()); }
+  // sends the pending records
+  void Flush();
+  bool Empty() const { return size_ == 0; }
+
+private:
+  Frontend *frontend_;
+  const size_t batch_;
+  char *data_  = nullptr;
+  size_t size_ = 0;
+};
+
+// Sends a partly filled batch once it waited delay ms, or as soon as the
+// frontend takes data again after that.
+class BatchTimer final {
+public:
+  BatchTimer(snet::TimerList *timer_list, Frontend *frontend, SendBatch *batch,
+             int delay);
+
+  BatchTimer(const BatchTimer &) = delete;
+  void operator=(const BatchTimer &) = delete;
+
+  // after appending, starts the wait of a new batch
+  void Arm();
+  // sends the pending records, unless the frontend cannot take them
+  void Flush();
+
+private:
+  Frontend *frontend_;
+  SendBatch *batch_;
+  const int delay_;
+  snet::Timer timer_;
+  bool armed_ = false;
+};
+
 class Client final {
 public:
   using OnErrorClose = std::function<void()>;
@@ -8,9 +8,20 @@ struct Option {
   std::string config_path_;
   std::string log_path_;
   std::string ip_db_path_;
+  std::string ip6_db_path_;
+  int db_check_ = 0;
   std::string redis_address_;
   std::string redis_queue_;
   bool tcp_input_ = false;
+  int workers_    = 0;
+  bool unordered_ = false;
+  size_t queue_size_;
+  size_t inflate_threads_;
+  size_t send_batch_;
+  int send_delay_;
+  int agg_lateness_;
+  size_t agg_groups_;
+  int agg_workers_ = 0;
 
   std::string frontend_ip_;
   unsigned short frontend_port_;
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <stddef.h>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include "fluorine/Macros.hpp"
+
+namespace fluorine {
+
+// Fans batches out to a fixed set of threads and hands the results back to a
+// single collector. Batches are dispatched round-robin, so collecting them
+// round-robin too keeps the input order; unordered collection takes whatever
+// is ready first. Dispatch and Collect must be called from the same thread.
+// Inputs are not owned by the pool, the transform may recycle them.
+template <typename Input, typename Output>
+class WorkerPool {
+public:
+  using Transform = std::function<void(Input &in, Output &out)>;
+
+  WorkerPool(size_t workers, bool ordered, Transform transform,
+             size_t depth = 4)
+      : ordered_(ordered), depth_(depth), transform_(transform) {
+    for (size_t i = 0; i < workers; ++i) {
+      workers_.emplace_back(new Worker());
+    }
+    for (auto &w : workers_) {
+      Worker *worker = w.get();
+      worker->thread_ = std::thread([this, worker]() { Run(worker); });
+    }
+  }
+
+  ~WorkerPool() {
+    for (auto &w : workers_) {
+      std::lock_guard<std::mutex> lock(w->mutex_);
+      w->stop_ = true;
+      w->cv_.notify_one();
+    }
+    for (auto &w : workers_) {
+      w->thread_.join();
+    }
+  }
+
+  size_t Size() const { return workers_.size(); }
+
+  // called on a worker thread after each output, set before dispatching
+  void SetReadyHandler(const std::function<void()> &handler) {
+    ready_handler_ = handler;
+  }
+
+  bool Idle() const { return inflight_ == 0; }
+
+  bool CanDispatch() const {
+    return workers_[next_dispatch_]->inflight_ < depth_;
+  }
+
+  void Dispatch(Input *in) {
+    Worker *w = workers_[next_dispatch_].get();
+    next_dispatch_ = (next_dispatch_ + 1) % workers_.size();
+    ++w->inflight_;
+    ++inflight_;
+
+    std::lock_guard<std::mutex> lock(w->mutex_);
+    w->input_.push_back(in);
+    w->cv_.notify_one();
+  }
+
+  // returns nullptr when no result is ready yet
+  std::unique_ptr<Output> Collect() {
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      Worker *w = workers_[next_collect_].get();
+      std::unique_ptr<Output> out;
+      {
+        std::lock_guard<std::mutex> lock(w->mutex_);
+        if (!w->output_.empty()) {
+          out = std::move(w->output_.front());
+          w->output_.pop_front();
+        }
+      }
+
+      if (out) {
+        --w->inflight_;
+        --inflight_;
+        if (ordered_) {
+          next_collect_ = (next_collect_ + 1) % workers_.size();
+        }
+        return out;
+      }
+
+      if (ordered_) {
+        break;
+      }
+      next_collect_ = (next_collect_ + 1) % workers_.size();
+    }
+
+    return nullptr;
+  }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(WorkerPool);
+
+  struct Worker {
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Input *> input_;
+    std::deque<std::unique_ptr<Output>> output_;
+    size_t inflight_ = 0; // owned by the dispatching thread
+    bool stop_       = false;
+  };
+
+  void Run(Worker *w) {
+    for (;;) {
+      Input *in;
+      {
+        std::unique_lock<std::mutex> lock(w->mutex_);
+        w->cv_.wait(lock, [w]() { return w->stop_ || !w->input_.empty(); });
+        if (w->input_.empty()) {
+          return;
+        }
+        in = w->input_.front();
+        w->input_.pop_front();
+      }
+
+      std::unique_ptr<Output> out(new Output());
+      transform_(*in, *out);
+
+      {
+        std::lock_guard<std::mutex> lock(w->mutex_);
+        w->output_.push_back(std::move(out));
+      }
+      if (ready_handler_) {
+        ready_handler_();
+      }
+    }
+  }
+
+  const bool ordered_;
+  const size_t depth_;
+  Transform transform_;
+  std::function<void()> ready_handler_;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  size_t next_dispatch_ = 0;
+  size_t next_collect_  = 0;
+  size_t inflight_      = 0;
+};
+
+} // namespace fluorine
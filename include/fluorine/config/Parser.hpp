@@ -10,9 +10,12 @@ namespace config {
 namespace qi    = boost::spirit::qi;
 namespace ascii = boost::spirit::ascii;
 
+// name: [type "format", action, value];
 struct Attribute {
   std::string name_;
-  std::vector<std::string> attribute_;
+  std::string type_;
+  std::string format_; // empty when not quoted after the type
+  std::vector<std::string> arguments_; // the action, then what it adds
 
   const static std::string IGNORE;
   const static std::string STORE;
@@ -22,11 +25,28 @@ struct Attribute {
 typedef std::vector<Attribute> Attributes;
 typedef std::string::const_iterator iterator_type;
 
+// a key aggregated by the function named before it, sum when not:
+// max(request_time)
+struct AggregateKey {
+  std::string function_;
+  std::string name_;
+};
+
 struct Aggregation {
-  std::vector<std::string> keys_;
+  std::vector<AggregateKey> keys_;
   std::string time_;
   int interval_;
   boost::optional<std::vector<std::string>> terms_;
+
+  const static std::string SUM;
+  const static std::string MIN;
+  const static std::string MAX;
+  const static std::string AVG;
+  const static std::string DISTINCT; // approximate, of any type
+
+  // the percentile of pNN, 0 for another function
+  static int Percentile(const std::string &function);
+  static bool IsFunction(const std::string &function);
 };
 
 struct Config {
@@ -56,10 +76,15 @@ struct Grammar : qi::grammar<Iterator, Config(), Skipper<Iterator>> {
     name   = quoted | +char_("a-zA-Z0-9_");
     list   = '[' >> (name % ',') >> ']';
 
-    attribute  = name >> ':' >> list >> ';';
+    attribute = name >> ':' >> '[' >> name >> -quoted >> *(',' >> name) >>
+                ']' >> ';';
     attributes = '{' >> *attribute >> '}';
+    function   = +char_("a-z0-9");
+    key        = hold[function >> '(' >> name >> ')'] |
+          attr(Aggregation::SUM) >> name;
+    keys = '[' >> (key % ',') >> ']' | repeat(1)[key];
     aggregation =
-        '(' >> (name | list) >> ',' >> name >> ',' >> int_ >> ')' >> -list;
+        '(' >> keys >> ',' >> name >> ',' >> int_ >> ')' >> -list;
     config = name >> '(' >> int_ >> ',' >> int_ >> ',' >> int_ >> ')' >>
              attributes >> -aggregation;
 
@@ -67,7 +92,9 @@ struct Grammar : qi::grammar<Iterator, Config(), Skipper<Iterator>> {
   }
 
 private:
-  qi::rule<Iterator, std::string(), qi::no_skip_type> quoted, name;
+  qi::rule<Iterator, std::string(), qi::no_skip_type> quoted, name, function;
+  qi::rule<Iterator, AggregateKey(), Skipper<Iterator>> key;
+  qi::rule<Iterator, std::vector<AggregateKey>(), Skipper<Iterator>> keys;
   qi::rule<Iterator, std::vector<std::string>(), Skipper<Iterator>> list;
   qi::rule<Iterator, Attribute(), Skipper<Iterator>> attribute;
   qi::rule<Iterator, Attributes(), Skipper<Iterator>> attributes;
@@ -92,10 +119,16 @@ BOOST_FUSION_ADAPT_STRUCT(fluorine::config::Config,
 
 BOOST_FUSION_ADAPT_STRUCT(fluorine::config::Attribute,
     (std::string, name_)
-    (std::vector<std::string>, attribute_))
+    (std::string, type_)
+    (std::string, format_)
+    (std::vector<std::string>, arguments_))
+
+BOOST_FUSION_ADAPT_STRUCT(fluorine::config::AggregateKey,
+    (std::string, function_)
+    (std::string, name_))
 
 BOOST_FUSION_ADAPT_STRUCT(fluorine::config::Aggregation,
-    (std::vector<std::string>, keys_)
+    (std::vector<fluorine::config::AggregateKey>, keys_)
     (std::string, time_)
     (int, interval_)
     (boost::optional<std::vector<std::string>>, terms_))
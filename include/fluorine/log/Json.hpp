@@ -5,6 +5,7 @@
 #include <string>
 #include <algorithm>
 #include <functional>
+#include <cmath>
 #include <ctime>
 #include <time.h>
 
@@ -19,7 +20,9 @@
 #include "fluorine/log/Parser.hpp"
 #include "fluorine/config/Parser.hpp"
 #include "fluorine/util/Fast.hpp"
+#include "fluorine/util/GroupBy.hpp"
 #include "fluorine/util/IPResolver.hpp"
+#include "fluorine/util/TimeFormat.hpp"
 
 namespace fluorine {
 namespace json {
@@ -34,11 +37,232 @@ using std::string;
 extern std::set<std::string> IPFields;
 extern std::set<std::string> RequestFields;
 
-typedef std::function<bool(Document &, string, string)> Handler;
-typedef std::map<string, Handler> Handlers;
+struct Step;
+class JsonWriter;
+class Projection;
+
+// handlers take the field as a view into the line, and copy it into the
+// document only once. They are written once over where the members go, a
+// document, a JsonWriter or a Projection, and a config entry holds the
+// three instances.
+typedef bool (*Handler)(Document &, const Step &, Field);
+typedef bool (*Emitter)(JsonWriter &, const Step &, Field);
+typedef bool (*Collector)(Projection &, const Step &, Field);
+// the emitter and collector are null for handlers reading members back
+// from the document
+struct HandlerSet {
+  Handler handler_;
+  Emitter emitter_;
+  Collector collector_;
+};
+typedef std::map<string, HandlerSet> Handlers;
 typedef std::tuple<string, string, string> Request;
 
-template <typename Iterator = string::iterator>
+// A member name, with the escaped `,"name":` JsonWriter puts before values.
+struct Key {
+  Key() = default;
+  Key(const string &name);
+
+  string name_;
+  string prefix_;
+};
+
+// what a compiled attribute does on each line
+enum class Action {
+  Store,     // the field at field_
+  StoreSpan, // the fields at field_ and field_ + 1, joined by a space
+  Add,       // the constant value_
+  Replace,   // value_, removing a member of the same name added before
+};
+
+// An attribute resolved once at config load. Documents refer to the keys
+// instead of copying them, the plan has to outlive them.
+struct Step {
+  Action action_   = Action::Store;
+  size_t field_    = 0;
+  Handler handler_     = nullptr;
+  Emitter emitter_     = nullptr;
+  Collector collector_ = nullptr;
+  Key key_;
+  std::vector<Key> derived_; // the members an ip handler adds
+  util::TimeFormat format_;  // what a time handler reads
+  string value_;
+  string fragment_; // an added constant as streamed, rendered once
+  bool replaced_ = false; // a constant a later step replaces when streamed
+};
+
+// A config compiled into the steps PopulateJsonDoc walks for each line.
+struct Plan {
+  int field_number_ = 0;
+  Step type_;
+  std::vector<Step> steps_;
+
+  // set by CompileStream, EmitJson writes head_, the steps and tail_
+  bool stream_ = false;
+  string head_; // the type member, unless replaced
+  string tail_; // the path member, closing the object
+};
+
+// Writes members straight into a string, the way rapidjson's Writer prints
+// them. Every member carries its comma, EmitJson turns the first into '{'.
+class JsonWriter {
+public:
+  explicit JsonWriter(std::string &out) : out_(out) {}
+
+  void String(const Key &k, Field v) {
+    out_ += k.prefix_;
+    Quote(v, out_);
+  }
+  void Int64(const Key &k, int64_t v);
+  void Double(const Key &k, double v);
+  void Raw(const string &s) { out_ += s; }
+
+  // appends s as an escaped JSON string
+  static void Quote(Field s, std::string &out);
+
+private:
+  std::string &out_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonWriter);
+};
+
+// Keeps the members of a line an aggregation reads, numbers and views into
+// the line or the plan, as handlers add them, and drops the others. A
+// member added again replaces the one before, as a replacing step does.
+class Projection {
+public:
+  Projection() = default;
+  explicit Projection(const std::vector<string> &names);
+
+  size_t Size() const { return members_.size(); }
+  const string &Name(size_t i) const { return members_[i].name_; }
+  // a member of the line, Null when it was not added, a String one in s
+  const util::Cell &Get(size_t i, Field &s) const {
+    s = members_[i].string_;
+    return members_[i].cell_;
+  }
+  // the slot of a member, Size() for one not kept
+  size_t Slot(const string &name) const;
+  void Set(size_t i, const util::Cell &c, Field s = Field()) {
+    members_[i].cell_   = c;
+    members_[i].string_ = s;
+  }
+
+  // before each line
+  void Clear() {
+    for (auto &m : members_) {
+      m.cell_.type_ = util::Type::Null;
+    }
+  }
+
+  void String(const Key &k, Field v) {
+    if (Member *m = find(k)) {
+      m->cell_.type_ = util::Type::String;
+      m->string_     = v;
+    }
+  }
+  void Int64(const Key &k, int64_t v) {
+    if (Member *m = find(k)) {
+      m->cell_ = util::Cell::Int64(v);
+    }
+  }
+  void Double(const Key &k, double v) {
+    if (Member *m = find(k)) {
+      m->cell_ = util::Cell::Double(v);
+    }
+  }
+
+private:
+  struct Member {
+    string name_;
+    util::Cell cell_;
+    Field string_;
+  };
+
+  // a few members, compared by size first
+  Member *find(const Key &k) {
+    for (auto &m : members_) {
+      if (m.name_.size() == k.name_.size() && m.name_ == k.name_) {
+        return &m;
+      }
+    }
+    return nullptr;
+  }
+
+  std::vector<Member> members_;
+};
+
+inline Value key_value(const Key &k) {
+  return Value(StringRef(k.name_.data(), k.name_.size()));
+}
+
+// adds a string member, the key is referenced and must outlive doc
+inline void add_string(Document &doc, const Key &k, Field v) {
+  Value val(v.data(), static_cast<SizeType>(v.size()), doc.GetAllocator());
+  doc.AddMember(key_value(k), val.Move(), doc.GetAllocator());
+}
+
+// adds a string member referring to v, which must outlive doc too
+inline void add_string_ref(Document &doc, const Key &k, Field v) {
+  Value val(StringRef(v.data(), v.size()));
+  doc.AddMember(key_value(k), val.Move(), doc.GetAllocator());
+}
+
+inline void add_int(Document &doc, const Key &k, int v) {
+  Value val;
+  val.SetInt(v);
+  doc.AddMember(key_value(k), val.Move(), doc.GetAllocator());
+}
+
+inline void add_int64(Document &doc, const Key &k, int64_t v) {
+  Value val;
+  val.SetInt64(v);
+  doc.AddMember(key_value(k), val.Move(), doc.GetAllocator());
+}
+
+inline void add_double(Document &doc, const Key &k, double v) {
+  Value val;
+  val.SetDouble(v);
+  doc.AddMember(key_value(k), val.Move(), doc.GetAllocator());
+}
+
+inline void add_string(JsonWriter &w, const Key &k, Field v) {
+  w.String(k, v);
+}
+
+inline void add_string_ref(JsonWriter &w, const Key &k, Field v) {
+  w.String(k, v);
+}
+
+inline void add_int(JsonWriter &w, const Key &k, int v) { w.Int64(k, v); }
+
+inline void add_int64(JsonWriter &w, const Key &k, int64_t v) {
+  w.Int64(k, v);
+}
+
+inline void add_double(JsonWriter &w, const Key &k, double v) {
+  w.Double(k, v);
+}
+
+inline void add_string(Projection &p, const Key &k, Field v) {
+  p.String(k, v);
+}
+
+inline void add_string_ref(Projection &p, const Key &k, Field v) {
+  p.String(k, v);
+}
+
+inline void add_int(Projection &p, const Key &k, int v) { p.Int64(k, v); }
+
+inline void add_int64(Projection &p, const Key &k, int64_t v) {
+  p.Int64(k, v);
+}
+
+inline void add_double(Projection &p, const Key &k, double v) {
+  p.Double(k, v);
+}
+
+template <typename Iterator = const char *>
 struct RequestGrammar : qi::grammar<Iterator, Request()> {
   RequestGrammar() : RequestGrammar::base_type(request) {
     using namespace qi;
@@ -52,68 +276,71 @@ private:
   qi::rule<Iterator, Request()> request;
 };
 
-inline bool string_handler(Document &doc, string k, string v) {
-  Value key(k.c_str(), doc.GetAllocator()), val(v.c_str(), doc.GetAllocator());
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+template <typename Out>
+inline bool string_handler(Out &out, const Step &s, Field v) {
+  add_string(out, s.key_, v);
   return true;
 }
 
 // int
-inline bool int32_handler(Document &doc, string k, string v) {
-  Value key(k.c_str(), doc.GetAllocator()), val;
+template <typename Out>
+inline bool int32_handler(Out &out, const Step &s, Field v) {
   int num;
-  try {
-    num = std::stoi(v);
-  } catch (const std::exception &e) {
+  if (!fast_stoi(v, num)) {
     return false;
   }
-  val.SetInt(num);
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+  add_int(out, s.key_, num);
   return true;
 };
 
 // long long
-inline bool int64_handler(Document &doc, string k, string v) {
-  Value key(k.c_str(), doc.GetAllocator()), val;
+template <typename Out>
+inline bool int64_handler(Out &out, const Step &s, Field v) {
   int64_t num;
-  try {
-    num = std::stoll(v);
-  } catch (const std::exception &e) {
+  if (!fast_stoll(v, num)) {
     return false;
   }
-  val.SetInt64(num);
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+  add_int64(out, s.key_, num);
   return true;
 };
 
 // double
-inline bool double_handler(Document &doc, string k, string v) {
-  Value key(k.c_str(), doc.GetAllocator()), val;
+// double, inf and nan are rejected, rapidjson's Writer stops at them and
+// leaves half a line
+template <typename Out>
+inline bool double_handler(Out &out, const Step &s, Field v) {
   double num;
-  try {
-    num = std::stod(v);
-  } catch (const std::exception &e) {
+  if (!fast_stod(v, num) || !std::isfinite(num)) {
     return false;
   }
-  val.SetDouble(num);
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+  add_double(out, s.key_, num);
   return true;
 };
 
-// ip address handler
-inline bool ip_handler(Document &doc, string k, string v) {
-  Value key(k.c_str(), doc.GetAllocator()), val(v.c_str(), doc.GetAllocator());
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+// Resolves the addresses the ip steps of plan read from logs in one batch,
+// for the thread's handlers to take. Dropped by the next call, and by
+// DropResolved(), which has to come before the lines go away.
+void ResolveAhead(const std::vector<const Log *> &logs, const Plan &plan);
+void DropResolved();
+// the result resolved ahead for the field of s in the line emitting
+bool TakeResolved(const Step &s, IPResolver::LRUValueType &result);
 
-  IPResolver::ResultType *result;
-  if (!util::ResolveIP(v, &result)) {
-    result = &IPResolver::UnknownResult;
+// ip address handler
+template <typename Out>
+inline bool ip_handler(Out &out, const Step &s, Field v) {
+  add_string(out, s.key_, v);
+
+  IPResolver::LRUValueType result;
+  if (!TakeResolved(s, result) &&
+      !util::ResolveIP(v.data(), v.size(), result)) {
+    result = IPResolver::UnknownResult;
   }
 
-  string_handler(doc, k + "@country", IPResolver::GetCountry(*result));
-  string_handler(doc, k + "@province", IPResolver::GetProvince(*result));
-  string_handler(doc, k + "@city", IPResolver::GetCity(*result));
-  string_handler(doc, k + "@isp", IPResolver::GetISP(*result));
+  // records are interned by the resolver, the members refer to them
+  add_string_ref(out, s.derived_[0], IPResolver::GetCountry(*result));
+  add_string_ref(out, s.derived_[1], IPResolver::GetProvince(*result));
+  add_string_ref(out, s.derived_[2], IPResolver::GetCity(*result));
+  add_string_ref(out, s.derived_[3], IPResolver::GetISP(*result));
 
   return true;
 };
@@ -139,7 +366,7 @@ struct TimeDate {
   int sec_;
 };
 
-template <typename Iterator = std::string::iterator>
+template <typename Iterator = const char *>
 struct TimeLocalGrammar : qi::grammar<Iterator, TimeLocal()> {
   TimeLocalGrammar() : TimeLocalGrammar::base_type(tl) {
     using namespace boost::spirit::qi;
@@ -154,7 +381,7 @@ private:
   qi::rule<Iterator, TimeLocal()> tl;
 };
 
-template <typename Iterator = std::string::iterator>
+template <typename Iterator = const char *>
 struct TimeDateGrammar : qi::grammar<Iterator, TimeDate()> {
   TimeDateGrammar() : TimeDateGrammar::base_type(td) {
     using namespace boost::spirit::qi;
@@ -166,15 +393,21 @@ private:
   qi::rule<Iterator, TimeDate()> td;
 };
 
-inline bool time_local_handler(Document &doc, string k, string s) {
+// the fields of $time_local, at fixed positions or else as the grammar
+// reads them, more loosely
+inline bool time_local_fields(Field v, struct tm &tm, int &offset) {
   static std::map<std::string, unsigned short> month = {
       {"Jan", 0}, {"Feb", 1}, {"Mar", 2}, {"Apr", 3}, {"May", 4},  {"Jun", 5},
       {"Jul", 6}, {"Aug", 7}, {"Sep", 8}, {"Oct", 9}, {"Nov", 10}, {"Dec", 11}};
 
+  if (parse_time_local(v, tm, offset)) {
+    return true;
+  }
+
   static TimeLocalGrammar<> g;
   TimeLocal tl;
 
-  bool ok = qi::parse(s.begin(), s.end(), g, tl);
+  bool ok = qi::parse(v.begin(), v.end(), g, tl);
   if (!ok) {
     return false;
   }
@@ -184,38 +417,31 @@ inline bool time_local_handler(Document &doc, string k, string s) {
     return false;
   }
 
-  struct tm tm = {};
-
   tm.tm_mday = tl.day_;
   tm.tm_mon  = it->second;
   tm.tm_year = tl.year_ - 1900;
   tm.tm_hour = tl.hour_;
   tm.tm_min  = tl.min_;
   tm.tm_sec  = tl.sec_;
-
-  time_t ts = cached_mktime(&tm);
-  if (ts < 0) {
-    return false;
-  }
-
-  Value key(k.c_str(), doc.GetAllocator()), val;
-  val.SetInt64(ts);
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+  offset     = tl.tz_hour_ * 3600 + tl.tz_min_ * 60;
+  offset     = tl.sign_ == '-' ? -offset : offset;
 
   return true;
 }
 
-inline bool time_date_handler(Document &doc, string k, string s) {
+inline bool time_date_fields(Field v, struct tm &tm) {
+  if (parse_time_date(v, tm)) {
+    return true;
+  }
+
   static TimeDateGrammar<> g;
   TimeDate td;
 
-  bool ok = qi::parse(s.begin(), s.end(), g, td);
+  bool ok = qi::parse(v.begin(), v.end(), g, td);
   if (!ok) {
     return false;
   }
 
-  struct tm tm = {};
-
   tm.tm_year = td.year_ - 1900;
   tm.tm_mon  = td.mon_ - 1;
   tm.tm_mday = td.day_;
@@ -223,22 +449,95 @@ inline bool time_date_handler(Document &doc, string k, string s) {
   tm.tm_min  = td.min_;
   tm.tm_sec  = td.sec_;
 
-  time_t ts = cached_mktime(&tm);
-  if (ts < 0) {
-    return false;
+  return true;
+}
+
+// The time with its offset, in seconds since the epoch. Lines of a second
+// carry the same text, the last one converted is kept per thread.
+template <typename Out>
+inline bool time_local_handler(Out &out, const Step &s, Field v) {
+  thread_local std::string last;
+  thread_local int64_t last_ts = -1;
+
+  if (last_ts < 0 || v != Field(last)) {
+    struct tm tm = {};
+    int offset;
+    if (!time_local_fields(v, tm, offset)) {
+      return false;
+    }
+
+    int64_t ts = civil_seconds(tm) - offset;
+    if (ts < 0) {
+      return false;
+    }
+    last.assign(v.data(), v.size());
+    last_ts = ts;
   }
 
-  Value key(k.c_str(), doc.GetAllocator()), val;
-  val.SetInt64(ts);
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+  add_int64(out, s.key_, last_ts);
 
   return true;
 }
 
-// request handler, like: "GET http://foo.com/bar"
-inline bool request_handler(Document &doc, string, string s) {
+// the time in the local timezone, which it has no offset for
+template <typename Out>
+inline bool time_date_handler(Out &out, const Step &s, Field v) {
+  thread_local std::string last;
+  thread_local int64_t last_ts = -1;
+
+  if (last_ts < 0 || v != Field(last)) {
+    struct tm tm = {};
+    if (!time_date_fields(v, tm)) {
+      return false;
+    }
+
+    time_t ts = cached_mktime(&tm);
+    if (ts < 0) {
+      return false;
+    }
+    last.assign(v.data(), v.size());
+    last_ts = ts;
+  }
+
+  add_int64(out, s.key_, last_ts);
+
+  return true;
+}
+
+// a time in the format of the config, compiled into the step, the last
+// one converted is kept per thread as the built-in handlers keep theirs
+template <typename Out>
+inline bool time_handler(Out &out, const Step &s, Field v) {
+  thread_local uint64_t last_format = 0;
+  thread_local std::string last;
+  thread_local int64_t last_ts = -1;
+
+  if (last_format != s.format_.Id() || v != Field(last)) {
+    int64_t ts;
+    if (!s.format_.Parse(v, ts)) {
+      return false;
+    }
+    last.assign(v.data(), v.size());
+    last_format = s.format_.Id();
+    last_ts     = ts;
+  }
+
+  add_int64(out, s.key_, last_ts);
+
+  return true;
+}
+
+// request handler, like: "GET http://foo.com/bar". The parts are parsed
+// into strings kept per thread, the views a Projection keeps of them last
+// until the next line.
+template <typename Out>
+inline bool request_handler(Out &out, const Step &, Field s) {
   static RequestGrammar<> g;
-  Request request;
+  static const Key method("method"), scheme("scheme"), domain("domain");
+  thread_local Request request;
+  std::get<0>(request).clear();
+  std::get<1>(request).clear();
+  std::get<2>(request).clear();
   auto begin = s.begin();
   auto end   = s.end();
 
@@ -247,27 +546,20 @@ inline bool request_handler(Document &doc, string, string s) {
     return false;
   }
 
-  Value method(std::get<0>(request).c_str(), doc.GetAllocator());
-  Value scheme(std::get<1>(request).c_str(), doc.GetAllocator());
-  Value domain(std::get<2>(request).c_str(), doc.GetAllocator());
-
-  doc.AddMember("method", method.Move(), doc.GetAllocator());
-  doc.AddMember("scheme", scheme.Move(), doc.GetAllocator());
-  doc.AddMember("domain", domain.Move(), doc.GetAllocator());
+  add_string(out, method, std::get<0>(request));
+  add_string(out, scheme, std::get<1>(request));
+  add_string(out, domain, std::get<2>(request));
 
   return true;
 }
 
-inline bool status_handler(Document &doc, string k, string v) {
-  Value key(k.c_str(), doc.GetAllocator()), val;
+template <typename Out>
+inline bool status_handler(Out &out, const Step &s, Field v) {
   int num;
-  try {
-    num = std::stoi(v);
-  } catch (const std::exception &e) {
+  if (!fast_stoi(v, num)) {
     num = 0;
   }
-  val.SetInt(num);
-  doc.AddMember(key.Move(), val.Move(), doc.GetAllocator());
+  add_int(out, s.key_, num);
   return true;
 };
 
@@ -277,7 +569,7 @@ inline char tolower(char in) {
   return in;
 }
 
-inline bool misc_live_filter(Document &doc, string, string) {
+inline bool misc_live_filter(Document &doc, const Step &, Field) {
   std::string method = doc["method"].GetString();
   std::transform(method.begin(), method.end(), method.begin(), tolower);
   if (method != "stop") {
@@ -288,44 +580,85 @@ inline bool misc_live_filter(Document &doc, string, string) {
   return true;
 };
 
-inline bool int64_sum_handler(Document &doc, string k, string v) {
-  Value key(k.c_str(), doc.GetAllocator());
+inline bool int64_sum_handler(Document &doc, const Step &s, Field v) {
   int64_t num;
-  try {
-    num = std::stoll(v);
-  } catch (const std::exception &e) {
+  if (!fast_stoll(v, num)) {
     num = 0;
   }
 
-  if (doc.HasMember(k.c_str())) {
-    Value &val = doc[k.c_str()];
+  const char *key = s.key_.name_.c_str();
+  if (doc.HasMember(key)) {
+    Value &val = doc[key];
     val.SetInt64(val.GetInt64() + num);
   } else {
-    doc.AddMember(key.Move(), num, doc.GetAllocator());
+    add_int64(doc, s.key_, num);
   }
 
   return true;
 };
 
 const Handlers handlers = {
-    {"string", string_handler},
-    {"int", int32_handler},
-    {"int64", int64_handler},
-    {"int64_sum", int64_sum_handler},
-    {"long long", int64_handler},
-    {"double", double_handler},
-    {"ip", ip_handler},
-    {"time_local", time_local_handler},
-    {"time_date", time_date_handler},
-    {"request", request_handler},
-    {"status", status_handler},
-    {"misc_live_filter", misc_live_filter},
-    {"status", status_handler},
+    {"string",
+     {string_handler<Document>, string_handler<JsonWriter>,
+      string_handler<Projection>}},
+    {"int",
+     {int32_handler<Document>, int32_handler<JsonWriter>,
+      int32_handler<Projection>}},
+    {"int64",
+     {int64_handler<Document>, int64_handler<JsonWriter>,
+      int64_handler<Projection>}},
+    {"int64_sum", {int64_sum_handler, nullptr, nullptr}},
+    {"long long",
+     {int64_handler<Document>, int64_handler<JsonWriter>,
+      int64_handler<Projection>}},
+    {"double",
+     {double_handler<Document>, double_handler<JsonWriter>,
+      double_handler<Projection>}},
+    {"ip",
+     {ip_handler<Document>, ip_handler<JsonWriter>,
+      ip_handler<Projection>}},
+    {"time_local",
+     {time_local_handler<Document>, time_local_handler<JsonWriter>,
+      time_local_handler<Projection>}},
+    {"time_date",
+     {time_date_handler<Document>, time_date_handler<JsonWriter>,
+      time_date_handler<Projection>}},
+    {"time",
+     {time_handler<Document>, time_handler<JsonWriter>,
+      time_handler<Projection>}},
+    {"request",
+     {request_handler<Document>, request_handler<JsonWriter>,
+      request_handler<Projection>}},
+    {"status",
+     {status_handler<Document>, status_handler<JsonWriter>,
+      status_handler<Projection>}},
+    {"misc_live_filter", {misc_live_filter, nullptr, nullptr}},
 };
 
 std::string JsonDocToString(Document *doc);
-bool PopulateJsonDoc(Document *doc, const Log &log, const Config &cfg);
-bool LogToJsonString(Log &log, std::string &json, const Config &cfg);
+// appends through a per-thread buffer and writer
+void AppendJsonDoc(Document *doc, std::string &out);
+bool CompilePlan(const Config &cfg, Plan &plan);
+bool PopulateJsonDoc(Document *doc, const Log &log, const Plan &plan);
+// Prepares plan for EmitJson, with path as the "path" member. False when
+// members are read back, or replaced other than as constants, the plan then
+// goes through PopulateJsonDoc. Replaced constants are left out where the
+// document would have moved its last member, the order differs there.
+bool CompileStream(Plan &plan, const std::string &path);
+// appends the line's JSON object to out, nothing when it fails
+bool EmitJson(const Log &log, const Plan &plan, std::string &out);
+bool LogToJsonString(Log &log, std::string &json, const Plan &plan);
+// Compiles into projected the steps of plan adding the members named,
+// with the collectors, an ip step without its derived members wanted not
+// resolving the address. The steps whose conversion can fail stay too, a
+// line drops as its document would. False when a step reads members back from the
+// document, the lines then go through PopulateJsonDoc and ProjectJsonDoc.
+bool CompileProjection(const Plan &plan, const std::vector<string> &members,
+                       Plan &projected);
+// the members of the line a projected plan adds, false when a step fails
+bool ProjectLog(const Log &log, const Plan &projected, Projection &out);
+// the members of a document, referring to its strings
+void ProjectJsonDoc(const Document &doc, Projection &out);
 
 } // namespace json
 } // namespace fluorine
@@ -1,20 +1,59 @@
 #pragma once
 
 #include <string>
+#include <vector>
+#include <forward_list>
+#include <boost/utility/string_ref.hpp>
 #include <boost/spirit/include/qi.hpp>
 
+#include "fluorine/Macros.hpp"
+
 namespace fluorine {
 namespace log {
 
 namespace qi    = boost::spirit::qi;
 namespace ascii = boost::spirit::ascii;
 
-typedef std::string Field;
-typedef std::vector<Field> Log;
-typedef Field::const_iterator iterator_type;
+// a view into the parsed line
+typedef boost::string_ref Field;
+typedef std::string::const_iterator iterator_type;
+
+// The fields of a parsed line, the line must outlive the log. Fields the
+// parser has to assemble rather than slice out of the line are kept here.
+class Log {
+public:
+  typedef std::vector<Field>::const_iterator const_iterator;
+
+  Log() = default;
+
+  size_t size() const { return fields_.size(); }
+  bool empty() const { return fields_.empty(); }
+  const Field &operator[](size_t i) const { return fields_[i]; }
+  const_iterator begin() const { return fields_.begin(); }
+  const_iterator end() const { return fields_.end(); }
+
+  // keeps the capacity, a log reused across lines stops allocating
+  void clear() {
+    fields_.clear();
+    owned_.clear();
+  }
+
+  void push_back(Field field) { fields_.push_back(field); }
+  void push_back(std::string &&field) {
+    owned_.push_front(std::move(field));
+    fields_.push_back(owned_.front());
+  }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(Log);
+
+  std::vector<Field> fields_;
+  std::forward_list<std::string> owned_;
+};
 
 template <typename Iterator>
-struct Grammar : qi::grammar<Iterator, Log(), qi::space_type> {
+struct Grammar
+    : qi::grammar<Iterator, std::vector<std::string>(), qi::space_type> {
   Grammar(unsigned int fn = 0, unsigned int ti = 0)
       : Grammar::base_type(log), field_number(fn), time_index(ti) {
     using namespace qi;
@@ -44,14 +83,19 @@ struct Grammar : qi::grammar<Iterator, Log(), qi::space_type> {
   }
 
 private:
-  qi::rule<Iterator, Field(), qi::no_skip_type> field, quoted, time, timestamp;
-  qi::rule<Iterator, Log(), qi::space_type> log;
+  qi::rule<Iterator, std::string(), qi::no_skip_type> field, quoted, time,
+      timestamp;
+  qi::rule<Iterator, std::vector<std::string>(), qi::space_type> log;
 
   unsigned int field_number, time_index;
 };
 
+// Grammar is the reference definition of the log format, ParseLog splits
+// lines with the equivalent Tokenizer.
 bool ParseLog(std::string &line, Log &log, unsigned int field_number = 0,
               unsigned int time_index = 0);
+bool ParseLog(const char *begin, const char *end, Log &log,
+              unsigned int field_number = 0, unsigned int time_index = 0);
 
 } // namespace log
 } // namespace netease
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "fluorine/log/Parser.hpp"
+
+namespace fluorine {
+namespace log {
+
+// A hand-written equivalent of Grammar: fields are separated by whitespace,
+// "quoted" fields may contain \" escapes and quotes not followed by a blank,
+// and the field at time_index may be a [bracketed] timestamp. It produces the
+// same fields as the grammar, including what the grammar leaves behind when it
+// backtracks out of an unterminated quote or bracket. The delimiters are
+// searched 32 (AVX2) or 16 (SSE2) bytes at a time, picked at runtime.
+class Tokenizer {
+public:
+  Tokenizer(unsigned int field_number = 0, unsigned int time_index = 0)
+      : field_number_(field_number), time_index_(time_index) {}
+
+  bool Tokenize(const char *begin, const char *end, Log &log) const;
+
+  // the instruction set used for delimiter searches
+  static const char *Isa();
+
+private:
+  bool field(const char *&p, const char *end, Log &log) const;
+  bool time(const char *&p, const char *end, Log &log) const;
+
+  unsigned int field_number_;
+  unsigned int time_index_;
+};
+
+} // namespace log
+} // namespace fluorine
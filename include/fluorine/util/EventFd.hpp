@@ -0,0 +1,32 @@
+#pragma once
+
+#include <atomic>
+
+#include "fluorine/Macros.hpp"
+
+namespace fluorine {
+namespace util {
+
+// A wakeup for a thread sleeping in an event loop. Notify() may be called
+// from any thread and makes Fd() readable until the sleeping thread calls
+// Drain(); notifications that arrive while one is pending cost no syscall.
+class EventFd {
+public:
+  EventFd();
+  ~EventFd();
+
+  int Fd() const { return fd_; }
+
+  void Notify();
+  // before looking at what the notifications announced
+  void Drain();
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(EventFd);
+
+  int fd_;
+  std::atomic<bool> pending_;
+};
+
+} // namespace util
+} // namespace fluorine
@@ -1,5 +1,25 @@
 #pragma once
 
 #include <time.h>
+#include <stdint.h>
+#include <boost/utility/string_ref.hpp>
 
+// mktime() through a per-thread cache of the day's midnight
 time_t cached_mktime(struct tm *tm);
+
+// days since 1970-01-01 of a proleptic Gregorian date, month from 1 to 12
+int64_t days_from_civil(int64_t year, unsigned mon, unsigned day);
+// seconds since the epoch of tm taken as UTC, without the libc timezone.
+// Fields out of range carry over as in mktime().
+int64_t civil_seconds(const struct tm &tm);
+
+// nginx's $time_local, dd/Mon/yyyy:HH:MM:SS +zzzz, read at fixed positions
+// into tm and the offset east of UTC in seconds. What follows is ignored.
+bool parse_time_local(boost::string_ref s, struct tm &tm, int &offset);
+// yyyy-mm-dd HH:MM:SS, read at fixed positions
+bool parse_time_date(boost::string_ref s, struct tm &tm);
+
+// std::stoi, std::stoll and std::stod on a view, false where they throw
+bool fast_stoi(boost::string_ref s, int &num);
+bool fast_stoll(boost::string_ref s, int64_t &num);
+bool fast_stod(boost::string_ref s, double &num);
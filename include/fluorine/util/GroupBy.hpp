@@ -0,0 +1,623 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "fluorine/util/Sketch.hpp"
+
+namespace fluorine {
+namespace util {
+
+// the type of a term in a key, or of a group's value
+enum class Type : uint8_t { Null, Int64, Double, String };
+
+// how a group folds a value of its lines
+enum class Fold : uint8_t {
+  Sum,      // added up, of the type of the first value
+  First,    // the first line's
+  Min,      // the least, of the type of the first value
+  Max,      // the greatest, of the type of the first value
+  Count,    // of the values, an Int64
+  Distinct, // the Int64 hashes into a HyperLogLog
+  Quantile, // the numbers into a DDSketch
+};
+
+// A value of a group, or a term read back from a key. The cell of a
+// Distinct or Quantile fold points to its group's sketch, owned by the
+// GroupBy and valid until the group is emitted.
+struct Cell {
+  Type type_ = Type::Null;
+  union {
+    int64_t int64_ = 0;
+    double double_;
+    HyperLogLog *distinct_;
+    DDSketch *quantile_;
+  };
+
+  static Cell Int64(int64_t v) {
+    Cell c;
+    c.type_  = Type::Int64;
+    c.int64_ = v;
+    return c;
+  }
+  static Cell Double(double v) {
+    Cell c;
+    c.type_   = Type::Double;
+    c.double_ = v;
+    return c;
+  }
+
+  double Number() const {
+    return type_ == Type::Double ? double_ : static_cast<double>(int64_);
+  }
+};
+
+// Appends terms to a key compared byte for byte: a tag of the type, then the
+// 8 bytes of a number, or the 4 byte length and the bytes of a string, so
+// equal keys are equal tuples of terms.
+class KeyWriter {
+public:
+  explicit KeyWriter(std::string &key) : key_(key) {}
+
+  void Null() { key_ += static_cast<char>(Type::Null); }
+  void Int64(int64_t v) {
+    key_ += static_cast<char>(Type::Int64);
+    key_.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+  void Double(double v) {
+    v = v == 0 ? 0.0 : v; // -0.0 groups with 0.0
+    key_ += static_cast<char>(Type::Double);
+    key_.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+  void String(boost::string_ref v) {
+    uint32_t size = static_cast<uint32_t>(v.size());
+    key_ += static_cast<char>(Type::String);
+    key_.append(reinterpret_cast<const char *>(&size), sizeof(size));
+    key_.append(v.data(), v.size());
+  }
+
+private:
+  std::string &key_;
+};
+
+// Reads back the terms KeyWriter packed, in order.
+class KeyReader {
+public:
+  explicit KeyReader(const std::string &key)
+      : p_(key.data()), end_(key.data() + key.size()) {}
+
+  // the next term, a string one in s, false past the last
+  bool Next(Cell &term, boost::string_ref &s) {
+    if (p_ == end_) {
+      return false;
+    }
+    term.type_ = static_cast<Type>(*p_++);
+    switch (term.type_) {
+    case Type::Int64:
+      memcpy(&term.int64_, p_, sizeof(term.int64_));
+      p_ += sizeof(term.int64_);
+      break;
+    case Type::Double:
+      memcpy(&term.double_, p_, sizeof(term.double_));
+      p_ += sizeof(term.double_);
+      break;
+    case Type::String: {
+      uint32_t size;
+      memcpy(&size, p_, sizeof(size));
+      s = boost::string_ref(p_ + sizeof(size), size);
+      p_ += sizeof(size) + size;
+      break;
+    }
+    case Type::Null:
+      break;
+    }
+    return true;
+  }
+
+private:
+  const char *p_;
+  const char *end_;
+};
+
+// Groups lines by an exact key within windows of their time, each group a
+// count and a cell per fold.
+//
+// The sketches of the Distinct and Quantile folds are made as groups need
+// them and recycled, cleared, once their groups are emitted: a table holds
+// at most a sketch a fold for each group it held at once.
+//
+// The groups and their cells live in arrays allocated up front, linked into
+// a list per window in the order they were made; an open-addressing table
+// with linear probing maps keys to them, comparing the keys in full where
+// the hashes match. The latest time added, less the lateness, is the
+// watermark: a window ending at or before it is emitted whole and closed,
+// the lines still coming for it dropped. A full table emits its oldest
+// window early, Flush() emits all of them, oldest first.
+//
+// A held table closes its windows on Close() only, a partial of one fed by
+// several threads: Merge() folds the groups of another's windows into it,
+// and its windows are then emitted in the order of their first lines.
+template <class Hash = std::hash<std::string>>
+class GroupBy {
+  static const uint32_t kNil = UINT32_MAX;
+
+  struct Slot {
+    uint32_t index_ = kNil;
+    uint32_t hash_  = 0;
+  };
+
+  struct Group {
+    std::string key_;
+    int64_t count_  = 0;
+    uint64_t first_ = 0;    // the sequence of its first line
+    uint32_t slot_  = 0;    // in the table
+    uint32_t next_  = kNil; // in its window, or free
+  };
+
+  struct Window {
+    uint32_t head_ = kNil;
+    uint32_t tail_ = kNil;
+  };
+
+public:
+  using OnEmit = std::function<void(const std::string &key, int64_t count,
+                                    const Cell *cells)>;
+
+  // interval 0 puts every line in one window, emitted by Flush() only
+  GroupBy(std::vector<Fold> folds, size_t capacity, OnEmit emit,
+          int64_t interval = 0, int64_t lateness = 0)
+      : folds_(std::move(folds)), capacity_(capacity ? capacity : 1),
+        interval_(interval), lateness_(lateness), emit_(emit) {
+    size_t slots = 2;
+    while (slots < capacity_ * 2) {
+      slots *= 2;
+    }
+    mask_ = slots - 1;
+    table_.resize(slots);
+    groups_.resize(capacity_);
+    cells_.resize(capacity_ * folds_.size());
+    for (size_t i = 0; i < capacity_; ++i) {
+      groups_[i].next_ = i + 1 < capacity_ ? i + 1 : kNil;
+    }
+  }
+
+  size_t Size() const { return size_; }
+  size_t Capacity() const { return capacity_; }
+  size_t Windows() const { return windows_.size(); }
+
+  // the window of a time, its start
+  int64_t WindowOf(int64_t time) const {
+    return interval_ ? time - time % interval_ : 0;
+  }
+
+  // the first window left open once the latest time is latest, the ones
+  // before it ending at or before the watermark
+  int64_t ClosedBy(int64_t latest) const {
+    if (!interval_ || latest == INT64_MIN) {
+      return INT64_MIN;
+    }
+    return WindowOf(latest - lateness_ - interval_) + interval_;
+  }
+
+  // lines dropped for their closed windows, windows emitted while open
+  uint64_t Late() const { return late_; }
+  uint64_t Early() const { return early_; }
+
+  // closes windows on Close() only, from now on
+  void Hold() { held_ = true; }
+
+  // folds cells, one per fold, into the group of key in the window of time,
+  // false when that window is closed
+  bool Add(int64_t time, const std::string &key, const Cell *cells) {
+    return Add(time, key, cells, lines_);
+  }
+
+  // the same for the line numbered seq, numbered in input order across
+  // the tables merged
+  bool Add(int64_t time, const std::string &key, const Cell *cells,
+           uint64_t seq) {
+    int64_t window = WindowOf(time);
+    if (window < closed_) {
+      ++late_;
+      return false;
+    }
+    lines_ = seq + 1;
+
+    uint32_t hash = mix(key);
+    size_t pos    = probe(key, hash);
+    size_t width  = folds_.size();
+
+    uint32_t i = table_[pos].index_;
+    if (i == kNil) {
+      i       = make(window, key, hash, pos, seq);
+      Cell *c = &cells_[i * width];
+      for (size_t j = 0; j < width; ++j) {
+        init(folds_[j], c[j], cells[j]);
+      }
+      groups_[i].count_ = 1;
+    } else {
+      Group &g = groups_[i];
+      ++g.count_;
+      // a line numbered before the group's first, added after it
+      bool first = seq < g.first_;
+      g.first_   = std::min(g.first_, seq);
+      Cell *c    = &cells_[i * width];
+      for (size_t j = 0; j < width; ++j) {
+        if (first && folds_[j] == Fold::First) {
+          c[j] = cells[j];
+        } else {
+          fold(folds_[j], c[j], cells[j]);
+        }
+      }
+    }
+
+    if (!held_ && interval_ && time > latest_) {
+      latest_ = time;
+      Close(ClosedBy(latest_));
+    }
+    return true;
+  }
+
+  // folds the groups of the windows of other starting before window into
+  // the groups of their keys here, leaving other without them. Both fold
+  // the same way, the First cells kept from the group seen first.
+  void Merge(GroupBy &other, int64_t window) {
+    size_t width = folds_.size();
+    merged_      = true;
+    while (!other.windows_.empty() && other.windows_.begin()->first < window) {
+      auto w = other.windows_.begin();
+      other.drain(w, [&](const Group &g, const Cell *in) {
+        uint32_t hash = mix(g.key_);
+        size_t pos    = probe(g.key_, hash);
+        uint32_t i    = table_[pos].index_;
+        if (i == kNil) {
+          i       = make(w->first, g.key_, hash, pos, g.first_);
+          Cell *c = &cells_[i * width];
+          for (size_t j = 0; j < width; ++j) {
+            copy(folds_[j], c[j], in[j]);
+          }
+          groups_[i].count_ = g.count_;
+          return;
+        }
+
+        Group &mine = groups_[i];
+        bool first  = mine.first_ < g.first_;
+        Cell *c     = &cells_[i * width];
+        for (size_t j = 0; j < width; ++j) {
+          merge(folds_[j], c[j], in[j], first);
+        }
+        mine.count_ += g.count_;
+        mine.first_ = std::min(mine.first_, g.first_);
+      });
+    }
+  }
+
+  // emits and closes the windows starting before window
+  void Close(int64_t window) {
+    while (!windows_.empty() && windows_.begin()->first < window) {
+      emit(windows_.begin());
+    }
+    closed_ = std::max(closed_, window);
+  }
+
+  void Flush() {
+    while (!windows_.empty()) {
+      emit(windows_.begin());
+    }
+  }
+
+  // the bytes held for the groups, keys and windows included
+  size_t MemoryUsage() const {
+    size_t bytes = sizeof(*this) + table_.capacity() * sizeof(Slot) +
+                   groups_.capacity() * sizeof(Group) +
+                   cells_.capacity() * sizeof(Cell) +
+                   windows_.size() * (sizeof(Window) + 6 * sizeof(void *));
+    size_t inline_capacity = std::string().capacity();
+    for (auto &g : groups_) {
+      if (g.key_.capacity() > inline_capacity) {
+        bytes += g.key_.capacity() + 1;
+      }
+    }
+    bytes += distincts_.size() * sizeof(HyperLogLog);
+    for (auto &q : quantiles_) {
+      bytes += q->MemoryUsage();
+    }
+    return bytes;
+  }
+
+private:
+  // the first value of a group
+  void init(Fold f, Cell &c, const Cell &in) {
+    switch (f) {
+    case Fold::Count:
+      c = Cell::Int64(in.type_ != Type::Null);
+      return;
+    case Fold::Distinct:
+      c           = Cell();
+      c.distinct_ = take(distincts_, free_distincts_);
+      break;
+    case Fold::Quantile:
+      c           = Cell();
+      c.quantile_ = take(quantiles_, free_quantiles_);
+      break;
+    default:
+      c = in;
+      return;
+    }
+    fold(f, c, in);
+  }
+
+  // the cell of a group merged in from another table
+  void copy(Fold f, Cell &c, const Cell &in) {
+    if (f == Fold::Distinct) {
+      c           = Cell();
+      c.distinct_ = take(distincts_, free_distincts_);
+      c.distinct_->Merge(*in.distinct_);
+    } else if (f == Fold::Quantile) {
+      c           = Cell();
+      c.quantile_ = take(quantiles_, free_quantiles_);
+      c.quantile_->Merge(*in.quantile_);
+    } else {
+      c = in;
+    }
+  }
+
+  // the cell of a group of another table into this one's, first when this
+  // one saw the key first
+  void merge(Fold f, Cell &c, const Cell &in, bool first) {
+    switch (f) {
+    case Fold::First:
+      if (!first) {
+        c = in;
+      }
+      break;
+    case Fold::Count:
+      c.int64_ += in.int64_;
+      break;
+    case Fold::Distinct:
+      c.distinct_->Merge(*in.distinct_);
+      break;
+    case Fold::Quantile:
+      c.quantile_->Merge(*in.quantile_);
+      break;
+    default:
+      // the folds of a value, what the other folded is one
+      if (in.type_ != Type::Null) {
+        fold(f, c, in);
+      }
+      break;
+    }
+  }
+
+  // a value of a later line of the group
+  void fold(Fold f, Cell &c, const Cell &in) {
+    switch (f) {
+    case Fold::Sum:
+      if (c.type_ == Type::Null) {
+        c = in;
+      } else if (c.type_ == in.type_) {
+        if (c.type_ == Type::Int64) {
+          c.int64_ += in.int64_;
+        } else if (c.type_ == Type::Double) {
+          c.double_ += in.double_;
+        }
+      }
+      break;
+    case Fold::First:
+      break;
+    case Fold::Min:
+    case Fold::Max:
+      if (c.type_ == Type::Null) {
+        c = in;
+      } else if (c.type_ == in.type_ && c.type_ == Type::Int64) {
+        c.int64_ = f == Fold::Min ? std::min(c.int64_, in.int64_)
+                                  : std::max(c.int64_, in.int64_);
+      } else if (c.type_ == in.type_ && c.type_ == Type::Double) {
+        c.double_ = f == Fold::Min ? std::min(c.double_, in.double_)
+                                   : std::max(c.double_, in.double_);
+      }
+      break;
+    case Fold::Count:
+      c.int64_ += in.type_ != Type::Null;
+      break;
+    case Fold::Distinct:
+      if (in.type_ == Type::Int64) {
+        c.distinct_->Add(static_cast<uint64_t>(in.int64_));
+      }
+      break;
+    case Fold::Quantile:
+      if (in.type_ == Type::Int64 || in.type_ == Type::Double) {
+        c.quantile_->Add(in.Number());
+      }
+      break;
+    }
+  }
+
+  // a sketch off the free ones, or a new one
+  template <class T>
+  static T *take(std::vector<std::unique_ptr<T>> &made,
+                 std::vector<T *> &free) {
+    if (free.empty()) {
+      made.emplace_back(new T());
+      return made.back().get();
+    }
+    T *sketch = free.back();
+    free.pop_back();
+    return sketch;
+  }
+
+  // gives the sketches of a group's cells back, cleared
+  void release(Cell *c) {
+    for (size_t j = 0; j < folds_.size(); ++j) {
+      if (folds_[j] == Fold::Distinct) {
+        c[j].distinct_->Clear();
+        free_distincts_.push_back(c[j].distinct_);
+      } else if (folds_[j] == Fold::Quantile) {
+        c[j].quantile_->Clear();
+        free_quantiles_.push_back(c[j].quantile_);
+      }
+    }
+  }
+
+  uint32_t mix(const std::string &key) const {
+    uint64_t h = static_cast<uint64_t>(hash_(key));
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<uint32_t>(h);
+  }
+
+  // the slot holding key, or the empty slot ending its probe sequence
+  size_t probe(const std::string &key, uint32_t hash) const {
+    size_t pos = hash & mask_;
+    for (;;) {
+      const Slot &slot = table_[pos];
+      if (slot.index_ == kNil ||
+          (slot.hash_ == hash && groups_[slot.index_].key_ == key)) {
+        return pos;
+      }
+      pos = (pos + 1) & mask_;
+    }
+  }
+
+  // empties a table slot, shifting back the groups probing past it so no
+  // tombstones are needed
+  void erase(size_t pos) {
+    for (;;) {
+      table_[pos] = Slot();
+      size_t next = pos;
+      for (;;) {
+        next = (next + 1) & mask_;
+        if (table_[next].index_ == kNil) {
+          return;
+        }
+        // stays when its home is cyclically in (pos, next]
+        size_t home = table_[next].hash_ & mask_;
+        if (pos <= next ? (pos < home && home <= next)
+                        : (pos < home || home <= next)) {
+          continue;
+        }
+        break;
+      }
+      uint32_t i       = table_[next].index_;
+      table_[pos]      = table_[next];
+      groups_[i].slot_ = static_cast<uint32_t>(pos);
+      pos              = next;
+    }
+  }
+
+  // a group of key in window at pos, its cells left to fill, the oldest
+  // window emitted early when the table is full
+  uint32_t make(int64_t window, const std::string &key, uint32_t hash,
+                size_t pos, uint64_t seq) {
+    if (size_ == capacity_) {
+      ++early_;
+      emit(windows_.begin());
+      // the erases may have shifted the probe sequence
+      pos = probe(key, hash);
+    }
+
+    uint32_t i = free_;
+    Group &g   = groups_[i];
+    free_      = g.next_;
+    g.key_.assign(key);
+    g.count_ = 0;
+    g.first_ = seq;
+    g.slot_  = static_cast<uint32_t>(pos);
+    g.next_  = kNil;
+
+    Window &w = windows_[window];
+    if (w.tail_ == kNil) {
+      w.head_ = i;
+    } else {
+      groups_[w.tail_].next_ = i;
+    }
+    w.tail_ = i;
+
+    table_[pos].index_ = i;
+    table_[pos].hash_  = hash;
+    ++size_;
+    return i;
+  }
+
+  // emits the groups of a window
+  void emit(typename std::map<int64_t, Window>::iterator w) {
+    drain(w, [this](const Group &g, const Cell *cells) {
+      if (emit_) {
+        emit_(g.key_, g.count_, cells);
+      }
+    });
+  }
+
+  // hands the groups of a window to f in the order they were made, or of
+  // their first lines once merged, and frees them, their keys keeping their
+  // buffers for the groups made in their place
+  template <class F>
+  void drain(typename std::map<int64_t, Window>::iterator w, F f) {
+    order_.clear();
+    for (uint32_t i = w->second.head_; i != kNil; i = groups_[i].next_) {
+      order_.push_back(i);
+    }
+    if (merged_) {
+      std::sort(order_.begin(), order_.end(), [this](uint32_t a, uint32_t b) {
+        return groups_[a].first_ < groups_[b].first_;
+      });
+    }
+
+    size_t width = folds_.size();
+    for (uint32_t i : order_) {
+      Group &g = groups_[i];
+      f(g, &cells_[i * width]);
+      release(&cells_[i * width]);
+      erase(g.slot_);
+      g.key_.clear();
+
+      g.next_ = free_;
+      free_   = i;
+      --size_;
+    }
+    windows_.erase(w);
+  }
+
+private:
+  std::vector<Fold> folds_;
+  std::vector<Slot> table_;
+  std::vector<Group> groups_;
+  std::vector<Cell> cells_; // the groups' cells, a row of folds_ each
+  std::map<int64_t, Window> windows_;
+  std::vector<uint32_t> order_; // of the groups of a window emitted
+  std::vector<std::unique_ptr<HyperLogLog>> distincts_;
+  std::vector<std::unique_ptr<DDSketch>> quantiles_;
+  std::vector<HyperLogLog *> free_distincts_;
+  std::vector<DDSketch *> free_quantiles_;
+  size_t mask_;
+  uint32_t free_ = 0;
+  size_t size_   = 0;
+  size_t capacity_;
+  int64_t interval_;
+  int64_t lateness_;
+  int64_t latest_ = INT64_MIN;
+  int64_t closed_ = INT64_MIN; // windows before it are emitted
+  uint64_t late_  = 0;
+  uint64_t early_ = 0;
+  uint64_t lines_ = 0;    // the sequence of the next line added
+  bool held_      = false;
+  bool merged_    = false;
+  Hash hash_;
+  OnEmit emit_;
+};
+
+template <class Hash>
+const uint32_t GroupBy<Hash>::kNil;
+
+} // namespace util
+} // namespace fluorine
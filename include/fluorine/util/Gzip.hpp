@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "fluorine/Macros.hpp"
+
+namespace fluorine {
+namespace util {
+
+// Finds the offsets where gzip members may start, none when the data does
+// not start with the gzip magic and deflate method. BGZF files (bgzip)
+// record their block sizes, so their members are exact; for other files the
+// ones past the first are candidate headers, which may also be false
+// positives inside the deflate data and must be validated by decoding.
+std::vector<size_t> FindGzipMembers(const unsigned char *data, size_t size);
+
+// Decompresses a gzip file and passes the output, in order, to a sink.
+// Multi-member files (pigz -i, bgzip, concatenated parts) are split at member
+// boundaries and inflated on several threads; a split that turns out not to
+// be a member boundary falls back to sequential decoding from the last good
+// one. Single member files are inflated by one readahead thread into large
+// buffers.
+class GzipReader {
+public:
+  using Sink = std::function<void(const char *data, size_t size)>;
+
+  static const size_t kBufferSize = 4 * 1024 * 1024;
+  static const size_t kChunkSize  = 4 * 1024 * 1024;
+
+  explicit GzipReader(size_t threads) : threads_(threads) {}
+
+  bool Read(const std::string &path, const Sink &sink);
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(GzipReader);
+
+  bool ReadParallel(const unsigned char *data, size_t size,
+                    const std::vector<size_t> &splits, const Sink &sink);
+  bool ReadAhead(const unsigned char *data, size_t size, size_t offset,
+                 const Sink &sink);
+
+  size_t threads_;
+};
+
+} // namespace util
+} // namespace fluorine
@@ -1,51 +1,252 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <array>
 #include <string>
 #include <vector>
-#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
 
+#include <boost/utility/string_ref.hpp>
+
+#include "fluorine/Macros.hpp"
 #include "fluorine/util/LRUCache.hpp"
 
 namespace fluorine {
 namespace util {
-// IP resolver(ipip.net)
+// an IPv6 address in host byte order, split in halves
+struct IPv6 {
+  uint64_t hi_;
+  uint64_t lo_;
+
+  bool operator<(const IPv6 &other) const {
+    return hi_ < other.hi_ || (hi_ == other.hi_ && lo_ < other.lo_);
+  }
+  bool operator==(const IPv6 &other) const {
+    return hi_ == other.hi_ && lo_ == other.lo_;
+  }
+};
+
+// IP resolver(ipip.net), with IPv6 ranges from a text database
 class IPResolver {
 public:
-  using LRUValueType = std::shared_ptr<std::vector<std::string>>;
-  using LRUType      = LRUCache<std::string, LRUValueType>;
-  using ResultType   = std::vector<std::string>;
-
   typedef unsigned char byte;
 
   static const int ResultLengthMax = UCHAR_MAX;
   static const int FieldNumber     = 5;
   static const size_t LRUCapacity  = 32768;
-  static ResultType UnknownResult;
 
-  static std::string &GetCountry(ResultType &result) { return result[0]; }
-  static std::string &GetProvince(ResultType &result) { return result[1]; }
-  static std::string &GetCity(ResultType &result) { return result[2]; }
-  static std::string &GetISP(ResultType &result) { return result[4]; }
+  // the fields of a record, referring to its text in the mapped index
+  using ResultType = std::array<boost::string_ref, FieldNumber>;
+  // records are interned for the life of the process, results point to them
+  using LRUValueType = const ResultType *;
+  using LRUType      = LRUCache<uint32_t, LRUValueType>;
+
+  static LRUValueType UnknownResult;
 
+  static boost::string_ref GetCountry(const ResultType &result) {
+    return result[0];
+  }
+  static boost::string_ref GetProvince(const ResultType &result) {
+    return result[1];
+  }
+  static boost::string_ref GetCity(const ResultType &result) {
+    return result[2];
+  }
+  static boost::string_ref GetISP(const ResultType &result) {
+    return result[4];
+  }
+
+  // Maps the index of the database from the file next to it, <db>.idx1,
+  // building it first when it is missing or was built from another version
+  // of the database. One process at a time builds it, the others wait and
+  // map it, instances on a host share its pages. An index that cannot be
+  // written there is kept private.
   IPResolver(const char *db_path);
   IPResolver(const char *db_data, const size_t db_size);
   ~IPResolver();
-  bool Resolve(const std::string &ip, ResultType **result);
+  // thread-safe, lookups share the index and take the lock of one cache
+  // stripe. The result stays valid after being evicted from the cache and
+  // after a reload, for the life of the process
+  bool Resolve(const char *ip, size_t size, LRUValueType &result);
+  bool Resolve(const std::string &ip, LRUValueType &result) {
+    return Resolve(ip.data(), ip.size(), result);
+  }
+  // resolves n addresses together, the IPv4 ones parsed first and looked up
+  // in a run. Addresses failing to parse get UnknownResult. The cache is
+  // left out, the index answers sooner than its locked lookup.
+  void Resolve(const boost::string_ref *ips, size_t n, LRUValueType *results);
+  // parses dotted-quad text into an address in host byte order, accepting
+  // what the Spirit grammar it replaced accepted: four '.' separated octets
+  // of one to three digits, with leading zeros, and anything after them
+  static bool ParseIPv4(const char *s, const char *end, uint32_t &ip);
+  // the record of an address in host byte order, no cache lock
+  LRUValueType Lookup(uint32_t ip) const;
+  // the records of n addresses, looked up together in one index
+  void Lookup(const uint32_t *ips, size_t n, LRUValueType *records) const;
+
+  // loads IPv6 ranges, without them IPv6 addresses resolve to "IPv6". The
+  // database is text, a range per line in increasing order and disjoint:
+  //   <first address>\t<last address>\t<record fields>
+  // the fields tab separated as in the IPv4 records, '#' starts a comment.
+  // Its index is mapped from <db>.idx1 as the IPv4 one
+  bool LoadIPv6(const char *db_path);
+  bool LoadIPv6(const char *db_data, const size_t db_size);
+  // parses IPv6 text accepting what inet_pton accepts, groups of up to four
+  // hex digits, one "::" and a dotted quad at the end, nothing after it
+  static bool ParseIPv6(const char *s, const char *end, IPv6 &ip);
+  // the record of an IPv6 address, searched like the IPv4 one
+  LRUValueType Lookup(const IPv6 &ip) const;
+
+  // maps the indexes of the database files again, off the hot path, those
+  // of changed files rebuilt, and swaps them in. Lookups keep going on the
+  // old ones meanwhile, and for good if a file fails to load
+  bool Reload();
+  // reloads from a thread of its own on RequestReload(), and when a database
+  // file changes if interval is not 0, checking every interval seconds
+  void Watch(int interval);
+  // async-signal-safe, for a SIGHUP handler
+  static void RequestReload();
+
+  size_t Ranges() const;
+  size_t Ranges6() const;
+  size_t Records() const;
 
 private:
   DISALLOW_COPY_AND_ASSIGN(IPResolver);
-  void Init();
 
-  byte *data_      = nullptr;
-  byte *index_     = nullptr;
-  uint32_t *flag_  = nullptr;
-  uint32_t offset_ = 0;
-  LRUType lru_     = LRUType(LRUCapacity);
+  // An index image mapped read-only, the file or, built in memory, a
+  // private copy. Unmapped but for the record texts when its index is
+  // freed, the interned records refer to those.
+  struct Image {
+    Image(const char *data, size_t size) : data_(data), size_(size) {}
+    ~Image();
+
+    const char *data_;
+    size_t size_;
+
+  private:
+    DISALLOW_COPY_AND_ASSIGN(Image);
+  };
+
+  // the database flattened into an image: the last address of every range,
+  // sorted, the first range ending in each /16 prefix, and the record of
+  // each range, shared by the ranges with the same text
+  struct IPv4Index {
+    IPv4Index(const char *data, size_t size) : image_(data, size) {}
+
+    Image image_;
+    const uint32_t *ends_;
+    const uint32_t *jump_;
+    const uint32_t *ranges_;
+    size_t size_;
+    std::vector<LRUValueType> records_;
+
+    LRUValueType Lookup(uint32_t ip) const {
+      const uint32_t *b = ends_ + jump_[ip >> 16];
+      const uint32_t *e = ends_ + jump_[(ip >> 16) + 1];
+      // the range holding ip ends in this /16 or is the first one after it
+      while (b < e) {
+        const uint32_t *mid = b + (e - b) / 2;
+        if (*mid < ip) {
+          b = mid + 1;
+        } else {
+          e = mid;
+        }
+      }
+      return records_[ranges_[b - ends_]];
+    }
+    void Lookup(const uint32_t *ips, size_t n, LRUValueType *records) const;
+  };
+
+  // the same for IPv6. Allocations crowd into a few /16 prefixes, a prefix
+  // with many ranges has its own jump table over the next 12 bits at
+  // dense_[prefix] in sub_
+  struct IPv6Index {
+    IPv6Index(const char *data, size_t size) : image_(data, size) {}
+
+    Image image_;
+    const IPv6 *ends_;
+    const uint32_t *jump_;
+    const uint32_t *dense_;
+    const uint32_t *sub_;
+    const uint32_t *ranges_;
+    size_t size_;
+    std::vector<LRUValueType> records_;
+
+    LRUValueType Lookup(const IPv6 &ip) const {
+      const uint32_t *jump = jump_ + (ip.hi_ >> 48);
+      if (dense_[ip.hi_ >> 48] != UINT32_MAX) {
+        jump = sub_ + dense_[ip.hi_ >> 48] + ((ip.hi_ >> 36) & 0xFFF);
+      }
+      const IPv6 *b = ends_ + jump[0];
+      const IPv6 *e = ends_ + jump[1];
+      while (b < e) {
+        const IPv6 *mid = b + (e - b) / 2;
+        if (*mid < ip) {
+          b = mid + 1;
+        } else {
+          e = mid;
+        }
+      }
+      return records_[ranges_[b - ends_]];
+    }
+  };
+
+  // the image of a database, empty when the database is bad
+  static std::string BuildIPv4(const char *data, size_t size);
+  static std::string BuildIPv6(const char *data, size_t size);
+  // the index searching a mapped image, null when it is not one of the
+  // database with the stamp source, when given. Owns the mapping then.
+  static IPv4Index *OpenIPv4(const char *data, size_t size,
+                             const uint64_t *source);
+  static IPv6Index *OpenIPv6(const char *data, size_t size,
+                             const uint64_t *source);
+  // under reload_mutex_, or before the resolver is shared. Frees the
+  // indexes swapped out once no reader holds them
+  void Swap(IPv4Index *v4, IPv6Index *v6);
+  // resolves an IPv6 address, but for an IPv4-mapped one, left to the
+  // caller as addr with result null
+  bool ResolveIPv6(const char *ip, size_t size, LRUValueType &result,
+                   uint32_t &addr) const;
+
+  // A reader pins the index it loads in a hazard slot of its thread for a
+  // whole lookup or batch, see IPResolver.cpp
+  std::atomic<const IPv4Index *> v4_{nullptr};
+  std::atomic<const IPv6Index *> v6_{nullptr};
+
+  // empty when built from memory, not reloaded then
+  std::string db_path_;
+  std::string db6_path_;
+  std::mutex reload_mutex_;
+  std::thread watcher_;
+  std::condition_variable stop_cond_;
+  bool stop_ = false;
+
+  // The cache of resolved IPv4 addresses, striped by address so threads
+  // resolving at once mostly take different locks. Cleared with the IPv4
+  // index swapped out.
+  static const int CacheShards = 16;
+  struct CacheShard {
+    std::mutex mutex_;
+    LRUType lru_ = LRUType(LRUCapacity / CacheShards);
+  };
+  CacheShard &Shard(uint32_t ip) {
+    return cache_[((ip * 0x9E3779B1u) >> 16) % CacheShards];
+  }
+  CacheShard cache_[CacheShards];
 };
 
-void InitIPResolver(const std::string &db_path);
-bool ResolveIP(const std::string &ip, IPResolver::ResultType **result);
+void InitIPResolver(const std::string &db_path,
+                    const std::string &db6_path = std::string(),
+                    int reload_interval = 0);
+bool ResolveIP(const char *ip, size_t size, IPResolver::LRUValueType &result);
+void ResolveIPs(const boost::string_ref *ips, size_t n,
+                IPResolver::LRUValueType *results);
 
 } // namespace util
 } // namespace fluorine
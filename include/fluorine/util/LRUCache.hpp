@@ -10,8 +10,9 @@
 // See http://boostorg.github.com/compute for more information.
 //---------------------------------------------------------------------------//
 
-#include <map>
-#include <list>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
 #include <utility>
 #include <functional>
 
@@ -21,15 +22,62 @@ namespace fluorine {
 namespace util {
 
 // a cache which evicts the least recently used item when it is full
-template <class Key, class Value>
+//
+// Entries live in one array allocated up front and are linked into the
+// recency list by index; an open-addressing table with linear probing maps
+// keys to them. Inserting and looking up allocate nothing, an evicted
+// entry's value is released when it is evicted. Inserting a key already
+// present aggregates into it without touching its recency, a lookup moves it
+// to the front.
+template <class Key, class Value, class Hash = std::hash<Key>>
 class LRUCache {
+  static const uint32_t kNil = UINT32_MAX;
+
+  struct Slot {
+    uint32_t index_ = kNil;
+    uint32_t hash_  = 0;
+  };
+
 public:
   typedef Key key_type;
   typedef Value value_type;
-  typedef std::list<key_type> list_type;
-  typedef std::map<key_type,
-                   std::pair<value_type, typename list_type::iterator>>
-      map_type;
+
+  // shaped like the std::map entries the cache used to hold: the key, then
+  // the value and the entry's slot in the table
+  struct entry_type {
+    key_type first;
+    std::pair<value_type, uint32_t> second;
+    uint32_t prev_ = kNil; // towards the most recently used
+    uint32_t next_ = kNil;
+  };
+
+  // the entries from the least to the most recently used
+  class map_type {
+  public:
+    class iterator {
+    public:
+      iterator(LRUCache *cache, uint32_t i) : cache_(cache), i_(i) {}
+      entry_type &operator*() const { return cache_->m_entries[i_]; }
+      entry_type *operator->() const { return &cache_->m_entries[i_]; }
+      iterator &operator++() {
+        i_ = cache_->m_entries[i_].prev_;
+        return *this;
+      }
+      bool operator!=(const iterator &other) const { return i_ != other.i_; }
+
+    private:
+      LRUCache *cache_;
+      uint32_t i_;
+    };
+
+    explicit map_type(LRUCache *cache) : cache_(cache) {}
+    iterator begin() const { return iterator(cache_, cache_->m_tail); }
+    iterator end() const { return iterator(cache_, kNil); }
+    size_t size() const { return cache_->m_size; }
+
+  private:
+    LRUCache *cache_;
+  };
 
   using OnInsert      = std::function<void(value_type &v)>;
   using OnAggregation = std::function<void(value_type &lhs, value_type &rhs)>;
@@ -38,99 +86,225 @@ public:
 
   LRUCache(size_t capacity, OnInsert oi = nullptr, OnAggregation oa = nullptr,
            OnEvict oe = nullptr, OnClear oc = nullptr)
-      : m_capacity(capacity), m_oi(oi), m_oa(oa), m_oe(oe), m_oc(oc) {}
-
-  ~LRUCache() {}
+      : m_capacity(capacity ? capacity : 1), m_oi(oi), m_oa(oa), m_oe(oe),
+        m_oc(oc) {
+    size_t slots = 2;
+    while (slots < m_capacity * 2) {
+      slots *= 2;
+    }
+    m_mask = slots - 1;
+    m_table.resize(slots);
+    m_entries.resize(m_capacity);
+    for (size_t i = 0; i < m_capacity; ++i) {
+      m_entries[i].next_ = i + 1 < m_capacity ? i + 1 : kNil;
+    }
+    m_free = 0;
+  }
 
-  size_t size() const { return m_map.size(); }
+  size_t size() const { return m_size; }
 
   size_t capacity() const { return m_capacity; }
 
-  bool empty() const { return m_map.empty(); }
+  bool empty() const { return m_size == 0; }
+
+  bool contains(const key_type &key) const {
+    return m_table[probe(key, mix(key))].index_ != kNil;
+  }
 
-  bool contains(const key_type &key) { return m_map.find(key) != m_map.end(); }
+  // lookups that found their key, and that did not
+  uint64_t hits() const { return m_hits; }
+  uint64_t misses() const { return m_misses; }
 
   void insert(const key_type &key, value_type value) {
-    typename map_type::iterator i = m_map.find(key);
-    if (i == m_map.end()) {
-      // insert item into the cache, but first check if it is full
-      if (size() >= m_capacity) {
-        // cache is full, evict the least recently used item
-        evict();
+    uint32_t hash = mix(key);
+    size_t pos    = probe(key, hash);
+    if (m_table[pos].index_ != kNil) {
+      if (m_oa) {
+        m_oa(m_entries[m_table[pos].index_].second.first, value);
       }
+      return;
+    }
 
-      if (m_oi) {
-        m_oi(value);
-      }
+    // insert item into the cache, but first check if it is full
+    if (m_size >= m_capacity) {
+      // cache is full, evict the least recently used item
+      evict();
+      // the eviction may have shifted the probe sequence
+      pos = probe(key, hash);
+    }
 
-      // insert the new item
-      m_list.push_front(key);
-      m_map[key] = std::make_pair(std::move(value), m_list.begin());
-    } else {
-      if (m_oa) {
-        m_oa(i->second.first, value);
-      }
+    if (m_oi) {
+      m_oi(value);
+    }
+
+    uint32_t i = m_free;
+    m_free     = m_entries[i].next_;
+
+    entry_type &e   = m_entries[i];
+    e.first         = key;
+    e.second.first  = std::move(value);
+    e.second.second = static_cast<uint32_t>(pos);
+
+    m_table[pos].index_ = i;
+    m_table[pos].hash_  = hash;
+    ++m_size;
+    pushFront(i);
+  }
+
+  // the value, moved to the front of the recency list, or nullptr
+  value_type *lookup(const key_type &key) {
+    uint32_t i = m_table[probe(key, mix(key))].index_;
+    if (i == kNil) {
+      ++m_misses;
+      return nullptr;
     }
+
+    ++m_hits;
+    if (i != m_head) {
+      unlink(i);
+      pushFront(i);
+    }
+    return &m_entries[i].second.first;
   }
 
   boost::optional<value_type> get(const key_type &key) {
-    // lookup value in the cache
-    typename map_type::iterator i = m_map.find(key);
-    if (i == m_map.end()) {
-      // value not in cache
+    value_type *value = lookup(key);
+    if (!value) {
       return boost::none;
     }
+    return *value;
+  }
+
+  void clear() {
+    if (m_oc) {
+      map_type m(this);
+      m_oc(m);
+    }
 
-    // return the value, but first update its place in the most
-    // recently used list
-    typename list_type::iterator j = i->second.second;
-    if (j != m_list.begin()) {
-      // move item to the front of the most recently used list
-      m_list.erase(j);
-      m_list.push_front(key);
+    for (uint32_t i = m_tail; i != kNil;) {
+      uint32_t prev = m_entries[i].prev_;
+      release(i);
+      i = prev;
+    }
+    m_head = m_tail = kNil;
+  }
+
+private:
+  uint32_t mix(const key_type &key) const {
+    uint64_t h = static_cast<uint64_t>(m_hash(key));
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<uint32_t>(h);
+  }
+
+  // the slot holding key, or the empty slot ending its probe sequence
+  size_t probe(const key_type &key, uint32_t hash) const {
+    size_t pos = hash & m_mask;
+    for (;;) {
+      const Slot &slot = m_table[pos];
+      if (slot.index_ == kNil ||
+          (slot.hash_ == hash && m_entries[slot.index_].first == key)) {
+        return pos;
+      }
+      pos = (pos + 1) & m_mask;
+    }
+  }
 
-      // update iterator in map
-      j                       = m_list.begin();
-      const value_type &value = i->second.first;
-      m_map[key]              = std::make_pair(value, j);
+  void pushFront(uint32_t i) {
+    entry_type &e = m_entries[i];
+    e.prev_       = kNil;
+    e.next_       = m_head;
+    if (m_head != kNil) {
+      m_entries[m_head].prev_ = i;
+    }
+    m_head = i;
+    if (m_tail == kNil) {
+      m_tail = i;
+    }
+  }
 
-      // return the value
-      return value;
+  void unlink(uint32_t i) {
+    entry_type &e = m_entries[i];
+    if (e.prev_ != kNil) {
+      m_entries[e.prev_].next_ = e.next_;
+    } else {
+      m_head = e.next_;
+    }
+    if (e.next_ != kNil) {
+      m_entries[e.next_].prev_ = e.prev_;
     } else {
-      // the item is already at the front of the most recently
-      // used list so just return it
-      return i->second.first;
+      m_tail = e.prev_;
     }
   }
 
-  void clear() {
-    if (m_oc) {
-      m_oc(m_map);
+  // empties a table slot, shifting back the entries probing past it so no
+  // tombstones are needed
+  void erase(size_t pos) {
+    for (;;) {
+      m_table[pos] = Slot();
+      size_t next  = pos;
+      for (;;) {
+        next = (next + 1) & m_mask;
+        if (m_table[next].index_ == kNil) {
+          return;
+        }
+        // stays when its home is cyclically in (pos, next]
+        size_t home = m_table[next].hash_ & m_mask;
+        if (pos <= next ? (pos < home && home <= next)
+                        : (pos < home || home <= next)) {
+          continue;
+        }
+        break;
+      }
+      m_table[pos] = m_table[next];
+      m_entries[m_table[pos].index_].second.second =
+          static_cast<uint32_t>(pos);
+      pos = next;
     }
-    m_map.clear();
-    m_list.clear();
   }
 
-private:
+  // drops the entry's key and value and returns it to the free list
+  void release(uint32_t i) {
+    entry_type &e = m_entries[i];
+    erase(e.second.second);
+    e.first        = key_type();
+    e.second.first = value_type();
+    e.next_        = m_free;
+    m_free         = i;
+    --m_size;
+  }
+
   void evict() {
     // evict item from the end of most recently used list
-    typename list_type::iterator i = --m_list.end();
+    uint32_t i = m_tail;
     if (m_oe) {
-      m_oe(m_map[*i].first);
+      m_oe(m_entries[i].second.first);
     }
-    m_map.erase(*i);
-    m_list.erase(i);
+    unlink(i);
+    release(i);
   }
 
 private:
-  map_type m_map;
-  list_type m_list;
+  std::vector<entry_type> m_entries;
+  std::vector<Slot> m_table;
+  size_t m_mask;
+  uint32_t m_free;
+  uint32_t m_head   = kNil;
+  uint32_t m_tail   = kNil;
+  size_t m_size     = 0;
+  uint64_t m_hits   = 0;
+  uint64_t m_misses = 0;
   size_t m_capacity;
+  Hash m_hash;
   OnInsert m_oi;
   OnAggregation m_oa;
   OnEvict m_oe;
   OnClear m_oc;
 };
 
+template <class Key, class Value, class Hash>
+const uint32_t LRUCache<Key, Value, Hash>::kNil;
+
 } // namespace util
 } // namespace fluorine
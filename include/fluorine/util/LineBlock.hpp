@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <condition_variable>
+
+#include <boost/lockfree/stack.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/utility/string_ref.hpp>
+
+#include "fluorine/Macros.hpp"
+#include "fluorine/util/EventFd.hpp"
+
+namespace fluorine {
+namespace util {
+
+// A batch of lines laid out back to back, each followed by a '\n', with an
+// offsets array marking where every line starts. The lines are either copied
+// into the block's own buffer or, for a mapped input file, reference the
+// mapping directly.
+class LineBlock {
+public:
+  explicit LineBlock(size_t capacity) : capacity_(capacity) {
+    buffer_.reserve(capacity);
+    offsets_.reserve(capacity / 64 + 1);
+    Clear();
+  }
+
+  void Clear() {
+    buffer_.clear();
+    offsets_.clear();
+    offsets_.push_back(0);
+    data_ = buffer_.data();
+  }
+
+  size_t Size() const { return offsets_.size() - 1; }
+  bool Empty() const { return offsets_.size() == 1; }
+  size_t Bytes() const { return offsets_.back(); }
+
+  boost::string_ref Line(size_t i) const {
+    return boost::string_ref(data_ + offsets_[i],
+                             offsets_[i + 1] - offsets_[i] - 1);
+  }
+
+  // copies the line, fails when a non-empty block has no room left
+  bool Append(const char *data, size_t size) {
+    if (!Empty() && Bytes() + size + 1 > capacity_) {
+      return false;
+    }
+
+    buffer_.append(data, size);
+    buffer_.push_back('\n');
+    data_ = buffer_.data();
+    offsets_.push_back(static_cast<uint32_t>(buffer_.size()));
+    return true;
+  }
+
+  // references the line, which has to directly follow the previous one
+  bool AppendView(const char *data, size_t size) {
+    if (Empty()) {
+      data_ = data;
+    } else if (Bytes() + size + 1 > capacity_) {
+      return false;
+    }
+
+    ASSERT(data == data_ + Bytes());
+    offsets_.push_back(static_cast<uint32_t>(data + size + 1 - data_));
+    return true;
+  }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(LineBlock);
+
+  const size_t capacity_;
+  const char *data_;
+  std::string buffer_;
+  std::vector<uint32_t> offsets_;
+};
+
+// Hands line blocks from a single producer to a single consumer. All blocks
+// are allocated up front, so the queue depth is bounded in bytes and steady
+// state ingestion does no allocation: consumed blocks return to a free list,
+// from any thread, and the producer sleeps until one does when all are in
+// flight. The consumer sleeps in its event loop on Fd(), which Push makes
+// readable.
+class BlockQueue {
+public:
+  static const size_t kBlockSize = 64 * 1024;
+
+  explicit BlockQueue(size_t bytes, size_t block_size = kBlockSize);
+
+  // producer side
+  LineBlock *Acquire();
+  void Push(LineBlock *block);
+
+  // consumer side, returns nullptr when empty
+  LineBlock *Pop();
+  bool Empty() { return ready_.read_available() == 0; }
+
+  // readable after a Push or Wake, Drain before popping
+  int Fd() const { return wakeup_.Fd(); }
+  void Drain() { wakeup_.Drain(); }
+  // any thread, for the consumer to look at something else, like the end of
+  // the input
+  void Wake() { wakeup_.Notify(); }
+
+  // any thread, once the lines of the block are no longer referenced
+  void Release(LineBlock *block);
+
+  size_t Blocks() const { return blocks_.size(); }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(BlockQueue);
+
+  std::vector<std::unique_ptr<LineBlock>> blocks_;
+  boost::lockfree::spsc_queue<LineBlock *> ready_;
+  boost::lockfree::stack<LineBlock *> free_;
+
+  std::mutex mutex_;
+  std::condition_variable released_;
+  EventFd wakeup_;
+};
+
+} // namespace util
+} // namespace fluorine
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include <boost/utility/string_ref.hpp>
+
+#include "fluorine/Macros.hpp"
+
+namespace fluorine {
+namespace util {
+
+// Read-only mapping of a whole regular file.
+class MappedFile {
+public:
+  MappedFile() {}
+  ~MappedFile() { Close(); }
+
+  bool Open(const std::string &path);
+  void Close();
+
+  bool IsOpen() const { return fd_ >= 0; }
+  const char *Data() const { return data_; }
+  size_t Size() const { return size_; }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(MappedFile);
+
+  int fd_           = -1;
+  const char *data_ = nullptr;
+  size_t size_      = 0;
+};
+
+// Splits a buffer into lines like std::getline, without copying: the returned
+// lines are views into the buffer and do not include the '\n'. Newlines are
+// located 64 bytes at a time with SSE2 when available.
+class LineScanner {
+public:
+  LineScanner(const char *data, size_t size)
+      : pos_(data), end_(data + size), chunk_(data), mask_(0) {
+    Scan();
+  }
+
+  bool Next(boost::string_ref &line) {
+    if (pos_ >= end_) {
+      return false;
+    }
+
+    const char *nl = FindNewline();
+    line           = boost::string_ref(pos_, nl - pos_);
+    pos_           = nl < end_ ? nl + 1 : end_;
+    return true;
+  }
+
+  const char *Position() const { return pos_; }
+
+  static const size_t kChunkSize = 64;
+
+private:
+  const char *FindNewline() {
+    for (;;) {
+      size_t offset = pos_ > chunk_ ? pos_ - chunk_ : 0;
+      if (offset < kChunkSize) {
+        uint64_t m = mask_ & (~uint64_t(0) << offset);
+        if (m) {
+          return chunk_ + __builtin_ctzll(m);
+        }
+      }
+
+      chunk_ += kChunkSize;
+      if (chunk_ >= end_) {
+        chunk_ = end_;
+        mask_  = 0;
+        return end_;
+      }
+      Scan();
+    }
+  }
+
+  // fills mask_ with one bit per '\n' in [chunk_, chunk_ + kChunkSize)
+  void Scan();
+
+  const char *pos_;
+  const char *end_;
+  const char *chunk_;
+  uint64_t mask_;
+};
+
+} // namespace util
+} // namespace fluorine
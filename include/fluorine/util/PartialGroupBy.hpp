@@ -0,0 +1,242 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <functional>
+
+#include "fluorine/Macros.hpp"
+#include "fluorine/util/GroupBy.hpp"
+
+namespace fluorine {
+namespace util {
+
+// Groups lines on several threads, each folding whole blocks of lines into a
+// table of its own, and merges the tables when their windows close, adding
+// up to what one GroupBy fed the same lines in order emits.
+//
+// Blocks are numbered in input order from 0, every block folded once, an
+// empty one included. A line is late as it would be in one table: a block
+// waits for the latest time of the blocks before it, then drops the lines of
+// the windows closed by it or by its own earlier lines. Its lines carry
+// their sequence in the input, so the merged groups keep their first line's
+// First cells and are emitted in the order of their first lines.
+//
+// Close() and Flush() merge the partial tables in a tree, the pairs of a
+// level on threads of their own once they hold enough groups, into the first
+// table, which emits them. The blocks of a window spread over all the
+// tables, each holds capacity groups as one table would. A full partial
+// table emits its oldest window early, as one table does: the totals stay,
+// the rows of a group split. Emits are serialized, on the thread folding
+// or closing.
+template <class Hash = std::hash<std::string>>
+class PartialGroupBy {
+public:
+  using OnEmit = typename GroupBy<Hash>::OnEmit;
+
+  // The lines of a block, staged by the thread folding it: a line's key
+  // and cells are written in place, then added with its time or left to
+  // the next line. The buffers are kept across blocks.
+  class Block {
+  public:
+    explicit Block(size_t width) : width_(width) {}
+
+    size_t Size() const { return size_; }
+
+    void Clear() { size_ = 0; }
+
+    std::string &Key() {
+      grow();
+      return keys_[size_];
+    }
+    Cell *Cells() {
+      grow();
+      return &cells_[size_ * width_];
+    }
+    void Add(int64_t time) {
+      grow();
+      times_[size_++] = time;
+    }
+
+  private:
+    friend class PartialGroupBy;
+
+    void grow() {
+      if (size_ == times_.size()) {
+        times_.emplace_back();
+        keys_.emplace_back();
+        cells_.resize(cells_.size() + width_);
+      }
+    }
+
+    size_t width_;
+    size_t size_ = 0;
+    std::vector<int64_t> times_;
+    std::vector<std::string> keys_;
+    std::vector<Cell> cells_;
+  };
+
+  // capacity is of each of the tables
+  PartialGroupBy(size_t workers, std::vector<Fold> folds, size_t capacity,
+                 OnEmit emit, int64_t interval = 0, int64_t lateness = 0)
+      : width_(folds.size()), emit_(emit) {
+    OnEmit serialized = [this](const std::string &key, int64_t count,
+                               const Cell *cells) {
+      std::lock_guard<std::mutex> lock(emit_mutex_);
+      if (emit_) {
+        emit_(key, count, cells);
+      }
+    };
+    for (size_t i = 0; i < std::max<size_t>(workers, 1); ++i) {
+      partials_.emplace_back(new Partial(folds, capacity, serialized,
+                                         interval, lateness));
+      partials_.back()->groups_.Hold();
+    }
+  }
+
+  size_t Workers() const { return partials_.size(); }
+  size_t Width() const { return width_; }
+
+  int64_t WindowOf(int64_t time) const {
+    return partials_[0]->groups_.WindowOf(time);
+  }
+
+  // the first window left open once the latest time is latest
+  int64_t ClosedBy(int64_t latest) const {
+    return partials_[0]->groups_.ClosedBy(latest);
+  }
+
+  // lines dropped for their closed windows, windows emitted while open
+  uint64_t Late() const { return late_; }
+  uint64_t Early() const {
+    uint64_t early = 0;
+    for (auto &p : partials_) {
+      std::lock_guard<std::mutex> lock(p->mutex_);
+      early += p->groups_.Early();
+    }
+    return early;
+  }
+
+  // folds the lines of block number seq into the table of worker, after the
+  // blocks before it told their latest times, and returns the latest time
+  // of the blocks up to it, INT64_MIN before any line
+  int64_t Add(size_t worker, uint64_t seq, const Block &block) {
+    int64_t latest = INT64_MIN;
+    for (size_t i = 0; i < block.size_; ++i) {
+      latest = std::max(latest, block.times_[i]);
+    }
+    int64_t running = publish(seq, latest);
+
+    Partial &p = *partials_[worker % partials_.size()];
+    uint64_t late = 0;
+    {
+      std::lock_guard<std::mutex> lock(p.mutex_);
+      for (size_t i = 0; i < block.size_; ++i) {
+        int64_t time = block.times_[i];
+        if (p.groups_.WindowOf(time) < ClosedBy(running)) {
+          ++late;
+          continue;
+        }
+        running = std::max(running, time);
+        p.groups_.Add(time, block.keys_[i], &block.cells_[i * width_],
+                      seq << 32 | i);
+      }
+    }
+    late_ += late;
+    return std::max(running, latest);
+  }
+
+  // merges and emits the windows closed once the latest time is latest,
+  // the blocks folded up to a time latest or later
+  void Close(int64_t latest) { merge(ClosedBy(latest), false); }
+
+  // merges and emits all windows
+  void Flush() { merge(INT64_MAX, true); }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(PartialGroupBy);
+
+  // below it, a level of the tree merges its pairs on one thread
+  static const size_t kParallelGroups = 16 * 1024;
+  // polls for the turn to publish before yielding the thread
+  static const int kSpins = 64;
+
+  struct Partial {
+    Partial(std::vector<Fold> folds, size_t capacity, OnEmit emit,
+            int64_t interval, int64_t lateness)
+        : groups_(std::move(folds), capacity, emit, interval, lateness) {}
+
+    mutable std::mutex mutex_;
+    GroupBy<Hash> groups_;
+  };
+
+  // the latest time of the blocks before seq, once they told theirs. The
+  // block whose turn it is adds its own and passes the turn on, the wait
+  // for it no longer than the blocks before take to be staged.
+  int64_t publish(uint64_t seq, int64_t latest) {
+    for (int spins = 0; next_.load(std::memory_order_acquire) != seq;
+         ++spins) {
+      if (spins >= kSpins) {
+        std::this_thread::yield();
+      }
+    }
+    int64_t before = latest_;
+    latest_        = std::max(latest_, latest);
+    next_.store(seq + 1, std::memory_order_release);
+    return before;
+  }
+
+  void merge(int64_t window, bool flush) {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    size_t groups = 0;
+    for (auto &p : partials_) {
+      locks.emplace_back(p->mutex_);
+      groups += p->groups_.Size();
+    }
+
+    size_t n = partials_.size();
+    for (size_t step = 1; step < n; step *= 2) {
+      // the first pair on this thread, last, the others already running
+      std::vector<std::thread> threads;
+      for (size_t i = 2 * step; i + step < n; i += 2 * step) {
+        GroupBy<Hash> &to   = partials_[i]->groups_;
+        GroupBy<Hash> &from = partials_[i + step]->groups_;
+        if (groups >= kParallelGroups) {
+          threads.emplace_back([&to, &from, window]() {
+            to.Merge(from, window);
+          });
+        } else {
+          to.Merge(from, window);
+        }
+      }
+      partials_[0]->groups_.Merge(partials_[step]->groups_, window);
+      for (auto &t : threads) {
+        t.join();
+      }
+    }
+
+    if (flush) {
+      partials_[0]->groups_.Flush();
+    } else {
+      partials_[0]->groups_.Close(window);
+    }
+  }
+
+  size_t width_;
+  OnEmit emit_;
+  std::mutex emit_mutex_;
+  std::vector<std::unique_ptr<Partial>> partials_;
+  std::atomic<uint64_t> late_{0};
+
+  std::atomic<uint64_t> next_{0}; // the block to tell its latest time next
+  int64_t latest_ = INT64_MIN;     // written by the block whose turn it is
+};
+
+} // namespace util
+} // namespace fluorine
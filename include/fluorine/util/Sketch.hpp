@@ -0,0 +1,230 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+namespace fluorine {
+namespace util {
+
+// spreads the bits of a hash, std::hash of an integer being itself
+inline uint64_t Fmix64(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// a hash of bytes counted distinct, 8 at a time
+inline uint64_t HashBytes(const char *p, size_t n) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+  for (; n >= 8; p += 8, n -= 8) {
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    h = (h ^ Fmix64(w)) * 0x9e3779b97f4a7c15ULL;
+  }
+  uint64_t w = 0;
+  memcpy(&w, p, n);
+  return Fmix64(h ^ w);
+}
+
+// Counts the distinct hashes added, approximately, in 2^12 one byte
+// registers: the standard error is 1.04 / sqrt(4096), about 1.6%, with
+// linear counting below 2.5 registers a distinct value. Merging keeps the
+// larger of each register, the sketch of the union.
+class HyperLogLog {
+public:
+  static const int kPrecision    = 12;
+  static const size_t kRegisters = size_t(1) << kPrecision;
+
+  HyperLogLog() { Clear(); }
+
+  void Clear() { memset(registers_, 0, sizeof(registers_)); }
+
+  void Add(uint64_t hash) {
+    hash        = Fmix64(hash);
+    size_t i    = hash >> (64 - kPrecision);
+    // the bit past the precision ends the run of zeros at 64 - precision
+    uint64_t w  = (hash << kPrecision) | (uint64_t(1) << (kPrecision - 1));
+    uint8_t run = static_cast<uint8_t>(__builtin_clzll(w) + 1);
+    registers_[i] = std::max(registers_[i], run);
+  }
+
+  void Merge(const HyperLogLog &other) {
+    for (size_t i = 0; i < kRegisters; ++i) {
+      registers_[i] = std::max(registers_[i], other.registers_[i]);
+    }
+  }
+
+  double Estimate() const {
+    const double m = kRegisters;
+    double sum     = 0;
+    size_t zeros   = 0;
+    for (size_t i = 0; i < kRegisters; ++i) {
+      sum += ldexp(1.0, -registers_[i]);
+      zeros += registers_[i] == 0;
+    }
+    double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (e <= 2.5 * m && zeros) {
+      e = m * ::log(m / zeros);
+    }
+    return e;
+  }
+
+private:
+  uint8_t registers_[kRegisters];
+};
+
+// Quantiles within a relative error of the values added, a DDSketch: a
+// positive value counts in bucket ceil(log_gamma(v)), gamma being
+// (1 + error) / (1 - error), and a quantile is read back as the middle of
+// its bucket. The buckets are dense between the lowest and highest used,
+// at most kBuckets, the lowest collapsed into one past that so only the
+// low quantiles lose their accuracy. Values below kMin, negative ones
+// included, count as 0. Merging adds up the buckets, the sketch of both
+// inputs.
+class DDSketch {
+public:
+  // at 1%, a span of 6e17 times, nanoseconds to centuries
+  static const size_t kBuckets = 2048;
+  static constexpr double kMin = 1e-9;
+
+  explicit DDSketch(double error = 0.01)
+      : gamma_((1 + error) / (1 - error)), log_gamma_(::log(gamma_)) {}
+
+  void Clear() {
+    buckets_.clear();
+    offset_ = 0;
+    zeros_  = 0;
+    count_  = 0;
+    min_    = 0;
+    max_    = 0;
+  }
+
+  uint64_t Count() const { return count_; }
+  double Min() const { return min_; }
+  double Max() const { return max_; }
+
+  void Add(double v, uint64_t n = 1) {
+    if (!count_ || v < min_) {
+      min_ = v;
+    }
+    if (!count_ || v > max_) {
+      max_ = v;
+    }
+    count_ += n;
+    if (v < kMin) {
+      zeros_ += n;
+      return;
+    }
+    *bucket(static_cast<int32_t>(ceil(::log(v) / log_gamma_))) += n;
+  }
+
+  void Merge(const DDSketch &other) {
+    if (!other.count_) {
+      return;
+    }
+    if (!count_ || other.min_ < min_) {
+      min_ = other.min_;
+    }
+    if (!count_ || other.max_ > max_) {
+      max_ = other.max_;
+    }
+    count_ += other.count_;
+    zeros_ += other.zeros_;
+    for (size_t i = 0; i < other.buckets_.size(); ++i) {
+      if (other.buckets_[i]) {
+        int32_t index = other.offset_ + static_cast<int32_t>(i);
+        *bucket(index) += other.buckets_[i];
+      }
+    }
+  }
+
+  // the value of rank q * (count - 1), 0 without values
+  double Quantile(double q) const {
+    if (!count_) {
+      return 0;
+    }
+    if (q <= 0) {
+      return min_;
+    }
+    if (q >= 1) {
+      return max_;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(q * (count_ - 1));
+    if (rank < zeros_) {
+      return std::max(min_, 0.0);
+    }
+    uint64_t seen = zeros_;
+    for (size_t i = 0; i < buckets_.size(); ++i) {
+      seen += buckets_[i];
+      if (seen > rank) {
+        double v = 2 * pow(gamma_, offset_ + static_cast<int32_t>(i)) /
+                   (gamma_ + 1);
+        return std::min(std::max(v, min_), max_);
+      }
+    }
+    return max_;
+  }
+
+  // the bytes held for the buckets
+  size_t MemoryUsage() const {
+    return sizeof(*this) + buckets_.capacity() * sizeof(uint64_t);
+  }
+
+private:
+  // the count of bucket index, the buckets grown to hold it
+  uint64_t *bucket(int32_t index) {
+    if (buckets_.empty()) {
+      buckets_.assign(1, 0);
+      offset_ = index;
+    } else if (index < offset_) {
+      size_t size = buckets_.size() + (offset_ - index);
+      if (size > kBuckets) {
+        // past the lowest kept, below the range
+        return &buckets_[0];
+      }
+      buckets_.insert(buckets_.begin(), offset_ - index, 0);
+      offset_ = index;
+    } else if (index >= offset_ + static_cast<int32_t>(buckets_.size())) {
+      if (static_cast<size_t>(index - offset_) >= kBuckets) {
+        collapse(index - static_cast<int32_t>(kBuckets) + 1);
+      }
+      buckets_.resize(index - offset_ + 1, 0);
+    }
+    return &buckets_[index - offset_];
+  }
+
+  // folds the buckets below offset into the one there
+  void collapse(int32_t offset) {
+    size_t n     = std::min<size_t>(offset - offset_, buckets_.size());
+    uint64_t low = 0;
+    for (size_t i = 0; i < n; ++i) {
+      low += buckets_[i];
+    }
+    buckets_.erase(buckets_.begin(), buckets_.begin() + n);
+    if (buckets_.empty()) {
+      buckets_.push_back(0);
+    }
+    buckets_[0] += low;
+    offset_ = offset;
+  }
+
+  double gamma_;
+  double log_gamma_;
+  std::vector<uint64_t> buckets_;
+  int32_t offset_ = 0;
+  uint64_t zeros_ = 0;
+  uint64_t count_ = 0;
+  double min_     = 0;
+  double max_     = 0;
+};
+
+} // namespace util
+} // namespace fluorine
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <time.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include <boost/utility/string_ref.hpp>
+
+namespace fluorine {
+namespace util {
+
+// A strftime-like time format, compiled at config load into a chain of
+// readers specialized for its conversions, %H:%M:%S and %Y-%m-%d read as
+// one and the width of a run of fixed fields checked once. Conversions:
+//   %Y  year, 4 digits           %m  month, 2 digits
+//   %d  day, 2 digits            %e  day, 1 or 2 digits, or a space and 1
+//   %b  month, Jan to Dec        %H %M %S  hour, minute, second, 2 digits
+//   %f  fraction of a second, 1 to 9 digits, dropped
+//   %z  offset, Z, +hh, +hhmm or +hh:mm
+//   %s  seconds since the epoch  %Q  milliseconds since the epoch
+//   %T  %H:%M:%S                 %F  %Y-%m-%d       %%  a '%'
+// Other characters match themselves. A time without %z is local, one
+// without %Y is in the last year up to now, as syslog writes them.
+class TimeFormat {
+public:
+  // false, with why, for a format it cannot read
+  bool Compile(const std::string &format, std::string &error);
+  // seconds since the epoch, anything after the format is ignored
+  bool Parse(boost::string_ref s, int64_t &ts) const;
+  bool Empty() const { return ops_.empty(); }
+  // another for every format compiled, so what one read is not another's
+  uint64_t Id() const { return id_; }
+
+private:
+  friend struct TimeSteps;
+
+  // the fields read so far
+  struct Fields {
+    struct tm tm_;
+    int offset_;
+    int64_t ts_;
+  };
+
+  struct Op;
+  // reads an op and runs the next, the ops chained into the first one's
+  using Run = bool (*)(const char *literals, const Op *op, const char *p,
+                       const char *end, Fields &f);
+
+  // A step, a conversion with the character after it or a literal, reading
+  // fixed or varying widths. The first of a run of fixed widths checks the
+  // width of the whole run, the others read without checking.
+  struct Op {
+    Run run_;
+    uint16_t pos_;   // of a literal in literals_
+    uint16_t len_;   // of the literal
+    uint16_t width_; // of the run from here, when checked here
+    char sep_;
+  };
+
+  std::vector<Op> ops_;
+  std::string literals_;
+  bool year_  = false;
+  bool zone_  = false;
+  bool epoch_ = false;
+  uint64_t id_ = 0;
+};
+
+} // namespace util
+} // namespace fluorine
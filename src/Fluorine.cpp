@@ -1,30 +1,37 @@
+#include <math.h>
 #include <signal.h>
 #include <stdint.h>
+#include <string.h>
+#include <map>
+#include <deque>
+#include <mutex>
 #include <chrono>
 #include <thread>
 #include <atomic>
 #include <fstream>
 #include <algorithm>
 #include <functional>
-#include <boost/functional/hash.hpp>
-#include <boost/lockfree/spsc_queue.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
 #include "fmt/format.h"
 #include "spdlog/spdlog.h"
 #include "snet/EventLoop.h"
 #include "snet/Timer.h"
-#include "gzstream/gzstream.h"
 
 #include "fluorine/Macros.hpp"
 #include "fluorine/Option.hpp"
 #include "fluorine/Timer.hpp"
+#include "fluorine/WorkerPool.hpp"
 #include "fluorine/Forwarder.hpp"
 #include "fluorine/log/Parser.hpp"
 #include "fluorine/log/Json.hpp"
 #include "fluorine/config/Parser.hpp"
-#include "fluorine/util/LRUCache.hpp"
+#include "fluorine/util/GroupBy.hpp"
+#include "fluorine/util/PartialGroupBy.hpp"
 #include "fluorine/util/IPResolver.hpp"
+#include "fluorine/util/Gzip.hpp"
+#include "fluorine/util/LineBlock.hpp"
+#include "fluorine/util/LineReader.hpp"
 #include "fluorine/util/Redis.hpp"
 
 using namespace fluorine;
@@ -37,88 +44,348 @@ using namespace fluorine::util::redis;
 using Value    = rapidjson::Value;
 using Document = rapidjson::Document;
 
-namespace lockfree = boost::lockfree;
+using TransformPool = WorkerPool<LineBlock, std::string>;
 
-using LRUType = LRUCache<size_t, std::unique_ptr<Document>>;
+// a block folded by an aggregation worker, numbered in input order
+struct AggBlock {
+  LineBlock *block_;
+  uint64_t seq_;
+};
+
+// the latest time of the blocks up to one folded, and its lines skipped
+struct AggOut {
+  int64_t latest_   = INT64_MIN;
+  uint64_t skipped_ = 0;
+};
+
+using AggPool = WorkerPool<AggBlock, AggOut>;
 
 static auto logger = spdlog::stdout_color_st("F");
-static lockfree::spsc_queue<std::string, lockfree::capacity<32768>> queue;
+static std::unique_ptr<BlockQueue> queue;
 static unsigned long long lines = 0;
 static unsigned long long total = 0;
 static unsigned long long aggre = 0;
 static std::atomic<bool> done(false);
 
-void loop(snet::EventLoop *event_loop, Frontend *frontend, std::string path,
-          const Config &config) {
-  auto handler = [&frontend, &config, path]() {
-    std::string line;
-    while (frontend->CanSend() && queue.pop(line)) {
-      Log log;
-      if (!ParseLog(line, log, config.field_number_, config.time_index_)) {
-        continue;
+// Consumer side iterator over the lines of the queued blocks.
+class BlockReader {
+public:
+  ~BlockReader() { Release(); }
+
+  bool Next(boost::string_ref &line) {
+    while (!block_ || index_ == block_->Size()) {
+      Release();
+      block_ = queue->Pop();
+      if (!block_) {
+        return false;
       }
+    }
 
-      std::unique_ptr<rapidjson::Document> doc(new rapidjson::Document());
-      if (!PopulateJsonDoc(doc.get(), log, config)) {
-        continue;
-      }
+    line = block_->Line(index_++);
+    return true;
+  }
 
-      if (!doc->HasMember("path")) {
-        doc->AddMember("path", Value(path.c_str(), doc->GetAllocator()),
-                       doc->GetAllocator());
-      }
+  bool Empty() {
+    return (!block_ || index_ == block_->Size()) && queue->Empty();
+  }
 
-      std::string json = JsonDocToString(doc.get());
-      char *ch         = new char[json.size() + 1];
-      ch[json.size()]  = '\n';
-      std::copy(json.begin(), json.end(), ch);
-      std::unique_ptr<snet::Buffer> data(
-          new snet::Buffer(ch, json.size() + 1, snet::OpDeleter));
-      frontend->Send(std::move(data));
+private:
+  void Release() {
+    if (block_) {
+      queue->Release(block_);
+      block_ = nullptr;
+      index_ = 0;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
-  };
+  }
+
+  LineBlock *block_ = nullptr;
+  size_t index_     = 0;
+};
+
+// Runs the consumer when the queue wakes it, the loop sleeps otherwise.
+class QueueWakeup : public snet::EventHandler {
+public:
+  QueueWakeup(snet::EventLoop *event_loop, std::function<void()> consume)
+      : event_loop_(event_loop), consume_(consume) {
+    event_loop_->AddEventHandler(this);
+  }
+
+  ~QueueWakeup() { event_loop_->DelEventHandler(this); }
+
+  int Fd() const override { return queue->Fd(); }
+  int Events() const override { return snet::Event_Read; }
+
+  void HandleRead() override {
+    queue->Drain();
+    consume_();
+  }
+
+  void HandleWrite() override {}
+  void HandleError() override {}
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(QueueWakeup);
+
+  snet::EventLoop *event_loop_;
+  std::function<void()> consume_;
+};
+
+// appends the parsed line as a '\n' terminated JSON line to out
+static bool emit(const Log &log, const Plan &plan, const std::string &path,
+                 std::string &out) {
+  // per thread, the document stays off the heap
+  thread_local char buffer[64 * 1024];
+
+  if (plan.stream_) {
+    if (!EmitJson(log, plan, out)) {
+      return false;
+    }
+    out += '\n';
+    return true;
+  }
+
+  Document::AllocatorType allocator(buffer, sizeof(buffer));
+  Document doc(&allocator);
+  if (!PopulateJsonDoc(&doc, log, plan)) {
+    return false;
+  }
+
+  if (!doc.HasMember("path")) {
+    doc.AddMember("path", Value(path.c_str(), doc.GetAllocator()),
+                  doc.GetAllocator());
+  }
+
+  AppendJsonDoc(&doc, out);
+  out += '\n';
+  return true;
+}
+
+// appends the line as a '\n' terminated JSON line to out
+static bool transform(boost::string_ref line, const Config &config,
+                      const Plan &plan, const std::string &path,
+                      std::string &out) {
+  // per thread, the fields stay off the heap once warm
+  thread_local Log log;
+
+  log.clear();
+  if (!ParseLog(line.begin(), line.end(), log, config.field_number_,
+                config.time_index_)) {
+    return false;
+  }
+  return emit(log, plan, path, out);
+}
+
+// transforms the lines of a block, all parsed first for their addresses to
+// be resolved in one batch
+static void transform(const LineBlock &block, const Config &config,
+                      const Plan &plan, const std::string &path,
+                      std::string &out) {
+  thread_local std::vector<std::unique_ptr<Log>> logs;
+  thread_local std::vector<const Log *> parsed;
+
+  while (logs.size() < block.Size()) {
+    logs.emplace_back(new Log());
+  }
+  parsed.clear();
+  for (size_t i = 0; i < block.Size(); ++i) {
+    boost::string_ref line = block.Line(i);
+    logs[i]->clear();
+    if (ParseLog(line.begin(), line.end(), *logs[i], config.field_number_,
+                 config.time_index_)) {
+      parsed.push_back(logs[i].get());
+    }
+  }
+
+  ResolveAhead(parsed, plan);
+  for (auto log : parsed) {
+    emit(*log, plan, path, out);
+  }
+  DropResolved();
+}
+
+void loop(snet::EventLoop *event_loop, Frontend *frontend, std::string path,
+          const Config &config, const Plan &plan, const Option &opt) {
+  std::unique_ptr<TransformPool> pool;
+  if (opt.workers_ > 0) {
+    logger->info("transform workers: {}, ordered: {}", opt.workers_,
+                 !opt.unordered_);
+    pool.reset(new TransformPool(
+        opt.workers_, !opt.unordered_,
+        [&config, &plan, path](LineBlock &block, std::string &out) {
+          transform(block, config, plan, path, out);
+          queue->Release(&block);
+        }));
+    pool->SetReadyHandler([]() { queue->Wake(); });
+  }
 
   snet::TimerList timer_list;
   snet::Timer send_timer(&timer_list);
   snet::TimerDriver timer_driver(timer_list);
+  SendBatch batch(frontend, opt.send_batch_);
+  BatchTimer batch_timer(&timer_list, frontend, &batch, opt.send_delay_);
+
+  BlockReader reader;
+  auto handler = [&frontend, &config, &plan, &reader, &batch, path]() {
+    boost::string_ref line;
+    std::string json;
+    while (frontend->CanSend() && reader.Next(line)) {
+      json.clear();
+      if (transform(line, config, plan, path, json)) {
+        batch.Append(json);
+      }
+    }
+  };
 
-  auto callback = [&event_loop, &send_timer, &timer_driver, &handler,
-                   &frontend]() {
-    if (done && queue.empty()) {
-      if (frontend->SendComplete()) {
+  auto pooled = [&frontend, &pool, &batch]() {
+    std::unique_ptr<std::string> out;
+    while (frontend->CanSend() && (out = pool->Collect())) {
+      if (!out->empty()) {
+        batch.Append(*out);
+      }
+    }
+
+    LineBlock *block;
+    while (pool->CanDispatch() && (block = queue->Pop())) {
+      pool->Dispatch(block);
+    }
+  };
+
+  auto callback = [&event_loop, &send_timer, &timer_driver, &handler, &pooled,
+                   &pool, &reader, &frontend, &batch, &batch_timer]() {
+    if (done && reader.Empty() && (!pool || pool->Idle())) {
+      batch_timer.Flush();
+      if (batch.Empty() && frontend->SendComplete()) {
         event_loop->Stop();
         event_loop->DelLoopHandler(&timer_driver);
         return;
       }
+    } else if (pool) {
+      pooled();
     } else {
       handler();
     }
-    send_timer.ExpireFromNow(snet::Milliseconds(1));
+    batch_timer.Arm();
+    // new blocks and pool outputs wake the loop, only a full socket and the
+    // end of the cycle are polled
+    if (!frontend->CanSend() || done) {
+      send_timer.ExpireFromNow(snet::Milliseconds(1));
+    }
   };
 
+  QueueWakeup wakeup(event_loop, callback);
   send_timer.ExpireFromNow(snet::Milliseconds(0));
   send_timer.SetOnTimeout(callback);
   event_loop->AddLoopHandler(&timer_driver);
   event_loop->Loop();
 }
 
-template <class T>
-inline void hash_combine(std::size_t &seed, const T &v) {
-  std::hash<T> hasher;
-  seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+// writes a summed value or a term read back from a group's key
+static void add_cell(JsonWriter &w, const Key &k, const Cell &c,
+                     boost::string_ref s) {
+  switch (c.type_) {
+  case util::Type::Int64:
+    w.Int64(k, c.int64_);
+    break;
+  case util::Type::Double:
+    w.Double(k, c.double_);
+    break;
+  case util::Type::String:
+    w.String(k, s);
+    break;
+  case util::Type::Null:
+    w.Raw(k.prefix_);
+    w.Raw("null");
+    break;
+  }
+}
+
+// a term of the line as a typed value of its key, false for another type
+static bool add_term(KeyWriter &key, const Cell &c, boost::string_ref s) {
+  switch (c.type_) {
+  case util::Type::String:
+    key.String(s);
+    return true;
+  case util::Type::Int64:
+    key.Int64(c.int64_);
+    return true;
+  case util::Type::Double:
+    key.Double(c.double_);
+    return true;
+  case util::Type::Null:
+    break;
+  }
+  return false;
+}
+
+// a number of the line folded, Null for another type
+static Cell number(const Cell &c) {
+  return c.type_ == util::Type::Int64 || c.type_ == util::Type::Double ? c
+                                                                       : Cell();
 }
 
+// the hash of a value counted distinct, as an Int64 cell
+static Cell hashed(const Cell &c, boost::string_ref s) {
+  switch (c.type_) {
+  case util::Type::String:
+    return Cell::Int64(static_cast<int64_t>(HashBytes(s.data(), s.size())));
+  case util::Type::Int64:
+    return c;
+  case util::Type::Double: {
+    int64_t bits;
+    memcpy(&bits, &c.double_, sizeof(bits));
+    return Cell::Int64(bits);
+  }
+  case util::Type::Null:
+    break;
+  }
+  return Cell();
+}
+
+// A member of an aggregated row: an aggregate function of a key, read from
+// the cells of its folds when the group is emitted.
+struct Aggregate {
+  Key key_;
+  std::string function_;
+  size_t fold_;
+  size_t count_   = 0; // for avg, the fold counting the values
+  int percentile_ = 0;
+
+  Cell Read(const Cell *cells) const {
+    const Cell &c = cells[fold_];
+    if (function_ == Aggregation::AVG) {
+      int64_t n = cells[count_].int64_;
+      return n && c.type_ != util::Type::Null ? Cell::Double(c.Number() / n)
+                                              : Cell();
+    } else if (function_ == Aggregation::DISTINCT) {
+      return Cell::Int64(llround(c.distinct_->Estimate()));
+    } else if (percentile_) {
+      return c.quantile_->Count()
+                 ? Cell::Double(c.quantile_->Quantile(percentile_ / 100.0))
+                 : Cell();
+    }
+    return c;
+  }
+};
+
 void agg(snet::EventLoop *event_loop, Frontend *frontend, std::string path,
-         const Config &config) {
+         const Config &config, const Plan &plan, const Option &opt) {
   auto aggregation = config.aggregation_;
-  auto agg_keys    = aggregation->keys_;
+  std::vector<std::string> agg_keys;
+  for (auto &key : aggregation->keys_) {
+    agg_keys.push_back(key.name_);
+  }
+  int interval     = aggregation->interval_;
+  std::vector<std::string> terms;
+  if (aggregation->terms_) {
+    terms = *aggregation->terms_;
+  }
 
   snet::TimerList timer_list;
   snet::Timer send_timer(&timer_list);
   snet::TimerDriver timer_driver(timer_list);
+  SendBatch batch(frontend, opt.send_batch_);
+  BatchTimer batch_timer(&timer_list, frontend, &batch, opt.send_delay_);
 
-  std::vector<std::string> diff;
   std::set<std::string> store_set;
   std::set<std::string> ignore_set;
 
@@ -138,19 +405,19 @@ void agg(snet::EventLoop *event_loop, Frontend *frontend, std::string path,
 
   auto ignore = [&store_set, &ignore_set](const Attribute &attr,
                                           std::string name) {
-    if (attr.attribute_[1] == Attribute::STORE &&
+    if (attr.arguments_[0] == Attribute::STORE &&
         store_set.find(name) == store_set.end()) {
       ignore_set.insert(name);
     }
   };
 
   for (const auto &attr : config.attributes_) {
-    if (attr.attribute_[0] == "ip") {
+    if (attr.type_ == "ip") {
       ignore(attr, attr.name_);
       for (auto field : IPFields) {
         ignore(attr, attr.name_ + "@" + field);
       }
-    } else if (attr.attribute_[0] == "request") {
+    } else if (attr.type_ == "request") {
       for (auto field : RequestFields) {
         ignore(attr, field);
       }
@@ -163,212 +430,576 @@ void agg(snet::EventLoop *event_loop, Frontend *frontend, std::string path,
     logger->info("ignore filed: {}", *it);
   }
 
-  auto clean_doc = [&ignore_set](std::unique_ptr<Document> &doc) {
-    for (auto it = ignore_set.begin(); it != ignore_set.end(); ++it) {
-      if (doc->HasMember(it->c_str())) {
-        doc->RemoveMember(it->c_str());
+  // A group is keyed by the window of its time and the terms, packed
+  // exactly, and holds a fold per function of a key, the percentiles of a
+  // key sharing one sketch and avg the sum. A sum is named as its key, the
+  // others as key@function. A window is emitted whole once the latest time,
+  // less the lateness, passes its end. Without an interval the time is not
+  // grouped by, the first line's is kept. The other members, the config's
+  // constants, are taken once from the first line.
+  std::vector<Fold> folds;
+  std::vector<size_t> inputs; // the key each fold reads
+  std::map<std::pair<size_t, Fold>, size_t> made;
+  auto fold_of = [&](size_t key, Fold f) -> size_t {
+    for (size_t i = 0; i < key; ++i) {
+      if (agg_keys[i] == agg_keys[key]) {
+        key = i; // the first of the same name reads it
+        break;
       }
     }
+    auto it = made.find(std::make_pair(key, f));
+    if (it != made.end()) {
+      return it->second;
+    }
+    folds.push_back(f);
+    inputs.push_back(key);
+    made[std::make_pair(key, f)] = folds.size() - 1;
+    return folds.size() - 1;
   };
 
-  auto send = [&frontend](std::unique_ptr<Document> &doc) {
-    std::string json = JsonDocToString(doc.get());
-    char *ch         = new char[json.size() + 1];
-    ch[json.size()]  = '\n';
-    std::copy(json.begin(), json.end(), ch);
-    std::unique_ptr<snet::Buffer> data(
-        new snet::Buffer(ch, json.size() + 1, snet::OpDeleter));
-    frontend->Send(std::move(data));
+  std::vector<Aggregate> aggregates(agg_keys.size());
+  for (size_t i = 0; i < agg_keys.size(); ++i) {
+    const std::string &function = aggregation->keys_[i].function_;
+    Aggregate &a                = aggregates[i];
+    a.function_                 = function;
+    a.percentile_               = Aggregation::Percentile(function);
+    a.key_ = Key(function == Aggregation::SUM ? agg_keys[i]
+                                              : agg_keys[i] + "@" + function);
+    if (function == Aggregation::SUM || function == Aggregation::AVG) {
+      a.fold_ = fold_of(i, Fold::Sum);
+    } else if (function == Aggregation::MIN) {
+      a.fold_ = fold_of(i, Fold::Min);
+    } else if (function == Aggregation::MAX) {
+      a.fold_ = fold_of(i, Fold::Max);
+    } else if (function == Aggregation::DISTINCT) {
+      a.fold_ = fold_of(i, Fold::Distinct);
+    } else {
+      a.fold_ = fold_of(i, Fold::Quantile);
+    }
+    if (function == Aggregation::AVG) {
+      a.count_ = fold_of(i, Fold::Count);
+    }
+  }
+  size_t time_fold = folds.size();
+  if (!interval) {
+    folds.push_back(Fold::First);
+  }
+  std::set<std::string> grouped(terms.begin(), terms.end());
+  grouped.insert(agg_keys.begin(), agg_keys.end());
+  grouped.insert(aggregation->time_);
+
+  Key time_key(aggregation->time_), count_key("count"), path_key("path");
+  std::vector<Key> term_keys(terms.begin(), terms.end());
+  std::string constants;
+  bool constants_taken = false, has_path = false;
+
+  auto take_constants = [&](Document &doc) {
+    Document::AllocatorType allocator;
+    Document members(&allocator);
+    members.SetObject();
+    for (auto m = doc.MemberBegin(); m != doc.MemberEnd(); ++m) {
+      std::string name(m->name.GetString(), m->name.GetStringLength());
+      if (grouped.count(name) || ignore_set.count(name) || name == "count") {
+        continue;
+      }
+      has_path = has_path || name == "path";
+      members.AddMember(Value(m->name, allocator), Value(m->value, allocator),
+                        allocator);
+    }
+
+    std::string json;
+    AppendJsonDoc(&members, json);
+    if (json.size() > 2) {
+      constants = "," + json.substr(1, json.size() - 2);
+    }
+    constants_taken = true;
   };
 
-  LRUType::OnInsert oi = [path](std::unique_ptr<Document> &doc) {
-    if (!doc->HasMember("count")) {
-      doc->AddMember("count", int64_t(1), doc->GetAllocator());
+  // appends the row of a group to out
+  auto render = [&](const std::string &key, int64_t count, const Cell *cells,
+                    std::string &out) {
+    size_t start = out.size();
+    JsonWriter writer(out);
+    KeyReader reader(key);
+    Cell term;
+    boost::string_ref s;
+
+    if (interval) {
+      reader.Next(term, s);
+      add_cell(writer, time_key, term, s);
+    } else {
+      add_cell(writer, time_key, cells[time_fold], s);
+    }
+    for (auto &k : term_keys) {
+      reader.Next(term, s);
+      add_cell(writer, k, term, s);
     }
-    if (!doc->HasMember("path")) {
-      doc->AddMember("path", Value(path.c_str(), doc->GetAllocator()),
-                     doc->GetAllocator());
+    for (auto &a : aggregates) {
+      add_cell(writer, a.key_, a.Read(cells), s);
     }
+    writer.Raw(constants);
+    writer.Int64(count_key, count);
+    if (!has_path) {
+      writer.String(path_key, path);
+    }
+    // every member starts with a comma, the first one opens the object
+    out[start] = '{';
+    out += "}\n";
+
+    total += count;
+    ++aggre;
   };
 
-  LRUType::OnAggregation oa = [agg_keys](std::unique_ptr<Document> &lhs,
-                                         std::unique_ptr<Document> &rhs) {
-    rapidjson::Value &count = (*lhs)["count"];
-    count.SetInt64(count.GetInt64() + 1);
+  // With workers, each folds whole blocks into a table of its own, merged
+  // as the windows close, and the rows are taken from rows_mutex by the
+  // loop thread: a full table emits on its worker.
+  std::unique_ptr<GroupBy<>> groups;
+  std::unique_ptr<PartialGroupBy<>> partial;
+  std::mutex rows_mutex;
+  std::string json, rows;
+  if (opt.agg_workers_ > 0) {
+    logger->info("aggregation workers: {}", opt.agg_workers_);
+    partial.reset(new PartialGroupBy<>(
+        opt.agg_workers_, folds, opt.agg_groups_,
+        [&](const std::string &key, int64_t count, const Cell *cells) {
+          std::lock_guard<std::mutex> lock(rows_mutex);
+          render(key, count, cells, rows);
+        },
+        interval, opt.agg_lateness_));
+  } else {
+    groups.reset(new GroupBy<>(
+        folds, opt.agg_groups_,
+        [&](const std::string &key, int64_t count, const Cell *cells) {
+          json.clear();
+          render(key, count, cells, json);
+          batch.Append(json);
+        },
+        interval, opt.agg_lateness_));
+  }
 
-    for (auto &key : agg_keys) {
-      auto k = key.c_str();
+  // Only the steps adding the time, the terms and the keys run, into a
+  // projection the groups are keyed and folded from, unless a step reads
+  // the document back. The first line still goes through a document for
+  // the constants.
+  std::vector<std::string> members{aggregation->time_};
+  members.insert(members.end(), terms.begin(), terms.end());
+  members.insert(members.end(), agg_keys.begin(), agg_keys.end());
+  Projection projection(members);
+  Plan projected; // outlives the projection, which refers to its constants
+  bool pushed = CompileProjection(plan, members, projected);
+  if (pushed) {
+    logger->info("aggregation runs {} of {} steps", projected.steps_.size(),
+                 plan.steps_.size());
+  } else {
+    logger->info("aggregation through documents");
+  }
 
-      rapidjson::Value &l = (*lhs)[k];
-      rapidjson::Value &r = (*rhs)[k];
+  size_t time_slot = projection.Slot(aggregation->time_);
+  std::vector<size_t> term_slots, input_slots;
+  for (auto &term : terms) {
+    term_slots.push_back(projection.Slot(term));
+  }
+  for (auto input : inputs) {
+    input_slots.push_back(projection.Slot(agg_keys[input]));
+  }
 
-      // XXX: only support aggregation on int64 and double type
-      if (l.IsNumber() && l.GetType() == r.GetType()) {
-        if (l.IsInt64()) {
-          l.SetInt64(l.GetInt64() + r.GetInt64());
-        } else if (l.IsDouble()) {
-          l.SetDouble(l.GetDouble() + r.GetDouble());
-        }
+  // the time, key and cells of the line, from a projection, false without
+  // them; the workers do not log, their lines are counted
+  auto stage = [&](const Projection &projection, boost::string_ref line,
+                   bool warn, int64_t &timestamp, std::string &key,
+                   Cell *cells) -> bool {
+    boost::string_ref s;
+    const Cell &tm = projection.Get(time_slot, s);
+    if (tm.type_ != util::Type::Int64) {
+      if (warn) {
+        logger->warn("{}, no time: {}", path, line.to_string());
       }
+      return false;
     }
-  };
-
-  LRUType::OnEvict oe = [&send](std::unique_ptr<Document> &doc) {
-    rapidjson::Value &count = (*doc)["count"];
-    total += count.GetInt64();
-    ++aggre;
-    send(doc);
-  };
 
-  LRUType::OnClear oc = [&send](LRUType::map_type &m) {
-    for (auto &p : m) {
-      rapidjson::Value &count = (*p.second.first)["count"];
-      total += count.GetInt64();
-      ++aggre;
-      send(p.second.first);
+    timestamp = tm.int64_;
+    key.clear();
+    KeyWriter writer(key);
+    if (interval) {
+      writer.Int64(groups ? groups->WindowOf(timestamp)
+                          : partial->WindowOf(timestamp));
+    } else {
+      cells[time_fold] = tm;
     }
-  };
 
-  auto hash = [&aggregation](size_t &seed, std::unique_ptr<Document> &doc) {
-    if (aggregation->terms_) {
-      for (auto term : *aggregation->terms_) {
-        Value &v = (*doc)[term.c_str()];
-        if (v.IsString())
-          hash_combine(seed, std::string(v.GetString()));
-        else if (v.IsInt())
-          hash_combine(seed, v.GetInt());
-        else if (v.IsInt64())
-          hash_combine(seed, v.GetInt64());
-        else if (v.IsDouble())
-          hash_combine(seed, v.GetDouble());
-        else {
-          logger->error("unexpected value type: {}, term: {}", v.GetType(),
-                        term);
-          return false;
+    for (size_t i = 0; i < terms.size(); ++i) {
+      const Cell &c = projection.Get(term_slots[i], s);
+      if (!add_term(writer, c, s)) {
+        if (warn) {
+          logger->error("unexpected value type: {}, term: {}",
+                        static_cast<int>(c.type_), terms[i]);
         }
+        return false;
       }
     }
 
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      const Cell &c = projection.Get(input_slots[i], s);
+      cells[i]      = folds[i] == Fold::Distinct ? hashed(c, s) : number(c);
+    }
     return true;
   };
 
-  LRUType lru(3600, oi, oa, oe, oc);
-  auto handler = [&frontend, &config, &hash, &lru, &clean_doc, &path]() {
-    std::string line;
-    int interval = config.aggregation_->interval_;
-    while (frontend->CanSend() && queue.pop(line)) {
-      Log log;
-      if (!ParseLog(line, log, config.field_number_, config.time_index_)) {
-        logger->warn("{}, bad log: {}", path, line);
+  // the line folded into its group, from the projection
+  std::string key;
+  std::vector<Cell> cells(folds.size());
+  auto fold = [&](boost::string_ref line) {
+    int64_t timestamp;
+    if (stage(projection, line, true, timestamp, key, cells.data())) {
+      groups->Add(timestamp, key, cells.data());
+    }
+  };
+
+  BlockReader reader;
+  Log log;
+  auto handler = [&]() {
+    // per thread, the document stays off the heap
+    thread_local char buffer[64 * 1024];
+
+    boost::string_ref line;
+    while (frontend->CanSend() && reader.Next(line)) {
+      log.clear();
+      if (!ParseLog(line.begin(), line.end(), log, config.field_number_,
+                    config.time_index_)) {
+        logger->warn("{}, bad log: {}", path, line.to_string());
         continue;
       }
 
-      std::unique_ptr<rapidjson::Document> doc(new rapidjson::Document());
-      if (!PopulateJsonDoc(doc.get(), log, config)) {
-        logger->warn("{}, json error: {}", path, line);
+      if (pushed && constants_taken) {
+        if (!ProjectLog(log, projected, projection)) {
+          logger->warn("{}, json error: {}", path, line.to_string());
+          continue;
+        }
+        fold(line);
         continue;
       }
 
-      clean_doc(doc);
-      size_t timestamp;
-      if (interval) {
-        rapidjson::Value &tm = (*doc)[config.aggregation_->time_.c_str()];
+      Document::AllocatorType allocator(buffer, sizeof(buffer));
+      Document doc(&allocator);
+      if (!PopulateJsonDoc(&doc, log, plan)) {
+        logger->warn("{}, json error: {}", path, line.to_string());
+        continue;
+      }
+      if (!constants_taken) {
+        take_constants(doc);
+      }
+      // the projection refers to the document, folded before it goes
+      ProjectJsonDoc(doc, projection);
+      fold(line);
+    }
+  };
 
-        timestamp = tm.GetInt64();
-        timestamp = timestamp - (timestamp % interval);
-        tm.SetInt64(timestamp);
-      } else {
-        timestamp = 0;
+  // A worker's own projection and staged lines; the pool threads claim one
+  // each, folding into the partial table of the same number.
+  struct Stage {
+    Stage(const std::vector<std::string> &members, size_t width)
+        : projection_(members), block_(width) {}
+
+    Log log_;
+    Projection projection_;
+    PartialGroupBy<>::Block block_;
+  };
+  std::vector<std::unique_ptr<Stage>> stages;
+  std::atomic<size_t> claimed(0);
+  std::unique_ptr<AggPool> pool;
+  if (partial) {
+    for (int i = 0; i < opt.agg_workers_; ++i) {
+      stages.emplace_back(new Stage(members, folds.size()));
+    }
+    pool.reset(new AggPool(
+        opt.agg_workers_, true, [&](AggBlock &in, AggOut &out) {
+          thread_local size_t worker = claimed++;
+          // per thread, the document stays off the heap
+          thread_local char buffer[64 * 1024];
+
+          Stage &st = *stages[worker % stages.size()];
+          st.block_.Clear();
+          for (size_t i = 0; i < in.block_->Size(); ++i) {
+            boost::string_ref line = in.block_->Line(i);
+            int64_t timestamp;
+            st.log_.clear();
+            if (!ParseLog(line.begin(), line.end(), st.log_,
+                          config.field_number_, config.time_index_)) {
+              ++out.skipped_;
+              continue;
+            }
+
+            bool staged;
+            if (pushed) {
+              staged = ProjectLog(st.log_, projected, st.projection_) &&
+                       stage(st.projection_, line, false, timestamp,
+                             st.block_.Key(), st.block_.Cells());
+            } else {
+              Document::AllocatorType allocator(buffer, sizeof(buffer));
+              Document doc(&allocator);
+              staged = PopulateJsonDoc(&doc, st.log_, plan);
+              if (staged) {
+                ProjectJsonDoc(doc, st.projection_);
+                staged = stage(st.projection_, line, false, timestamp,
+                               st.block_.Key(), st.block_.Cells());
+              }
+            }
+            if (staged) {
+              st.block_.Add(timestamp);
+            } else {
+              ++out.skipped_;
+            }
+          }
+          out.latest_ = partial->Add(worker, in.seq_, st.block_);
+          queue->Release(in.block_);
+        }));
+    pool->SetReadyHandler([]() { queue->Wake(); });
+  }
+
+  // the constants from the first line of a block that makes a document
+  auto take_from = [&](const LineBlock &block) {
+    thread_local char buffer[64 * 1024];
+    for (size_t i = 0; i < block.Size() && !constants_taken; ++i) {
+      boost::string_ref line = block.Line(i);
+      log.clear();
+      Document::AllocatorType allocator(buffer, sizeof(buffer));
+      Document doc(&allocator);
+      if (ParseLog(line.begin(), line.end(), log, config.field_number_,
+                   config.time_index_) &&
+          PopulateJsonDoc(&doc, log, plan)) {
+        take_constants(doc);
+      }
+    }
+  };
+
+  // the blocks out to the pool, in the order they come back
+  std::deque<AggBlock> inflight;
+  uint64_t seq = 0, skipped = 0;
+  int64_t closed = INT64_MIN;
+  auto pooled = [&]() {
+    std::unique_ptr<AggOut> out;
+    while ((out = pool->Collect())) {
+      inflight.pop_front();
+      skipped += out->skipped_;
+      // the blocks before are folded, the windows their latest time closes
+      // get no more lines
+      if (partial->ClosedBy(out->latest_) > closed) {
+        closed = partial->ClosedBy(out->latest_);
+        partial->Close(out->latest_);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(rows_mutex);
+      if (!rows.empty()) {
+        batch.Append(rows);
+        rows.clear();
       }
+    }
 
-      if (hash(timestamp, doc)) {
-        lru.insert(timestamp, std::move(doc));
+    LineBlock *block;
+    while (frontend->CanSend() && pool->CanDispatch() &&
+           (block = queue->Pop())) {
+      if (!constants_taken) {
+        take_from(*block);
       }
+      inflight.push_back(AggBlock{block, seq++});
+      pool->Dispatch(&inflight.back());
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(1));
   };
 
-  auto callback = [&event_loop, &send_timer, &timer_driver, &handler, &lru,
-                   &frontend]() {
-    if (done && queue.empty()) {
-      lru.clear();
-      if (frontend->SendComplete()) {
+  bool flushed  = false;
+  auto callback = [&]() {
+    if (done && reader.Empty() && (!pool || pool->Idle())) {
+      if (!flushed) {
+        flushed = true;
+        if (partial) {
+          partial->Flush();
+          if (!rows.empty()) {
+            batch.Append(rows);
+            rows.clear();
+          }
+          logger->info("{}, lines skipped by the workers: {}", path, skipped);
+        } else {
+          groups->Flush();
+        }
+        logger->info("{}, late lines dropped: {}, windows emitted early: {}",
+                     path, partial ? partial->Late() : groups->Late(),
+                     partial ? partial->Early() : groups->Early());
+      }
+      batch_timer.Flush();
+      if (batch.Empty() && frontend->SendComplete()) {
         event_loop->Stop();
         event_loop->DelLoopHandler(&timer_driver);
         logger->info("cycle completed");
         return;
       }
+    } else if (pool) {
+      pooled();
     } else {
       handler();
     }
-    send_timer.ExpireFromNow(snet::Milliseconds(1));
+    batch_timer.Arm();
+    if (!frontend->CanSend() || done) {
+      send_timer.ExpireFromNow(snet::Milliseconds(1));
+    }
   };
 
+  QueueWakeup wakeup(event_loop, callback);
   send_timer.ExpireFromNow(snet::Milliseconds(0));
   send_timer.SetOnTimeout(callback);
   event_loop->AddLoopHandler(&timer_driver);
   event_loop->Loop();
 }
 
+inline void push(LineBlock *block) {
+  if (block->Empty()) {
+    queue->Release(block);
+    return;
+  }
+
+  auto before = lines;
+  lines += block->Size();
+  if (before / 100000 != lines / 100000) {
+    logger->info("input lines: {}", lines);
+  }
+  queue->Push(block);
+}
+
 template <typename T>
 inline void produce(T &is) {
   std::string line;
+  LineBlock *block = queue->Acquire();
   while (std::getline(is, line)) {
-    ++lines;
-    if (lines % 100000 == 0) {
-      logger->info("input lines: {}", lines);
+    if (!block->Append(line.data(), line.size())) {
+      push(block);
+      block = queue->Acquire();
+      block->Append(line.data(), line.size());
+    }
+  }
+  push(block);
+}
+
+// Plain files are mapped and queued as views, no per line copy.
+void mapped_producer(const MappedFile &file) {
+  LineScanner scanner(file.Data(), file.Size());
+  boost::string_ref line;
+  LineBlock *block = queue->Acquire();
+  while (scanner.Next(line)) {
+    if (!block->AppendView(line.data(), line.size())) {
+      push(block);
+      block = queue->Acquire();
+      block->AppendView(line.data(), line.size());
     }
-    while (!queue.push(std::move(line)))
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
+  push(block);
 }
 
-void producer(std::string path) {
+bool producer(std::string path) {
   std::ifstream is(path);
   if (!is.is_open()) {
     logger->error("cannot open: {}", path);
-    return;
+    return false;
   }
 
   produce(is);
+  if (is.bad()) {
+    logger->error("cannot read: {}", path);
+    return false;
+  }
+  return true;
 }
 
-void gzip_producer(std::string path) {
-  igzstream is(path.c_str(), std::ios_base::in | std::ios_base::binary);
-  if (!is.good()) {
-    logger->error("cannot open: {}", path);
-    return;
-  }
+bool gzip_producer(std::string path, size_t threads) {
+  GzipReader reader(threads);
+  LineBlock *block = queue->Acquire();
+  std::string partial; // a line split across two pieces of output
 
-  produce(is);
+  auto append = [&block](const char *data, size_t size) {
+    if (!block->Append(data, size)) {
+      push(block);
+      block = queue->Acquire();
+      block->Append(data, size);
+    }
+  };
+
+  bool ok = reader.Read(path, [&append, &partial](const char *data,
+                                                   size_t size) {
+    LineScanner scanner(data, size);
+    boost::string_ref line;
+    while (scanner.Next(line)) {
+      if (scanner.Position() == data + size && data[size - 1] != '\n') {
+        partial.append(line.data(), line.size());
+        break;
+      }
+
+      if (partial.empty()) {
+        append(line.data(), line.size());
+      } else {
+        partial.append(line.data(), line.size());
+        append(partial.data(), partial.size());
+        partial.clear();
+      }
+    }
+  });
+
+  if (!partial.empty()) {
+    append(partial.data(), partial.size());
+  }
+  push(block);
+  if (!ok) {
+    // what inflated before the damage is sent, the rest is lost
+    logger->error("cannot inflate: {}", path);
+  }
+  return ok;
 }
 
-void cycle(snet::EventLoop *event_loop, Frontend *frontend, std::string path,
-           Config &cfg) {
+// false when the config does not compile or the input is not read whole
+bool cycle(snet::EventLoop *event_loop, Frontend *frontend, std::string path,
+           Config &cfg, const Option &opt) {
   TimerGuard tg;
+  Plan plan; // outlives the documents, which refer to its keys
+  if (!CompilePlan(cfg, plan)) {
+    logger->error("invalid config for: {}", path);
+    return false;
+  }
+  if (!cfg.aggregation_ && !CompileStream(plan, path)) {
+    logger->info("json through documents for: {}", path);
+  }
+
+  MappedFile file; // lines of a mapped file are consumed in the loop thread
   std::thread loop_thread;
 
   event_loop->Ready();
 
   if (cfg.aggregation_) {
     loop_thread =
-        std::thread(std::bind(agg, event_loop, frontend, path, std::cref(cfg)));
+        std::thread(std::bind(agg, event_loop, frontend, path, std::cref(cfg),
+                              std::cref(plan), std::cref(opt)));
   } else {
-    loop_thread = std::thread(
-        std::bind(loop, event_loop, frontend, path, std::cref(cfg)));
+    loop_thread =
+        std::thread(std::bind(loop, event_loop, frontend, path, std::cref(cfg),
+                              std::cref(plan), std::cref(opt)));
   }
 
+  bool read = true;
   if (boost::algorithm::ends_with(path, ".gz")) {
-    gzip_producer(path);
+    read = gzip_producer(path, opt.inflate_threads_);
+  } else if (file.Open(path)) {
+    mapped_producer(file);
   } else {
-    producer(path);
+    read = producer(path);
   }
 
   done = true;
+  queue->Wake();
   loop_thread.join();
 
   logger->info("input: {}, handle: {}, aggregation: {}, {}%", lines, total,
                aggre, total == 0 ? 0 : aggre * 100.0 / total);
+  if (!read) {
+    logger->error("input failed: {}", path);
+  }
+  return read;
 }
 
 void fix_config(Config &cfg, bool show = false) {
@@ -379,7 +1010,7 @@ void fix_config(Config &cfg, bool show = false) {
   auto agg = cfg.aggregation_;
   for (auto &attr : cfg.attributes_) {
     if (attr.name_ == agg->time_) {
-      attr.attribute_[1] = Attribute::STORE;
+      attr.arguments_[0] = Attribute::STORE;
     }
   }
 
@@ -393,7 +1024,7 @@ void fix_config(Config &cfg, bool show = false) {
     if (i != 0) {
       ss << ",";
     }
-    ss << agg->keys_[i];
+    ss << agg->keys_[i].function_ << "(" << agg->keys_[i].name_ << ")";
   }
   ss << "]";
 
@@ -410,11 +1041,13 @@ void fix_config(Config &cfg, bool show = false) {
 
 int main(int argc, char *argv[]) {
   signal(SIGPIPE, SIG_IGN);
+  signal(SIGHUP, [](int) { IPResolver::RequestReload(); });
 
   Option opt;
   ParseOption(argc, argv, opt);
 
-  InitIPResolver(opt.ip_db_path_);
+  InitIPResolver(opt.ip_db_path_, opt.ip6_db_path_, opt.db_check_);
+  queue.reset(new BlockQueue(opt.queue_size_));
 
   auto event_loop = snet::CreateEventLoop(1000000);
   snet::TimerList timer_list;
@@ -463,7 +1096,8 @@ int main(int argc, char *argv[]) {
 
         fix_config(cfg);
         done = false;
-        cycle(event_loop.get(), &frontend, path.GetString(), cfg);
+        // a failed input is logged, the queue moves on
+        cycle(event_loop.get(), &frontend, path.GetString(), cfg, opt);
       } else {
         std::this_thread::sleep_for(std::chrono::seconds(2));
       }
@@ -474,7 +1108,9 @@ int main(int argc, char *argv[]) {
       return 1;
     }
     fix_config(cfg);
-    cycle(event_loop.get(), &frontend, opt.log_path_, cfg);
+    if (!cycle(event_loop.get(), &frontend, opt.log_path_, cfg, opt)) {
+      return 1;
+    }
   }
 
   return 0;
@@ -122,6 +122,61 @@ void Frontend::HandleTunnelData(std::unique_ptr<snet::Buffer> data) {
                 std::string(data->buf, data->buf + data->size));
 }
 
+void SendBatch::Append(const char *data, size_t size) {
+  if (size_ + size > batch_) {
+    Flush();
+    if (size >= batch_) {
+      char *ch = new char[size];
+      memcpy(ch, data, size);
+      std::unique_ptr<snet::Buffer> buffer(
+          new snet::Buffer(ch, size, snet::OpDeleter));
+      frontend_->Send(std::move(buffer));
+      return;
+    }
+  }
+
+  if (!data_) {
+    data_ = new char[batch_];
+  }
+  memcpy(data_ + size_, data, size);
+  size_ += size;
+}
+
+void SendBatch::Flush() {
+  if (size_ == 0) {
+    return;
+  }
+
+  std::unique_ptr<snet::Buffer> buffer(
+      new snet::Buffer(data_, size_, snet::OpDeleter));
+  data_ = nullptr;
+  size_ = 0;
+  frontend_->Send(std::move(buffer));
+}
+
+BatchTimer::BatchTimer(snet::TimerList *timer_list, Frontend *frontend,
+                       SendBatch *batch, int delay)
+    : frontend_(frontend), batch_(batch), delay_(delay), timer_(timer_list) {
+  timer_.SetOnTimeout([this]() {
+    armed_ = false;
+    Flush();
+    Arm();
+  });
+}
+
+void BatchTimer::Arm() {
+  if (!armed_ && !batch_->Empty()) {
+    armed_ = true;
+    timer_.ExpireFromNow(snet::Milliseconds(delay_));
+  }
+}
+
+void BatchTimer::Flush() {
+  if (frontend_->CanSend()) {
+    batch_->Flush();
+  }
+}
+
 Client::Client(std::unique_ptr<snet::Connection> connection)
     : connection_(std::move(connection)) {
   connection_->SetOnError([this]() { HandleError(); });
@@ -1,10 +1,12 @@
 #include <iostream>
 
 #include "spdlog/spdlog.h"
+#include "rapidjson/internal/dtoa.h"
+#include "rapidjson/internal/itoa.h"
 #include "fluorine/log/Json.hpp"
 #include "fluorine/log/Parser.hpp"
 
-static auto logger = spdlog::stdout_color_st("Json");
+static auto logger = spdlog::stdout_color_mt("Json");
 
 namespace fluorine {
 namespace json {
@@ -12,6 +14,79 @@ namespace json {
 std::set<std::string> IPFields{"country", "province", "city", "isp"};
 std::set<std::string> RequestFields{"method", "scheme", "domain"};
 
+Key::Key(const string &name) : name_(name), prefix_(",") {
+  JsonWriter::Quote(name_, prefix_);
+  prefix_ += ':';
+}
+
+// the escape rapidjson's Writer uses for a byte, 0 for none
+static char escape(unsigned char c) {
+  static const char table[] = {
+      'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r',
+      'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+      'u', 'u', 'u', 'u'};
+
+  if (c < 0x20) {
+    return table[c];
+  }
+  return c == '"' || c == '\\' ? c : 0;
+}
+
+void JsonWriter::Quote(Field s, std::string &out) {
+  static const char hex[] = "0123456789ABCDEF";
+
+  out += '"';
+  const char *p = s.data(), *end = s.data() + s.size(), *run = p;
+  for (; p < end; ++p) {
+    char e = escape(static_cast<unsigned char>(*p));
+    if (!e) {
+      continue;
+    }
+
+    out.append(run, p);
+    run = p + 1;
+    out += '\\';
+    out += e;
+    if (e == 'u') {
+      unsigned char c = static_cast<unsigned char>(*p);
+      out += "00";
+      out += hex[c >> 4];
+      out += hex[c & 0xF];
+    }
+  }
+  out.append(run, end);
+  out += '"';
+}
+
+void JsonWriter::Int64(const Key &k, int64_t v) {
+  char buf[24];
+  out_ += k.prefix_;
+  out_.append(buf, internal::i64toa(v, buf));
+}
+
+void JsonWriter::Double(const Key &k, double v) {
+  char buf[32];
+  out_ += k.prefix_;
+  out_.append(buf, internal::dtoa(v, buf));
+}
+
+Projection::Projection(const std::vector<string> &names) {
+  for (auto &name : names) {
+    if (Slot(name) == Size()) {
+      members_.push_back(Member{name, util::Cell(), Field()});
+    }
+  }
+}
+
+size_t Projection::Slot(const string &name) const {
+  for (size_t i = 0; i < members_.size(); ++i) {
+    if (members_[i].name_ == name) {
+      return i;
+    }
+  }
+  return members_.size();
+}
+
 std::string JsonDocToString(Document *doc) {
   StringBuffer sb;
   Writer<StringBuffer> writer(sb);
@@ -19,62 +94,470 @@ std::string JsonDocToString(Document *doc) {
   return sb.GetString();
 }
 
-bool PopulateJsonDoc(Document *doc, const Log &log, const Config &cfg) {
-  if (cfg.field_number_ && static_cast<int>(log.size()) != cfg.field_number_) {
-    logger->error("invalid log, log fields: {}, expected: {}", log.size(),
-                  cfg.field_number_);
-    return false;
+void AppendJsonDoc(Document *doc, std::string &out) {
+  thread_local StringBuffer sb;
+  thread_local Writer<StringBuffer> writer(sb);
+
+  sb.Clear();
+  writer.Reset(sb);
+  doc->Accept(writer);
+  out.append(sb.GetString(), sb.GetSize());
+}
+
+// the time field spanning two log fields, a view when they are separated by
+// one space in the line
+static Field joinFields(const Field &a, const Field &b, std::string &buf) {
+  if (b.data() == a.data() + a.size() + 1 && a.data()[a.size()] == ' ') {
+    return Field(a.data(), a.size() + 1 + b.size());
   }
 
-  doc->SetObject();
-  string_handler(*doc, "type", cfg.name_);
+  buf.assign(a.data(), a.size());
+  buf += ' ';
+  buf.append(b.data(), b.size());
+  return buf;
+}
 
-  auto &attributes = cfg.attributes_;
-  for (size_t i = 0, j = 0; i < attributes.size(); ++i) {
-    auto attribute = attributes[i].attribute_;
+// the members a step may add, to find the added attributes that replace one
+static void addedKeys(const Step &step, std::set<std::string> &keys) {
+  if (step.handler_ == request_handler<Document>) {
+    keys.insert(RequestFields.begin(), RequestFields.end());
+  } else if (step.handler_ != misc_live_filter) {
+    keys.insert(step.key_.name_);
+    for (auto &k : step.derived_) {
+      keys.insert(k.name_);
+    }
+  }
+}
+
+bool CompilePlan(const Config &cfg, Plan &plan) {
+  plan.field_number_    = cfg.field_number_;
+  plan.type_.action_    = Action::Add;
+  plan.type_.handler_   = string_handler<Document>;
+  plan.type_.emitter_   = string_handler<JsonWriter>;
+  plan.type_.collector_ = string_handler<Projection>;
+  plan.type_.key_       = Key("type");
+  plan.type_.value_     = cfg.name_;
+  plan.steps_.clear();
+  plan.stream_ = false;
 
-    if (attribute[1] == Attribute::IGNORE) {
+  std::set<std::string> keys{plan.type_.key_.name_};
+  int time_index = cfg.time_index_ - 1;
+  size_t j       = 0;
+
+  for (auto &attr : cfg.attributes_) {
+    auto &arguments = attr.arguments_;
+    if (arguments.empty()) {
+      logger->error("invalid attribute: {}", attr.name_);
+      return false;
+    }
+
+    if (arguments[0] == Attribute::IGNORE) {
       ++j;
       continue;
     }
 
-    auto it = handlers.find(attribute[0]);
+    auto it = handlers.find(attr.type_);
     if (it == handlers.end()) {
-      logger->error("invalid attribute: {}", attribute[0]);
+      logger->error("invalid attribute: {}", attr.type_);
       return false;
     }
 
-    int time_index = cfg.time_index_ - 1;
-    int time_span  = cfg.time_span_;
+    Step step;
+    step.handler_   = it->second.handler_;
+    step.emitter_   = it->second.emitter_;
+    step.collector_ = it->second.collector_;
+    step.key_       = Key(attr.name_);
 
-    if (attribute[1] == Attribute::STORE && j < log.size()) {
-      if (static_cast<int>(j) == time_index && time_span > 0) {
-        if (!it->second(*doc, attributes[i].name_, log[j] + " " + log[j + 1])) {
-          return false;
-        }
+    if (attr.type_ == "time") {
+      std::string error;
+      if (!step.format_.Compile(attr.format_, error)) {
+        logger->error("time format of {}: {}", attr.name_, error);
+        return false;
+      }
+    } else if (!attr.format_.empty()) {
+      logger->error("format given to {}: {}", attr.type_, attr.name_);
+      return false;
+    }
+
+    if (arguments[0] == Attribute::STORE) {
+      step.field_ = j;
+      if (static_cast<int>(j) == time_index && cfg.time_span_ > 0) {
+        step.action_ = Action::StoreSpan;
         j += 2;
       } else {
-        if (!it->second(*doc, attributes[i].name_, log[j++])) {
-          return false;
-        }
+        step.action_ = Action::Store;
+        ++j;
+      }
+    } else if (arguments[0] == Attribute::ADD) {
+      if (arguments.size() < 2) {
+        logger->error("no value to add: {}", attr.name_);
+        return false;
       }
-    } else if (attribute[1] == Attribute::ADD) {
-      if (doc->HasMember(attributes[i].name_.c_str())) {
-        doc->RemoveMember(attributes[i].name_.c_str());
+      step.action_ =
+          keys.count(step.key_.name_) ? Action::Replace : Action::Add;
+      step.value_ = arguments[1];
+    } else {
+      continue;
+    }
+
+    if (step.handler_ == ip_handler<Document>) {
+      for (auto suffix : {"@country", "@province", "@city", "@isp"}) {
+        step.derived_.push_back(Key(step.key_.name_ + suffix));
       }
+    }
+
+    addedKeys(step, keys);
+    plan.steps_.push_back(std::move(step));
+  }
+
+  return true;
+}
 
-      if (!it->second(*doc, attributes[i].name_, attribute[2])) {
+static bool checkFields(const Log &log, const Plan &plan) {
+  if (plan.field_number_ &&
+      static_cast<int>(log.size()) != plan.field_number_) {
+    logger->error("invalid log, log fields: {}, expected: {}", log.size(),
+                  plan.field_number_);
+    return false;
+  }
+  return true;
+}
+
+static bool apply(const Step &step, Document &doc, Field v) {
+  return step.handler_(doc, step, v);
+}
+
+static bool apply(const Step &step, JsonWriter &w, Field v) {
+  return step.emitter_(w, step, v);
+}
+
+static bool apply(const Step &step, Projection &p, Field v) {
+  return step.collector_(p, step, v);
+}
+
+static bool constant(const Step &step, Document &doc) {
+  return step.handler_(doc, step, step.value_);
+}
+
+static bool constant(const Step &step, JsonWriter &w) {
+  if (step.replaced_) {
+    return true;
+  }
+  if (step.fragment_.empty()) {
+    return step.emitter_(w, step, step.value_);
+  }
+  w.Raw(step.fragment_);
+  return true;
+}
+
+static bool constant(const Step &step, Projection &p) {
+  return step.collector_(p, step, step.value_);
+}
+
+static void remove(Document &doc, const Step &step) {
+  doc.RemoveMember(step.key_.name_.c_str());
+}
+
+// streamed plans skip the replaced constant instead, see CompileStream
+static void remove(JsonWriter &, const Step &) {}
+
+// the constant overwrites the member
+static void remove(Projection &, const Step &) {}
+
+// The addresses ResolveAhead() resolved, in line order, each with the
+// index of its field. The fields of line i are first_[i] to first_[i + 1],
+// the lines matched by their Log, not by where their fields point, which
+// for a field the parser owns is anywhere.
+struct Resolved {
+  std::vector<Field> ips_;
+  std::vector<size_t> fields_;
+  std::vector<IPResolver::LRUValueType> results_;
+  std::vector<const Log *> lines_;
+  std::vector<size_t> first_;
+  size_t line_  = 0;     // the line emitting, or the last one
+  bool current_ = false; // whether the one emitting is line_
+};
+
+static thread_local Resolved resolved;
+
+// the lines are emitted in order, a line not resolved ahead takes nothing
+static void enterResolved(const Log &log) {
+  size_t line = resolved.line_;
+  while (line < resolved.lines_.size() && resolved.lines_[line] != &log) {
+    ++line;
+  }
+  resolved.current_ = line < resolved.lines_.size();
+  if (resolved.current_) {
+    resolved.line_ = line;
+  }
+}
+
+template <typename Out>
+static bool runSteps(Out &out, const Log &log, const Plan &plan) {
+  if (!resolved.lines_.empty()) {
+    enterResolved(log);
+  }
+  std::string joined;
+  for (auto &step : plan.steps_) {
+    bool ok = true;
+    switch (step.action_) {
+    case Action::Store:
+      if (step.field_ < log.size()) {
+        ok = apply(step, out, log[step.field_]);
+      }
+      break;
+    case Action::StoreSpan:
+      if (step.field_ + 1 < log.size()) {
+        ok = apply(step, out,
+                   joinFields(log[step.field_], log[step.field_ + 1], joined));
+      }
+      break;
+    case Action::Replace:
+      remove(out, step);
+      ok = constant(step, out);
+      break;
+    case Action::Add:
+      ok = constant(step, out);
+      break;
+    }
+
+    if (!ok) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool PopulateJsonDoc(Document *doc, const Log &log, const Plan &plan) {
+  if (!checkFields(log, plan)) {
+    return false;
+  }
+
+  doc->SetObject();
+  string_handler(*doc, plan.type_, plan.type_.value_);
+  return runSteps(*doc, log, plan);
+}
+
+// a constant adding the one member, which a replacing step can drop
+static bool singleConstant(const Step &step) {
+  return step.action_ != Action::Store && step.action_ != Action::StoreSpan &&
+         step.handler_ != ip_handler<Document> &&
+         step.handler_ != request_handler<Document>;
+}
+
+bool CompileStream(Plan &plan, const std::string &path) {
+  plan.stream_ = false;
+
+  // the steps that added each member so far, null for type
+  std::map<std::string, std::vector<Step *>> added{{"type", {nullptr}}};
+  bool type_replaced = false;
+  for (auto &step : plan.steps_) {
+    if (!step.emitter_) {
+      return false;
+    }
+
+    step.replaced_ = false;
+    if (step.action_ == Action::Replace) {
+      // the member is left out instead of removed, possible only when a
+      // constant added it, the document moves its last member there
+      auto &by = added[step.key_.name_];
+      if (by.size() != 1 || (by[0] && !singleConstant(*by[0]))) {
         return false;
       }
+      if (by[0]) {
+        by[0]->replaced_ = true;
+      } else {
+        type_replaced = true;
+      }
+      by.clear();
+    }
+
+    std::set<std::string> keys;
+    addedKeys(step, keys);
+    for (auto &key : keys) {
+      added[key].push_back(&step);
+    }
+  }
+  // the document path adds it only when no attribute did
+  if (added.count("path")) {
+    return false;
+  }
+
+  // constants are rendered once, but for ip lookups the db answers
+  for (auto &step : plan.steps_) {
+    step.fragment_.clear();
+    if (step.action_ != Action::Store && step.action_ != Action::StoreSpan &&
+        step.handler_ != ip_handler<Document>) {
+      JsonWriter writer(step.fragment_);
+      if (!step.emitter_(writer, step, step.value_)) {
+        return false;
+      }
+    }
+  }
+
+  plan.head_.clear();
+  if (!type_replaced) {
+    JsonWriter head(plan.head_);
+    string_handler(head, plan.type_, plan.type_.value_);
+  }
+
+  plan.tail_.clear();
+  JsonWriter tail(plan.tail_);
+  tail.String(Key("path"), path);
+  plan.tail_ += '}';
+
+  plan.stream_ = true;
+  return true;
+}
+
+bool EmitJson(const Log &log, const Plan &plan, std::string &out) {
+  ASSERT(plan.stream_);
+  if (!checkFields(log, plan)) {
+    return false;
+  }
+
+  size_t mark = out.size();
+  out += plan.head_;
+  JsonWriter writer(out);
+  if (!runSteps(writer, log, plan)) {
+    out.resize(mark);
+    return false;
+  }
+  out += plan.tail_;
+  // every member starts with a comma, the first one opens the object
+  out[mark] = '{';
+  return true;
+}
+
+void ResolveAhead(const std::vector<const Log *> &logs, const Plan &plan) {
+  DropResolved();
+  for (auto log : logs) {
+    resolved.lines_.push_back(log);
+    resolved.first_.push_back(resolved.ips_.size());
+    for (auto &step : plan.steps_) {
+      if (step.handler_ == ip_handler<Document> &&
+          step.action_ == Action::Store && step.field_ < log->size()) {
+        resolved.ips_.push_back((*log)[step.field_]);
+        resolved.fields_.push_back(step.field_);
+      }
+    }
+  }
+  resolved.first_.push_back(resolved.ips_.size());
+
+  resolved.results_.resize(resolved.ips_.size());
+  util::ResolveIPs(resolved.ips_.data(), resolved.ips_.size(),
+                   resolved.results_.data());
+}
+
+void DropResolved() {
+  resolved.ips_.clear();
+  resolved.fields_.clear();
+  resolved.results_.clear();
+  resolved.lines_.clear();
+  resolved.first_.clear();
+  resolved.line_    = 0;
+  resolved.current_ = false;
+}
+
+bool TakeResolved(const Step &s, IPResolver::LRUValueType &result) {
+  if (!resolved.current_) {
+    return false;
+  }
+  // a result is taken once, a second step of the field takes the next
+  for (size_t i = resolved.first_[resolved.line_];
+       i < resolved.first_[resolved.line_ + 1]; ++i) {
+    if (resolved.fields_[i] == s.field_ && resolved.results_[i]) {
+      result               = resolved.results_[i];
+      resolved.results_[i] = nullptr;
+      return true;
+    }
+  }
+  return false;
+}
+
+// whether a step can drop a line, its conversion rejecting the field or
+// constant, the others add what they read as it is
+static bool mayDrop(const Step &step) {
+  return step.collector_ != string_handler<Projection> &&
+         step.collector_ != ip_handler<Projection> &&
+         step.collector_ != status_handler<Projection>;
+}
+
+bool CompileProjection(const Plan &plan, const std::vector<string> &members,
+                       Plan &projected) {
+  std::set<std::string> wanted(members.begin(), members.end());
+  projected.field_number_ = plan.field_number_;
+  projected.type_         = plan.type_;
+  projected.steps_.clear();
+  projected.stream_ = false;
+
+  for (auto &step : plan.steps_) {
+    if (!step.collector_) {
+      return false;
+    }
+
+    std::set<std::string> keys;
+    addedKeys(step, keys);
+    bool needed = false, derived = false;
+    for (auto &key : keys) {
+      if (wanted.count(key)) {
+        needed  = true;
+        derived = derived || key != step.key_.name_;
+      }
+    }
+    // a line drops as its document would, the steps that can drop it run
+    // for their checks, what they add is not kept
+    if (!needed) {
+      if (mayDrop(step)) {
+        projected.steps_.push_back(step);
+      }
+      continue;
+    }
+
+    projected.steps_.push_back(step);
+    if (step.handler_ == ip_handler<Document> && !derived) {
+      projected.steps_.back().collector_ = string_handler<Projection>;
     }
   }
 
   return true;
 }
 
-bool LogToJsonString(Log &log, std::string &json, const Config &cfg) {
+bool ProjectLog(const Log &log, const Plan &projected, Projection &out) {
+  if (!checkFields(log, projected)) {
+    return false;
+  }
+
+  out.Clear();
+  string_handler(out, projected.type_, projected.type_.value_);
+  return runSteps(out, log, projected);
+}
+
+void ProjectJsonDoc(const Document &doc, Projection &out) {
+  out.Clear();
+  for (size_t i = 0; i < out.Size(); ++i) {
+    auto m = doc.FindMember(out.Name(i).c_str());
+    if (m == doc.MemberEnd()) {
+      continue;
+    }
+
+    const Value &v = m->value;
+    if (v.IsString()) {
+      util::Cell c;
+      c.type_ = util::Type::String;
+      out.Set(i, c, Field(v.GetString(), v.GetStringLength()));
+    } else if (v.IsInt64()) {
+      out.Set(i, util::Cell::Int64(v.GetInt64()));
+    } else if (v.IsDouble()) {
+      out.Set(i, util::Cell::Double(v.GetDouble()));
+    }
+  }
+}
+
+bool LogToJsonString(Log &log, std::string &json, const Plan &plan) {
   Document doc;
-  if (PopulateJsonDoc(&doc, log, cfg)) {
+  if (PopulateJsonDoc(&doc, log, plan)) {
     json = JsonDocToString(&doc);
     return true;
   }
@@ -21,6 +21,28 @@ static void optionDependency(const po::variables_map &vm, const char *x,
   }
 }
 
+static void optionRange(const po::variables_map &vm, const char *x,
+                        long long min, long long max) {
+  if (!vm.count(x)) {
+    return;
+  }
+  // unsigned options given negative values wrap past any max
+  const auto &v = vm[x].value();
+  long long n   = 0;
+  bool wrapped  = false;
+  if (auto p = boost::any_cast<int>(&v)) {
+    n = *p;
+  } else if (auto p = boost::any_cast<size_t>(&v)) {
+    wrapped = *p > static_cast<size_t>(max);
+    n       = static_cast<long long>(*p);
+  }
+  if (wrapped || n < min || n > max) {
+    throw std::logic_error(std::string("Option '") + x + "' must be in [" +
+                           std::to_string(min) + ", " + std::to_string(max) +
+                           "].");
+  }
+}
+
 // https://github.com/boostorg/program_options/tree/develop/example
 void ParseOption(int argc, char *argv[], Option &opt) {
   using namespace boost::program_options;
@@ -32,9 +54,20 @@ void ParseOption(int argc, char *argv[], Option &opt) {
       ("config,c", value(&opt.config_path_), "config file path")
       ("log,l", value(&opt.log_path_), "log file path")
       ("db,d", value(&opt.ip_db_path_)->default_value("/opt/17monipdb.dat"), "ip database path")
+      ("db6", value(&opt.ip6_db_path_), "ipv6 database path, text ranges")
+      ("db-check", value(&opt.db_check_)->default_value(0), "seconds between checks of the ip databases for changes, 0 reloads them on SIGHUP only")
       ("redis,r", value(&opt.redis_address_), "redis input(host:port)")
       ("redis-queue", value(&opt.redis_queue_), "redis job queue")
       ("tcp,t", bool_switch(&opt.tcp_input_), "tcp input")
+      ("workers,w", value(&opt.workers_)->default_value(0), "transform threads, 0 transforms in the event loop")
+      ("unordered", bool_switch(&opt.unordered_), "do not preserve the input order with workers")
+      ("queue-size", value(&opt.queue_size_)->default_value(16 * 1024 * 1024), "input queue size in bytes")
+      ("inflate-threads", value(&opt.inflate_threads_)->default_value(4), "gzip input inflate threads")
+      ("send-batch", value(&opt.send_batch_)->default_value(64 * 1024), "output bytes packed into one send")
+      ("send-delay", value(&opt.send_delay_)->default_value(5), "milliseconds output waits for a batch to fill")
+      ("agg-lateness", value(&opt.agg_lateness_)->default_value(60), "seconds an aggregation window stays open past its end for late lines")
+      ("agg-groups", value(&opt.agg_groups_)->default_value(64 * 1024), "aggregation groups held, the oldest window is emitted early when full")
+      ("agg-workers", value(&opt.agg_workers_)->default_value(0), "aggregation threads, 0 aggregates in the event loop; each holds agg-groups, a full one emits its oldest window early and splits the rows of its groups")
       ("listen-ip", value(&opt.frontend_ip_)->default_value("127.0.0.1"), "listen ip")
       ("listen-port", value(&opt.frontend_port_)->default_value(5565), "listen port")
       ("server-ip", value(&opt.backend_ip_)->default_value("127.0.0.1"), "server ip")
@@ -54,6 +87,16 @@ void ParseOption(int argc, char *argv[], Option &opt) {
     conflictingOptions(vm, "log", "redis");
     conflictingOptions(vm, "tcp", "redis");
     optionDependency(vm, "redis", "redis-queue");
+    optionRange(vm, "workers", 0, 256);
+    // two blocks at least, one filled while the other is consumed
+    optionRange(vm, "queue-size", 128 * 1024, 64LL << 30);
+    optionRange(vm, "inflate-threads", 1, 256);
+    optionRange(vm, "send-batch", 1, 64 << 20);
+    optionRange(vm, "send-delay", 0, 10000);
+    optionRange(vm, "db-check", 0, 86400);
+    optionRange(vm, "agg-lateness", 0, 86400);
+    optionRange(vm, "agg-groups", 1024, 64 << 20);
+    optionRange(vm, "agg-workers", 0, 256);
 
     if (!vm.count("redis") && !vm.count("config")) {
       std::cerr << "config required" << std::endl;
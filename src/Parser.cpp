@@ -4,29 +4,17 @@
 
 #include "spdlog/spdlog.h"
 #include "fluorine/log/Parser.hpp"
+#include "fluorine/log/Tokenizer.hpp"
 #include "fluorine/config/Parser.hpp"
 
-static auto logger = spdlog::stdout_color_st("Parser");
+static auto logger = spdlog::stdout_color_mt("Parser");
 
 namespace fluorine {
 namespace log {
-bool ParseLog(std::string &line, Log &log, unsigned int field_number,
-              unsigned int time_index) {
-  static unsigned int fn_cache = field_number;
-  static unsigned int ti_cache = time_index;
-  static std::unique_ptr<Grammar<iterator_type>> g(
-      new Grammar<iterator_type>(field_number, time_index));
-
-  if (field_number != fn_cache || time_index != ti_cache) {
-    fn_cache = field_number;
-    ti_cache = time_index;
-    g.reset(new Grammar<iterator_type>(field_number, time_index));
-  }
-
-  iterator_type begin = line.begin();
-  iterator_type end   = line.end();
-  bool ok             = qi::phrase_parse(begin, end, *g, qi::space, log);
-  if (!ok) {
+bool ParseLog(const char *begin, const char *end, Log &log,
+              unsigned int field_number, unsigned int time_index) {
+  Tokenizer tokenizer(field_number, time_index);
+  if (!tokenizer.Tokenize(begin, end, log)) {
     logger->warn("log parse failed, remaining unparsed: {}",
                  std::string(begin, end));
     return false;
@@ -35,6 +23,12 @@ bool ParseLog(std::string &line, Log &log, unsigned int field_number,
   return true;
 }
 
+bool ParseLog(std::string &line, Log &log, unsigned int field_number,
+              unsigned int time_index) {
+  return ParseLog(line.data(), line.data() + line.size(), log, field_number,
+                  time_index);
+}
+
 } // namespace log
 
 namespace config {
@@ -42,6 +36,33 @@ const std::string Attribute::IGNORE = "0";
 const std::string Attribute::STORE  = "1";
 const std::string Attribute::ADD    = "2";
 
+const std::string Aggregation::SUM      = "sum";
+const std::string Aggregation::MIN      = "min";
+const std::string Aggregation::MAX      = "max";
+const std::string Aggregation::AVG      = "avg";
+const std::string Aggregation::DISTINCT = "distinct";
+
+int Aggregation::Percentile(const std::string &function) {
+  // p1 to p99, without a leading zero
+  if (function.size() < 2 || function.size() > 3 || function[0] != 'p' ||
+      function[1] == '0') {
+    return 0;
+  }
+  int p = 0;
+  for (size_t i = 1; i < function.size(); ++i) {
+    if (function[i] < '0' || function[i] > '9') {
+      return 0;
+    }
+    p = p * 10 + function[i] - '0';
+  }
+  return p;
+}
+
+bool Aggregation::IsFunction(const std::string &function) {
+  return function == SUM || function == MIN || function == MAX ||
+         function == AVG || function == DISTINCT || Percentile(function);
+}
+
 static bool parseConfig(const std::string &content, Config &cfg) {
   static Grammar<iterator_type> g;
   Skipper<iterator_type> skip;
@@ -54,6 +75,16 @@ static bool parseConfig(const std::string &content, Config &cfg) {
     return false;
   }
 
+  if (cfg.aggregation_) {
+    for (auto &key : cfg.aggregation_->keys_) {
+      if (!Aggregation::IsFunction(key.function_)) {
+        logger->error("unknown aggregate function: {}({})", key.function_,
+                      key.name_);
+        return false;
+      }
+    }
+  }
+
   return true;
 }
 
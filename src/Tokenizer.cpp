@@ -0,0 +1,233 @@
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FLUORINE_X86 1
+#endif
+
+#include "fluorine/log/Tokenizer.hpp"
+
+namespace fluorine {
+namespace log {
+
+// Finds the first of the bytes a, b and c in [p, end), end if none.
+typedef const char *(*FindFn)(const char *p, const char *end, char a, char b,
+                              char c);
+
+static const char *findScalar(const char *p, const char *end, char a, char b,
+                              char c) {
+  for (; p < end; ++p) {
+    if (*p == a || *p == b || *p == c) {
+      break;
+    }
+  }
+  return p;
+}
+
+#if defined(FLUORINE_X86)
+__attribute__((target("sse2"))) static const char *
+findSSE2(const char *p, const char *end, char a, char b, char c) {
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  const __m128i vc = _mm_set1_epi8(c);
+
+  for (; p + 16 <= end; p += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+        _mm_cmpeq_epi8(v, vc));
+    int mask = _mm_movemask_epi8(m);
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  return findScalar(p, end, a, b, c);
+}
+
+__attribute__((target("avx2"))) static const char *
+findAVX2(const char *p, const char *end, char a, char b, char c) {
+  const __m256i va = _mm256_set1_epi8(a);
+  const __m256i vb = _mm256_set1_epi8(b);
+  const __m256i vc = _mm256_set1_epi8(c);
+
+  for (; p + 32 <= end; p += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i m = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)),
+        _mm256_cmpeq_epi8(v, vc));
+    unsigned int mask = static_cast<unsigned int>(_mm256_movemask_epi8(m));
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+
+  // no call into the SSE2 version with the upper halves dirty, legacy SSE
+  // code pays for the transition on every instruction
+  if (p + 16 <= end) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i m = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(va)),
+                     _mm_cmpeq_epi8(v, _mm256_castsi256_si128(vb))),
+        _mm_cmpeq_epi8(v, _mm256_castsi256_si128(vc)));
+    int mask = _mm_movemask_epi8(m);
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+    p += 16;
+  }
+
+  for (; p < end; ++p) {
+    if (*p == a || *p == b || *p == c) {
+      break;
+    }
+  }
+  return p;
+}
+#endif
+
+static FindFn resolveFind(const char **isa) {
+#if defined(FLUORINE_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    *isa = "avx2";
+    return findAVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    *isa = "sse2";
+    return findSSE2;
+  }
+#endif
+  *isa = "scalar";
+  return findScalar;
+}
+
+static const char *isa;
+static const FindFn find = resolveFind(&isa);
+
+const char *Tokenizer::Isa() { return isa; }
+
+// the blanks skipped between fields, std::isspace in the C locale
+static inline bool isSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// the end of an unquoted field
+static inline const char *fieldEnd(const char *p, const char *end) {
+  return find(p, end, ' ', '\t', '\n');
+}
+
+bool Tokenizer::field(const char *&p, const char *end, Log &log) const {
+  while (p < end && isSpace(*p)) {
+    ++p;
+  }
+  if (p == end) {
+    return false;
+  }
+
+  if (*p == '"') {
+    const char *q = p + 1;
+    for (;;) {
+      q = find(q, end, '"', '\\', '"');
+      if (q == end) {
+        break;
+      }
+
+      if (*q == '\\') {
+        q += q + 1 < end && q[1] == '"' ? 2 : 1;
+      } else if (q + 1 < end && q[1] != ' ' && q[1] != '\t' && q[1] != '\n') {
+        q += 2;
+      } else {
+        break;
+      }
+    }
+
+    if (q < end) {
+      log.push_back(Field(p + 1, q - p - 1));
+      p = q + 1;
+      return true;
+    }
+
+    // unterminated, the grammar keeps what the quote matched and appends
+    // the field parsed again without quotes
+    const char *e = fieldEnd(p, end);
+    std::string leaked(p + 1, end);
+    leaked.append(p, e);
+    log.push_back(std::move(leaked));
+    p = e;
+    return true;
+  }
+
+  const char *e = fieldEnd(p, end);
+  log.push_back(Field(p, e - p));
+  p = e;
+  return true;
+}
+
+bool Tokenizer::time(const char *&p, const char *end, Log &log) const {
+  while (p < end && isSpace(*p)) {
+    ++p;
+  }
+  if (p == end || *p != '[') {
+    return field(p, end, log);
+  }
+
+  const char *q = find(p + 1, end, '[', ']', ']');
+  if (q < end && *q == ']' && q > p + 1) {
+    log.push_back(Field(p + 1, q - p - 1));
+    p = q + 1;
+    return true;
+  }
+
+  // same as for quotes, the timestamp matched so far is kept
+  const char *e = fieldEnd(p, end);
+  std::string leaked(p + 1, q);
+  leaked.append(p, e);
+  log.push_back(std::move(leaked));
+  p = e;
+  return true;
+}
+
+bool Tokenizer::Tokenize(const char *begin, const char *end, Log &log) const {
+  const char *p = begin;
+
+  if (time_index_) {
+    for (unsigned int i = 1; i < time_index_; ++i) {
+      if (!field(p, end, log)) {
+        return false;
+      }
+    }
+
+    if (!time(p, end, log)) {
+      return false;
+    }
+
+    if (field_number_ < time_index_) {
+      while (field(p, end, log)) {
+      }
+    } else {
+      for (unsigned int i = time_index_; i < field_number_; ++i) {
+        if (!field(p, end, log)) {
+          return false;
+        }
+      }
+    }
+  } else if (field_number_) {
+    for (unsigned int i = 0; i < field_number_; ++i) {
+      if (!field(p, end, log)) {
+        return false;
+      }
+    }
+  } else {
+    if (!field(p, end, log)) {
+      return false;
+    }
+    while (field(p, end, log)) {
+    }
+  }
+
+  return true;
+}
+
+} // namespace log
+} // namespace fluorine
@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "fluorine/util/EventFd.hpp"
+
+namespace fluorine {
+namespace util {
+
+EventFd::EventFd()
+    : fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), pending_(false) {
+  ASSERT(fd_ >= 0);
+}
+
+EventFd::~EventFd() { close(fd_); }
+
+void EventFd::Notify() {
+  if (pending_.exchange(true)) {
+    return;
+  }
+
+  uint64_t one = 1;
+  ssize_t n    = write(fd_, &one, sizeof(one));
+  (void)n;
+}
+
+void EventFd::Drain() {
+  uint64_t count;
+  ssize_t n = read(fd_, &count, sizeof(count));
+  (void)n;
+  // cleared after the read, a notification in between is then either seen
+  // here, with what it announced, or writes the fd again
+  pending_.exchange(false);
+}
+
+} // namespace util
+} // namespace fluorine
@@ -1,27 +1,184 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
 #include "fluorine/util/Fast.hpp"
 
-// https://github.com/mnp/libfast-mktime/blob/master/fast-mktime.c
+// https://github.com/mnp/libfast-mktime/blob/master/fast-mktime.c, caching
+// the hour rather than the day as daylight saving starts and ends within one
 time_t cached_mktime(struct tm *tm) {
-  static struct tm cache   = {};
-  static time_t time_cache = 0;
+  thread_local struct tm cache   = {};
+  thread_local time_t time_cache = -1;
   time_t result;
   time_t carry;
 
   /* the epoch time portion of the request */
-  carry = 3600 * tm->tm_hour + 60 * tm->tm_min + tm->tm_sec;
+  carry = 60 * tm->tm_min + tm->tm_sec;
 
-  if (cache.tm_mday == tm->tm_mday && cache.tm_mon == tm->tm_mon &&
+  if (time_cache != -1 && cache.tm_hour == tm->tm_hour &&
+      cache.tm_mday == tm->tm_mday && cache.tm_mon == tm->tm_mon &&
       cache.tm_year == tm->tm_year) {
     result = time_cache + carry;
   } else {
-    cache.tm_mday  = tm->tm_mday;
-    cache.tm_mon   = tm->tm_mon;
-    cache.tm_year  = tm->tm_year;
-    time_cache     = mktime(&cache);
-    cache.tm_isdst = 0;
+    struct tm hour = {};
+    hour.tm_hour   = tm->tm_hour;
+    hour.tm_mday   = tm->tm_mday;
+    hour.tm_mon    = tm->tm_mon;
+    hour.tm_year   = tm->tm_year;
+    hour.tm_isdst  = -1; // whichever is in effect then
+    cache          = hour;
+    time_cache     = mktime(&hour);
 
     result = (-1 == time_cache) ? -1 : time_cache + carry;
   }
 
   return result;
 }
+
+// http://howardhinnant.github.io/date_algorithms.html#days_from_civil
+int64_t days_from_civil(int64_t year, unsigned mon, unsigned day) {
+  year -= mon <= 2;
+  const int64_t era  = (year >= 0 ? year : year - 399) / 400;
+  const unsigned yoe = static_cast<unsigned>(year - era * 400);
+  const unsigned doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + day - 1;
+  const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+int64_t civil_seconds(const struct tm &tm) {
+  int64_t year = tm.tm_year + 1900 + tm.tm_mon / 12;
+  int mon      = tm.tm_mon % 12;
+  if (mon < 0) {
+    mon += 12;
+    --year;
+  }
+
+  int64_t days = days_from_civil(year, mon + 1, 1) + tm.tm_mday - 1;
+  return days * 86400 + tm.tm_hour * 3600 + tm.tm_min * 60 + tm.tm_sec;
+}
+
+// the n digits at p, false for anything else
+static inline bool digits(const char *p, int n, int &v) {
+  v = 0;
+  for (int i = 0; i < n; ++i) {
+    unsigned d = static_cast<unsigned char>(p[i]) - '0';
+    if (d > 9) {
+      return false;
+    }
+    v = v * 10 + d;
+  }
+  return true;
+}
+
+// the month from 0 of its English abbreviation
+static inline int month(const char *p) {
+  static const char names[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  for (int i = 0; i < 12; ++i) {
+    if (p[0] == names[i * 3] && p[1] == names[i * 3 + 1] &&
+        p[2] == names[i * 3 + 2]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool parse_time_local(boost::string_ref s, struct tm &tm, int &offset) {
+  // 29/Nov/2016:03:49:00 +0800
+  const char *p = s.data();
+  int tz_hour, tz_min;
+  if (s.size() < 26 || p[2] != '/' || p[6] != '/' || p[11] != ':' ||
+      p[14] != ':' || p[17] != ':' || p[20] != ' ' ||
+      (p[21] != '+' && p[21] != '-') || !digits(p, 2, tm.tm_mday) ||
+      (tm.tm_mon = month(p + 3)) < 0 || !digits(p + 7, 4, tm.tm_year) ||
+      !digits(p + 12, 2, tm.tm_hour) || !digits(p + 15, 2, tm.tm_min) ||
+      !digits(p + 18, 2, tm.tm_sec) || !digits(p + 22, 2, tz_hour) ||
+      !digits(p + 24, 2, tz_min)) {
+    return false;
+  }
+
+  tm.tm_year -= 1900;
+  offset = (tz_hour * 3600 + tz_min * 60) * (p[21] == '-' ? -1 : 1);
+  return true;
+}
+
+bool parse_time_date(boost::string_ref s, struct tm &tm) {
+  // 2016-11-29 03:49:00
+  const char *p = s.data();
+  if (s.size() < 19 || p[4] != '-' || p[7] != '-' || p[10] != ' ' ||
+      p[13] != ':' || p[16] != ':' || !digits(p, 4, tm.tm_year) ||
+      !digits(p + 5, 2, tm.tm_mon) || !digits(p + 8, 2, tm.tm_mday) ||
+      !digits(p + 11, 2, tm.tm_hour) || !digits(p + 14, 2, tm.tm_min) ||
+      !digits(p + 17, 2, tm.tm_sec)) {
+    return false;
+  }
+
+  tm.tm_year -= 1900;
+  tm.tm_mon -= 1;
+  return true;
+}
+
+bool fast_stoll(boost::string_ref s, int64_t &num) {
+  const char *p = s.begin(), *end = s.end();
+  while (p < end && (*p == ' ' || (*p >= '\t' && *p <= '\r'))) {
+    ++p;
+  }
+
+  bool negative = false;
+  if (p < end && (*p == '+' || *p == '-')) {
+    negative = *p++ == '-';
+  }
+
+  const uint64_t limit = negative ? uint64_t(INT64_MAX) + 1 : INT64_MAX;
+  const char *digits   = p;
+  uint64_t n           = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+    unsigned d = *p - '0';
+    if (n > (limit - d) / 10) {
+      return false;
+    }
+    n = n * 10 + d;
+  }
+
+  if (p == digits) {
+    return false;
+  }
+
+  num = negative ? static_cast<int64_t>(0 - n) : static_cast<int64_t>(n);
+  return true;
+}
+
+bool fast_stoi(boost::string_ref s, int &num) {
+  int64_t n;
+  if (!fast_stoll(s, n) || n < INT_MIN || n > INT_MAX) {
+    return false;
+  }
+
+  num = static_cast<int>(n);
+  return true;
+}
+
+bool fast_stod(boost::string_ref s, double &num) {
+  // strtod needs a terminated string, numbers fit the stack buffer
+  char buf[64];
+  std::string copy;
+  const char *str = buf;
+  if (s.size() < sizeof(buf)) {
+    memcpy(buf, s.data(), s.size());
+    buf[s.size()] = '\0';
+  } else {
+    copy = s.to_string();
+    str  = copy.c_str();
+  }
+
+  char *end;
+  errno    = 0;
+  double n = strtod(str, &end);
+  if (end == str || errno == ERANGE) {
+    return false;
+  }
+
+  num = n;
+  return true;
+}
@@ -0,0 +1,366 @@
+#include <string.h>
+#include <zlib.h>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <algorithm>
+#include <condition_variable>
+
+#include "spdlog/spdlog.h"
+#include "fluorine/util/Gzip.hpp"
+#include "fluorine/util/LineReader.hpp"
+
+static auto logger = spdlog::stdout_color_mt("Gzip");
+
+namespace fluorine {
+namespace util {
+
+const size_t GzipReader::kBufferSize;
+const size_t GzipReader::kChunkSize;
+
+enum class InflateStatus { Ok, Garbage, Overrun, Error };
+
+// Called with a full output buffer, replaces it with an empty one.
+using Flush = std::function<void(std::string &buf)>;
+
+// Inflates the members starting at offset one after another, until limit is
+// reached or passed. The output goes into buf[used, buf.size()), which is
+// flushed when full, or grown without a flush callback. Data without the
+// gzip magic after at least one complete member is reported as Garbage, and
+// ignored like gzread does; a member still open past limit is reported as
+// Overrun.
+static InflateStatus inflateMembers(const unsigned char *data, size_t size,
+                                    size_t offset, size_t limit,
+                                    std::string &buf, size_t &used,
+                                    const Flush &flush, size_t *stop) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+    return InflateStatus::Error;
+  }
+
+  InflateStatus status = InflateStatus::Ok;
+  size_t pos           = offset;
+  size_t start         = offset;
+  size_t members       = 0;
+  bool in_member       = false;
+
+  while (pos < limit) {
+    if (used == buf.size()) {
+      if (flush) {
+        flush(buf);
+        used = 0;
+      } else {
+        buf.resize(std::max<size_t>(buf.size() * 2, 65536));
+      }
+    }
+
+    size_t in_size  = std::min<size_t>(size - pos, 1u << 30);
+    size_t out_size = std::min<size_t>(buf.size() - used, 1u << 30);
+    zs.next_in      = const_cast<Bytef *>(data + pos);
+    zs.avail_in     = static_cast<uInt>(in_size);
+    zs.next_out     = reinterpret_cast<Bytef *>(&buf[used]);
+    zs.avail_out    = static_cast<uInt>(out_size);
+
+    int rc = inflate(&zs, Z_NO_FLUSH);
+    pos += in_size - zs.avail_in;
+    used += out_size - zs.avail_out;
+    in_member = true;
+
+    if (rc == Z_STREAM_END) {
+      ++members;
+      in_member = false;
+      start     = pos;
+      inflateReset(&zs);
+    } else if (rc == Z_OK || (rc == Z_BUF_ERROR && zs.avail_out == 0)) {
+      continue;
+    } else {
+      bool magic = size - start >= 2 && data[start] == 0x1f &&
+                   data[start + 1] == 0x8b;
+      status = members > 0 && !magic ? InflateStatus::Garbage
+                                     : InflateStatus::Error;
+      in_member = false;
+      break;
+    }
+  }
+
+  if (in_member) {
+    status = pos >= size ? InflateStatus::Error : InflateStatus::Overrun;
+  }
+
+  inflateEnd(&zs);
+  *stop = pos;
+  return status;
+}
+
+// the magic and the deflate method, what gzread takes for a gzip file
+static bool isGzip(const unsigned char *p, size_t size) {
+  return size >= 3 && p[0] == 0x1f && p[1] == 0x8b && p[2] == 8;
+}
+
+// a likely header inside a gzip file, strict on the flags, XFL and OS bytes
+// so few splits fall inside the deflate data
+static bool isMemberHeader(const unsigned char *p, size_t size) {
+  return size >= 18 && isGzip(p, size) && (p[3] & 0xe0) == 0 &&
+         (p[8] == 0 || p[8] == 2 || p[8] == 4) && (p[9] <= 13 || p[9] == 255);
+}
+
+// the block size of a BGZF member, 0 when it is not one
+static size_t bgzfBlockSize(const unsigned char *p, size_t size) {
+  if (!(p[3] & 0x04) || size < 12) {
+    return 0;
+  }
+
+  size_t xlen = p[10] | (p[11] << 8);
+  const unsigned char *x = p + 12, *end = p + 12 + xlen;
+  if (12 + xlen > size) {
+    return 0;
+  }
+
+  while (x + 4 <= end) {
+    size_t slen = x[2] | (x[3] << 8);
+    if (x[0] == 'B' && x[1] == 'C' && slen == 2 && x + 6 <= end) {
+      return (x[4] | (x[5] << 8)) + 1;
+    }
+    x += 4 + slen;
+  }
+
+  return 0;
+}
+
+std::vector<size_t> FindGzipMembers(const unsigned char *data, size_t size) {
+  std::vector<size_t> members;
+  if (!isGzip(data, size)) {
+    return members;
+  }
+
+  if (isMemberHeader(data, size) && bgzfBlockSize(data, size)) {
+    size_t pos = 0, block;
+    while (pos < size && isMemberHeader(data + pos, size - pos) &&
+           (block = bgzfBlockSize(data + pos, size - pos))) {
+      members.push_back(pos);
+      pos += block;
+    }
+    if (pos == size) {
+      return members;
+    }
+    members.clear();
+  }
+
+  // the first member starts the file whatever its header bytes
+  members.push_back(0);
+  const unsigned char *p = data + 1, *end = data + size;
+  while ((p = static_cast<const unsigned char *>(
+              memchr(p, 0x1f, end - p))) != nullptr) {
+    if (isMemberHeader(p, end - p)) {
+      members.push_back(p - data);
+    }
+    ++p;
+  }
+
+  return members;
+}
+
+bool GzipReader::Read(const std::string &path, const Sink &sink) {
+  MappedFile file;
+  if (!file.Open(path)) {
+    logger->error("cannot open: {}", path);
+    return false;
+  }
+
+  auto data   = reinterpret_cast<const unsigned char *>(file.Data());
+  size_t size = file.Size();
+  if (size == 0) {
+    return true;
+  }
+
+  auto members = FindGzipMembers(data, size);
+  if (members.empty()) {
+    // not compressed, gzread passes such files through
+    sink(file.Data(), size);
+    return true;
+  }
+
+  // group the members into chunks of about kChunkSize compressed bytes
+  std::vector<size_t> splits;
+  for (auto offset : members) {
+    if (splits.empty() || offset - splits.back() >= kChunkSize) {
+      splits.push_back(offset);
+    }
+  }
+
+  if (threads_ > 1 && splits.size() > 1) {
+    return ReadParallel(data, size, splits, sink);
+  }
+
+  return ReadAhead(data, size, 0, sink);
+}
+
+bool GzipReader::ReadParallel(const unsigned char *data, size_t size,
+                              const std::vector<size_t> &splits,
+                              const Sink &sink) {
+  struct Chunk {
+    size_t begin;
+    size_t end;
+    std::string out;
+    bool ok    = false;
+    bool ready = false;
+  };
+
+  std::vector<Chunk> chunks(splits.size());
+  for (size_t i = 0; i < splits.size(); ++i) {
+    chunks[i].begin = splits[i];
+    chunks[i].end   = i + 1 < splits.size() ? splits[i + 1] : size;
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t next = 0, consumed = 0;
+  bool stop           = false;
+  const size_t window = threads_ * 2;
+
+  auto run = [&]() {
+    for (;;) {
+      size_t k;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() {
+          return stop || next == chunks.size() || next < consumed + window;
+        });
+        if (stop || next == chunks.size()) {
+          return;
+        }
+        k = next++;
+      }
+
+      Chunk &chunk = chunks[k];
+      std::string out;
+      size_t used = 0, end;
+      out.resize((chunk.end - chunk.begin) * 4);
+      auto status = inflateMembers(data, size, chunk.begin, chunk.end, out,
+                                   used, nullptr, &end);
+      out.resize(used);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      chunk.out.swap(out);
+      chunk.ok    = status == InflateStatus::Ok && end == chunk.end;
+      chunk.ready = true;
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < std::min(threads_, chunks.size()); ++i) {
+    threads.emplace_back(run);
+  }
+
+  size_t fallback = size;
+  for (size_t k = 0; k < chunks.size(); ++k) {
+    std::string out;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return chunks[k].ready; });
+      if (!chunks[k].ok) {
+        // chunk k starts where chunk k - 1 ended, a real member boundary
+        fallback = chunks[k].begin;
+        stop     = true;
+        cv.notify_all();
+        break;
+      }
+      out.swap(chunks[k].out);
+    }
+
+    sink(out.data(), out.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    consumed = k + 1;
+    cv.notify_all();
+  }
+
+  for (auto &t : threads) {
+    t.join();
+  }
+
+  if (fallback < size) {
+    logger->info("not a member boundary, inflate sequentially from {}",
+                 fallback);
+    return ReadAhead(data, size, fallback, sink);
+  }
+
+  return true;
+}
+
+bool GzipReader::ReadAhead(const unsigned char *data, size_t size,
+                           size_t offset, const Sink &sink) {
+  const size_t kBuffers = 4;
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::string> full, empty;
+  bool finished        = false;
+  InflateStatus status = InflateStatus::Ok;
+
+  for (size_t i = 0; i < kBuffers; ++i) {
+    empty.emplace_back(kBufferSize, '\0');
+  }
+
+  std::thread inflater([&]() {
+    std::string buf;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      buf.swap(empty.front());
+      empty.pop_front();
+    }
+
+    auto flush = [&](std::string &b) {
+      std::unique_lock<std::mutex> lock(mutex);
+      full.push_back(std::move(b));
+      cv.notify_all();
+      cv.wait(lock, [&]() { return !empty.empty(); });
+      b.swap(empty.front());
+      empty.pop_front();
+      b.resize(kBufferSize);
+    };
+
+    size_t used = 0, stop;
+    auto st = inflateMembers(data, size, offset, size, buf, used, flush, &stop);
+    buf.resize(used);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    full.push_back(std::move(buf));
+    status   = st;
+    finished = true;
+    cv.notify_all();
+  });
+
+  for (;;) {
+    std::string buf;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return finished || !full.empty(); });
+      if (full.empty()) {
+        break;
+      }
+      buf.swap(full.front());
+      full.pop_front();
+    }
+
+    sink(buf.data(), buf.size());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    empty.push_back(std::move(buf));
+    cv.notify_all();
+  }
+
+  inflater.join();
+
+  if (status == InflateStatus::Error) {
+    logger->error("corrupt gzip data");
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace util
+} // namespace fluorine
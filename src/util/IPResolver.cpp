@@ -1,26 +1,47 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <memory>
 #include <iostream>
+#include <algorithm>
+#include <unordered_map>
 
-#include <boost/spirit/include/qi.hpp>
+#include <boost/functional/hash.hpp>
 
 #include "spdlog/spdlog.h"
 #include "fluorine/Macros.hpp"
 #include "fluorine/util/IPResolver.hpp"
 
-static auto logger = spdlog::stdout_color_st("IP Resolver");
+static auto logger = spdlog::stdout_color_mt("IP Resolver");
 
 namespace fluorine {
 namespace util {
 static std::unique_ptr<IPResolver> resolver(nullptr);
 
-void InitIPResolver(const std::string &db_path) {
+void InitIPResolver(const std::string &db_path, const std::string &db6_path,
+                    int reload_interval) {
   if (!resolver) {
     resolver.reset(new IPResolver(db_path.c_str()));
+    if (!db6_path.empty() && !resolver->LoadIPv6(db6_path.c_str())) {
+      exit(1);
+    }
+    resolver->Watch(reload_interval);
   }
 }
 
-bool ResolveIP(const std::string &ip, IPResolver::ResultType **result) {
-  return resolver->Resolve(ip, result);
+bool ResolveIP(const char *ip, size_t size, IPResolver::LRUValueType &result) {
+  return resolver->Resolve(ip, size, result);
+}
+
+void ResolveIPs(const boost::string_ref *ips, size_t n,
+                IPResolver::LRUValueType *results) {
+  resolver->Resolve(ips, n, results);
 }
 
 #define B2IL(b)                                                               \
@@ -31,134 +52,1111 @@ bool ResolveIP(const std::string &ip, IPResolver::ResultType **result) {
   (((b)[3] & 0xFF) | (((b)[2] << 8) & 0xFF00) | (((b)[1] << 16) & 0xFF0000) | \
    (((b)[0] << 24) & 0xFF000000))
 
-IPResolver::ResultType IPResolver::UnknownResult =
-    IPResolver::ResultType(IPResolver::FieldNumber, "unknown");
+const int IPResolver::FieldNumber;
 
-IPResolver::IPResolver(const char *db_path) {
-  FILE *fd = fopen(db_path, "rb");
-  if (fd == nullptr) {
-    perror(db_path);
-    exit(1);
+// a record with the same text in every field
+static IPResolver::ResultType sameFields(const char *text) {
+  IPResolver::ResultType fields;
+  fields.fill(text);
+  return fields;
+}
+
+static const IPResolver::ResultType unknown = sameFields("unknown");
+IPResolver::LRUValueType IPResolver::UnknownResult = &unknown;
+
+static std::atomic<bool> reload_requested(false);
+
+// The indexes a thread is searching, in hazard slots on cache lines of its
+// own: a reader stores the index it loaded in its slot and checks it is
+// still the published one, and a swap frees the index it replaced once no
+// slot holds it. A lookup writes its own slot only, no lock or count shared
+// with the other threads.
+struct Hazard {
+  std::atomic<const void *> index_[2]; // an IPv4 and an IPv6 index
+  std::atomic<bool> taken_;
+  Hazard *next_;
+  char pad_[64];
+};
+
+// the slots of all threads, a thread's taken on its first lookup and given
+// back when it exits, never freed
+static std::atomic<Hazard *> hazards(nullptr);
+
+static Hazard &threadHazard() {
+  struct Owner {
+    Owner() {
+      for (hazard_ = hazards.load(std::memory_order_acquire); hazard_;
+           hazard_ = hazard_->next_) {
+        bool taken = false;
+        if (hazard_->taken_.compare_exchange_strong(taken, true)) {
+          return;
+        }
+      }
+      hazard_ = new Hazard();
+      hazard_->index_[0] = nullptr;
+      hazard_->index_[1] = nullptr;
+      hazard_->taken_    = true;
+      hazard_->next_     = hazards.load(std::memory_order_relaxed);
+      while (!hazards.compare_exchange_weak(hazard_->next_, hazard_)) {
+      }
+    }
+    ~Owner() { hazard_->taken_.store(false, std::memory_order_release); }
+
+    Hazard *hazard_;
+  };
+  static thread_local Owner owner;
+  return *owner.hazard_;
+}
+
+// the index published at source, pinned in the slot of the thread while
+// the guard lives
+template <typename Index>
+class Pinned {
+public:
+  Pinned(const std::atomic<const Index *> &source, int slot)
+      : hazard_(threadHazard().index_[slot]) {
+    const Index *index = source.load(std::memory_order_relaxed);
+    do {
+      index_ = index;
+      hazard_.store(index_);
+      index = source.load();
+    } while (index != index_);
+  }
+  ~Pinned() { hazard_.store(nullptr, std::memory_order_release); }
+
+  const Index *operator->() const { return index_; }
+  explicit operator bool() const { return index_ != nullptr; }
+
+private:
+  DISALLOW_COPY_AND_ASSIGN(Pinned);
+
+  std::atomic<const void *> &hazard_;
+  const Index *index_;
+};
+
+// frees an index swapped out, once the readers holding it are done
+template <typename Index>
+static void retire(const Index *index) {
+  if (index == nullptr) {
+    return;
+  }
+  for (;;) {
+    bool held = false;
+    for (Hazard *h = hazards.load(std::memory_order_acquire); h && !held;
+         h = h->next_) {
+      held = h->index_[0].load() == index || h->index_[1].load() == index;
+    }
+    if (!held) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  delete index;
+}
+
+// The sections of an index image, 8 byte aligned at the offsets its header
+// records, the record texts last. Images are written and mapped by the
+// processes of one host, the integers are native.
+enum Section { kEnds, kJump, kDense, kSub, kRanges, kRecords, kText, kSections };
+
+struct ImageHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t reserved_;
+  // the size, modification time and inode of the database it was built from
+  uint64_t source_[3];
+  uint64_t size_;
+  uint64_t offset_[kSections];
+  uint64_t count_[kSections];
+};
+
+// a new layout is a new version, and a new file name
+static const uint32_t kImageVersion = 1;
+static const char kImageSuffix[]    = ".idx1";
+static const char kMagicIPv4[8]     = "fl-ipv4";
+static const char kMagicIPv6[8]     = "fl-ipv6";
+// the bytes of an element of each section, the records an offset and a
+// length in the texts
+static const size_t kWidthsIPv4[kSections] = {4, 4, 0, 0, 4, 8, 1};
+static const size_t kWidthsIPv6[kSections] = {16, 4, 4, 4, 4, 8, 1};
+
+// lays out an image, its sections appended in order
+class ImageWriter {
+public:
+  explicit ImageWriter(const char *magic) : image_(sizeof(ImageHeader), 0) {
+    memcpy(header_.magic_, magic, sizeof(header_.magic_));
+    header_.version_ = kImageVersion;
+  }
+
+  template <typename T>
+  void Add(Section section, const std::vector<T> &v) {
+    Add(section, v.data(), v.size(), sizeof(T));
+  }
+  void Add(Section section, const void *data, size_t count, size_t width) {
+    image_.resize((image_.size() + 7) & ~static_cast<size_t>(7));
+    header_.offset_[section] = image_.size();
+    header_.count_[section]  = count;
+    image_.append(static_cast<const char *>(data), count * width);
   }
 
-  fseek(fd, 0, SEEK_END);
-  size_t size = ftell(fd);
-  ASSERT(size > 0);
-  fseek(fd, 0, SEEK_SET);
+  std::string Finish() {
+    header_.size_ = image_.size();
+    memcpy(&image_[0], &header_, sizeof(header_));
+    return std::move(image_);
+  }
+
+private:
+  ImageHeader header_ = ImageHeader();
+  std::string image_;
+};
+
+// the header of an image of the kind magic with its sections within it,
+// null for anything else. source, when given, is the stamp of the database
+// it has to come from.
+static const ImageHeader *imageHeader(const char *data, size_t size,
+                                      const char *magic,
+                                      const size_t *widths,
+                                      const uint64_t *source) {
+  const ImageHeader *h = reinterpret_cast<const ImageHeader *>(data);
+  if (size < sizeof(ImageHeader) ||
+      memcmp(h->magic_, magic, sizeof(h->magic_)) != 0 ||
+      h->version_ != kImageVersion || h->size_ != size ||
+      (source && memcmp(h->source_, source, sizeof(h->source_)) != 0)) {
+    return nullptr;
+  }
+  for (int s = 0; s < kSections; ++s) {
+    uint64_t offset = h->offset_[s], count = h->count_[s];
+    if (offset % 8 != 0 || offset > size ||
+        (widths[s] == 0 ? count != 0
+                        : count > (size - offset) / widths[s])) {
+      return nullptr;
+    }
+  }
+  return h;
+}
 
-  data_        = (byte *)malloc(size);
-  size_t count = fread(data_, 1, size, fd);
-  fclose(fd);
+template <typename T>
+static const T *section(const char *data, const ImageHeader *h, Section s) {
+  return reinterpret_cast<const T *>(data + h->offset_[s]);
+}
 
-  ASSERT(count > 512 * sizeof(uint));
+// whether the n values at v are all below bound
+static bool below(const uint32_t *v, size_t n, uint64_t bound) {
+  for (size_t i = 0; i < n; ++i) {
+    if (v[i] >= bound) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  Init();
+// whether the records of an image all lie in its texts
+static bool recordsWithin(const char *data, const ImageHeader *h) {
+  const uint32_t *r = section<uint32_t>(data, h, kRecords);
+  for (size_t i = 0; i < h->count_[kRecords]; ++i) {
+    if (r[2 * i] != UINT32_MAX &&
+        static_cast<uint64_t>(r[2 * i]) + r[2 * i + 1] > h->count_[kText]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+IPResolver::Image::~Image() {
+  // the pages before the record texts
+  const ImageHeader *h = reinterpret_cast<const ImageHeader *>(data_);
+  size_t page          = sysconf(_SC_PAGESIZE);
+  size_t head          = h->offset_[kText] / page * page;
+  if (head > 0) {
+    munmap(const_cast<char *>(data_), head);
+  }
+}
+
+// maps the file at path read-only, quietly, a missing image is built
+static bool mapFile(const std::string &path, const char *&data,
+                    size_t &size) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  void *p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (p == MAP_FAILED) {
+    return false;
+  }
+  data = static_cast<const char *>(p);
+  size = st.st_size;
+  return true;
+}
+
+// writes image as path at once, a reader maps the old file or the new one
+static bool writeFile(const std::string &path, const std::string &image) {
+  std::string tmp = path + "." + std::to_string(getpid()) + ".tmp";
+  int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  size_t done = 0;
+  while (done < image.size()) {
+    ssize_t n = write(fd, image.data() + done, image.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    done += n;
+  }
+  bool ok = done == image.size();
+  ok      = close(fd) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    int error = errno;
+    unlink(tmp.c_str());
+    errno = error;
+    return false;
+  }
+  return true;
+}
+
+// an index over a private read-only copy of image
+template <typename Index>
+static Index *openCopy(const std::string &image,
+                       Index *(*openImage)(const char *, size_t,
+                                           const uint64_t *)) {
+  if (image.empty()) {
+    return nullptr;
+  }
+  void *p = mmap(nullptr, image.size(), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    logger->error("mmap {} bytes: {}", image.size(), strerror(errno));
+    return nullptr;
+  }
+  memcpy(p, image.data(), image.size());
+  mprotect(p, image.size(), PROT_READ);
+
+  Index *index = openImage(static_cast<const char *>(p), image.size(), nullptr);
+  if (index == nullptr) {
+    munmap(p, image.size());
+  }
+  return index;
+}
+
+// The index of the database at path, mapped from the image file next to it
+// when that was built from this version of the database. Otherwise the
+// image is built and written there, under a lock on the database: one
+// process of the host builds it, the others wait and map it. An image that
+// cannot be written is mapped privately.
+template <typename Index>
+static Index *loadIndex(const std::string &path,
+                        std::string (*build)(const char *, size_t),
+                        Index *(*openImage)(const char *, size_t,
+                                            const uint64_t *)) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    logger->error("open {}: {}", path, strerror(errno));
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    logger->error("{}: empty or not readable", path);
+    close(fd);
+    return nullptr;
+  }
+  uint64_t source[3] = {
+      static_cast<uint64_t>(st.st_size),
+      static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000 +
+          st.st_mtim.tv_nsec,
+      static_cast<uint64_t>(st.st_ino)};
+  std::string image_path = path + kImageSuffix;
+
+  auto mapped = [&]() -> Index * {
+    const char *data;
+    size_t size;
+    if (!mapFile(image_path, data, size)) {
+      return nullptr;
+    }
+    Index *index = openImage(data, size, source);
+    if (index == nullptr) {
+      munmap(const_cast<char *>(data), size);
+    }
+    return index;
+  };
+
+  // tried again once the process building it is done
+  Index *index = mapped();
+  if (index == nullptr) {
+    flock(fd, LOCK_EX);
+    index = mapped();
+  }
+  if (index == nullptr) {
+    std::string image;
+    void *db = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (db == MAP_FAILED) {
+      logger->error("mmap {}: {}", path, strerror(errno));
+    } else {
+      image = build(static_cast<const char *>(db), st.st_size);
+      munmap(db, st.st_size);
+    }
+
+    if (!image.empty()) {
+      memcpy(reinterpret_cast<ImageHeader *>(&image[0])->source_, source,
+             sizeof(source));
+      if (writeFile(image_path, image)) {
+        index = mapped();
+      } else {
+        logger->warn("write {}: {}, the index stays private", image_path,
+                     strerror(errno));
+      }
+      if (index == nullptr) {
+        index = openCopy(image, openImage);
+      }
+    }
+  }
+  // unlocks
+  close(fd);
+  return index;
+}
+
+IPResolver::IPResolver(const char *db_path) : db_path_(db_path) {
+  IPv4Index *index = loadIndex(db_path_, &BuildIPv4, &OpenIPv4);
+  if (index == nullptr) {
+    exit(1);
+  }
+  Swap(index, nullptr);
 }
 
 IPResolver::IPResolver(const char *db_data, const size_t db_size) {
-  data_ = (byte *)malloc(db_size);
-  memcpy(data_, db_data, db_size);
-  Init();
+  IPv4Index *index = openCopy(BuildIPv4(db_data, db_size), &OpenIPv4);
+  ASSERT(index != nullptr);
+  Swap(index, nullptr);
 }
 
 IPResolver::~IPResolver() {
-  if (offset_) {
-    offset_ = 0;
-    free(data_);
+  {
+    std::lock_guard<std::mutex> lock(reload_mutex_);
+    stop_ = true;
   }
+  stop_cond_.notify_all();
+  if (watcher_.joinable()) {
+    watcher_.join();
+  }
+  delete v4_.load();
+  delete v6_.load();
 }
 
-template <typename Iterator = std::string::const_iterator>
-struct IPGrammar
-    : boost::spirit::qi::grammar<Iterator, std::vector<uint8_t>()> {
-  IPGrammar() : IPGrammar::base_type(ip) {
-    using namespace boost::spirit::qi;
+bool IPResolver::ParseIPv4(const char *s, const char *end, uint32_t &ip) {
+  uint32_t addr = 0;
+  for (int i = 0; i < 4; ++i) {
+    if (i > 0 && (s == end || *s++ != '.')) {
+      return false;
+    }
+    if (s == end || static_cast<unsigned>(*s - '0') > 9) {
+      return false;
+    }
 
-    uint_parser<uint8_t, 10, 1, 3> uint8_p;
-    ip = uint8_p >> '.' >> uint8_p >> '.' >> uint8_p >> '.' >> uint8_p;
+    // only a third digit can overflow an octet
+    uint32_t octet = *s++ - '0';
+    if (s != end && static_cast<unsigned>(*s - '0') <= 9) {
+      octet = octet * 10 + (*s++ - '0');
+      if (s != end && static_cast<unsigned>(*s - '0') <= 9) {
+        octet = octet * 10 + (*s++ - '0');
+        if (octet > 255) {
+          return false;
+        }
+      }
+    }
+    addr = addr << 8 | octet;
   }
 
-private:
-  boost::spirit::qi::rule<Iterator, std::vector<uint8_t>()> ip;
-};
+  ip = addr;
+  return true;
+}
 
-bool IPResolver::Resolve(const std::string &ip, ResultType **result) {
-  static char buf[ResultLengthMax + 1];
-  static ResultType ipv6(FieldNumber, "IPv6");
-  static IPGrammar<> g;
+static inline int hexDigit(char c) {
+  if (static_cast<unsigned>(c - '0') <= 9) {
+    return c - '0';
+  }
+  c |= 0x20;
+  if (static_cast<unsigned>(c - 'a') <= 5) {
+    return c - 'a' + 10;
+  }
+  return -1;
+}
 
-  if (ip.find(':') != std::string::npos) {
-    *result = &ipv6;
-    return true;
+// the dotted quad ending an IPv6 address, strict like inet_pton: no
+// leading zeros and nothing after it
+static bool parseEmbeddedIPv4(const char *s, const char *end, uint32_t &ip) {
+  uint32_t addr = 0;
+  for (int i = 0; i < 4; ++i) {
+    if (i > 0 && (s == end || *s++ != '.')) {
+      return false;
+    }
+    if (s == end || static_cast<unsigned>(*s - '0') > 9) {
+      return false;
+    }
+    uint32_t octet = *s++ - '0';
+    while (s != end && static_cast<unsigned>(*s - '0') <= 9) {
+      if (octet == 0) {
+        return false;
+      }
+      octet = octet * 10 + (*s++ - '0');
+      if (octet > 255) {
+        return false;
+      }
+    }
+    addr = addr << 8 | octet;
+  }
+
+  ip = addr;
+  return s == end;
+}
+
+bool IPResolver::ParseIPv6(const char *s, const char *end, IPv6 &ip) {
+  uint16_t groups[8];
+  int n = 0, gap = -1, digits = 0;
+  uint32_t value = 0;
+
+  // a leading colon only as part of "::"
+  if (s != end && *s == ':' && (++s == end || *s != ':')) {
+    return false;
+  }
+
+  const char *group = s;
+  while (s != end) {
+    char c = *s++;
+    int d  = hexDigit(c);
+    if (d >= 0) {
+      if (++digits > 4) {
+        return false;
+      }
+      value = value << 4 | d;
+    } else if (c == ':') {
+      group = s;
+      if (digits == 0) {
+        if (gap >= 0) {
+          return false;
+        }
+        gap = n;
+        continue;
+      }
+      if (s == end || n == 8) {
+        return false;
+      }
+      groups[n++] = static_cast<uint16_t>(value);
+      value = digits = 0;
+    } else if (c == '.' && n <= 6) {
+      uint32_t v4;
+      if (!parseEmbeddedIPv4(group, end, v4)) {
+        return false;
+      }
+      groups[n++] = static_cast<uint16_t>(v4 >> 16);
+      groups[n++] = static_cast<uint16_t>(v4);
+      digits      = 0;
+      break;
+    } else {
+      return false;
+    }
   }
 
-  auto res = lru_.get(ip);
-  if (res) {
-    *result = res->get();
+  if (digits > 0) {
+    if (n == 8) {
+      return false;
+    }
+    groups[n++] = static_cast<uint16_t>(value);
+  }
+  if (gap >= 0) {
+    // "::" stands for one zero group at least
+    if (n == 8) {
+      return false;
+    }
+    int zeros = 8 - n;
+    for (int i = n - 1; i >= gap; --i) {
+      groups[i + zeros] = groups[i];
+    }
+    for (int i = gap; i < gap + zeros; ++i) {
+      groups[i] = 0;
+    }
+  } else if (n != 8) {
+    return false;
+  }
+
+  ip.hi_ = ip.lo_ = 0;
+  for (int i = 0; i < 4; ++i) {
+    ip.hi_ = ip.hi_ << 16 | groups[i];
+    ip.lo_ = ip.lo_ << 16 | groups[i + 4];
+  }
+  return true;
+}
+
+bool IPResolver::ResolveIPv6(const char *ip, size_t size,
+                             LRUValueType &result, uint32_t &addr) const {
+  static const ResultType ipv6 = sameFields("IPv6");
+
+  Pinned<IPv6Index> index(v6_, 1);
+  if (!index) {
+    result = &ipv6;
     return true;
   }
 
-  std::vector<uint8_t> ips;
-  ips.reserve(4);
-  bool ok = boost::spirit::qi::parse(ip.begin(), ip.end(), g, ips);
-  if (!ok) {
+  IPv6 addr6;
+  if (!ParseIPv6(ip, ip + size, addr6)) {
     return false;
   }
+  // IPv4-mapped, ::ffff:a.b.c.d, is looked up as IPv4
+  if (addr6.hi_ != 0 || (addr6.lo_ >> 32) != 0xFFFF) {
+    result = index->Lookup(addr6);
+  } else {
+    result = nullptr;
+    addr   = static_cast<uint32_t>(addr6.lo_);
+  }
+  return true;
+}
 
-  uint32_t ip_int       = B2IU(ips);
-  uint32_t start        = flag_[ips[0]];
-  uint32_t max_comp_len = offset_ - 1028;
-  uint32_t index_offset = 0;
-  uint32_t index_length = 0;
+bool IPResolver::Resolve(const char *ip, size_t size, LRUValueType &result) {
+  uint32_t addr;
+  if (memchr(ip, ':', size) != nullptr) {
+    if (!ResolveIPv6(ip, size, result, addr)) {
+      return false;
+    }
+    if (result) {
+      return true;
+    }
+  } else if (!ParseIPv4(ip, ip + size, addr)) {
+    return false;
+  }
 
-  uint32_t lo = start * 8 + 1024;
-  uint32_t hi = max_comp_len;
-  while (lo < hi) {
-    uint32_t mid = lo + (hi - lo) / 16 * 8;
-    if (B2IU(index_ + mid) < ip_int) {
-      lo = mid + 8;
-    } else {
-      hi = mid;
+  CacheShard &shard = Shard(addr);
+  std::lock_guard<std::mutex> lock(shard.mutex_);
+  if (auto res = shard.lru_.lookup(addr)) {
+    result = *res;
+    return true;
+  }
+
+  result = Lookup(addr);
+  shard.lru_.insert(addr, result);
+
+  return true;
+}
+
+void IPResolver::Resolve(const boost::string_ref *ips, size_t n,
+                         LRUValueType *results) {
+  const size_t kBatch = 64;
+  uint32_t addrs[kBatch];
+  size_t slots[kBatch];
+  LRUValueType records[kBatch];
+  // one index for the whole batch, IPv4-mapped addresses included
+  Pinned<IPv4Index> index(v4_, 0);
+
+  for (size_t i = 0; i < n;) {
+    size_t m = 0;
+    for (; i < n && m < kBatch; ++i) {
+      const char *ip = ips[i].data();
+      size_t size    = ips[i].size();
+      results[i]     = nullptr;
+      bool parsed    = memchr(ip, ':', size) == nullptr
+                        ? ParseIPv4(ip, ip + size, addrs[m])
+                        : ResolveIPv6(ip, size, results[i], addrs[m]);
+      if (!parsed) {
+        results[i] = UnknownResult;
+      } else if (results[i] == nullptr) {
+        slots[m++] = i;
+      }
+    }
+
+    index->Lookup(addrs, m, records);
+    for (size_t j = 0; j < m; ++j) {
+      results[slots[j]] = records[j];
     }
   }
+}
 
-  index_offset = B2IL(index_ + lo + 4) & 0x00FFFFFF;
-  index_length = index_[lo + 7];
+IPResolver::LRUValueType IPResolver::Lookup(uint32_t ip) const {
+  return Pinned<IPv4Index>(v4_, 0)->Lookup(ip);
+}
 
-  memcpy(buf, data_ + offset_ + index_offset - 1024, index_length);
-  buf[index_length] = '\0';
+void IPResolver::Lookup(const uint32_t *ips, size_t n,
+                        LRUValueType *records) const {
+  Pinned<IPv4Index>(v4_, 0)->Lookup(ips, n, records);
+}
 
-  LRUValueType fields(new ResultType());
-  fields->reserve(FieldNumber);
+IPResolver::LRUValueType IPResolver::Lookup(const IPv6 &ip) const {
+  Pinned<IPv6Index> index(v6_, 1);
+  return index ? index->Lookup(ip) : UnknownResult;
+}
 
-  int n   = 0;
-  char *s = buf, *e = buf;
-  while (*e && n < FieldNumber) {
+size_t IPResolver::Ranges() const { return Pinned<IPv4Index>(v4_, 0)->size_; }
+
+size_t IPResolver::Ranges6() const {
+  Pinned<IPv6Index> index(v6_, 1);
+  return index ? index->size_ : 0;
+}
+
+size_t IPResolver::Records() const {
+  return Pinned<IPv4Index>(v4_, 0)->records_.size();
+}
+
+// The jump table entry of an address a few ahead is prefetched, its search
+// starts from there. The searches are left one after the other: the jump
+// table leaves two or three probes to each, and the searches of
+// neighbouring addresses overlap in the pipeline already, stepping them
+// together round by round measured slower.
+void IPResolver::IPv4Index::Lookup(const uint32_t *ips, size_t n,
+                                   LRUValueType *records) const {
+  const size_t kAhead = 8;
+  for (size_t i = 0; i < n; ++i) {
+    if (i + kAhead < n) {
+      __builtin_prefetch(&jump_[ips[i + kAhead] >> 16]);
+    }
+    records[i] = Lookup(ips[i]);
+  }
+}
+
+// splits a record at tabs into at most FieldNumber fields, the rest empty
+static void splitRecord(boost::string_ref text,
+                        IPResolver::ResultType &fields) {
+  const char *s = text.begin(), *e = s, *end = text.end();
+  size_t n = 0;
+  while (e < end && *e && n < IPResolver::FieldNumber) {
     if (*e == '\t') {
-      fields->emplace_back(s, e);
-      s = e + 1;
-      ++n;
+      fields[n++] = boost::string_ref(s, e - s);
+      s           = e + 1;
     }
     ++e;
   }
 
-  if (n < FieldNumber) {
-    fields->emplace_back(s, e);
+  if (n < IPResolver::FieldNumber) {
+    fields[n] = boost::string_ref(s, e - s);
+  }
+}
+
+struct TextHash {
+  size_t operator()(boost::string_ref s) const {
+    return boost::hash_range(s.begin(), s.end());
+  }
+};
+
+// Records are interned for the life of the process, so results, cache
+// entries and documents point to them rather than counting references,
+// also documents an aggregation keeps across a reload. A record refers to
+// its text in the first image holding it, which stays mapped for it.
+// Databases hold a few thousand distinct records, a reload only adds the
+// ones it changes.
+static IPResolver::LRUValueType internRecord(boost::string_ref text) {
+  static std::mutex mutex;
+  // the nodes stay put as the table grows
+  static std::unordered_map<boost::string_ref, IPResolver::ResultType,
+                            TextHash>
+      records;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = records.find(text);
+  if (it == records.end()) {
+    it = records.emplace(text, IPResolver::ResultType()).first;
+    splitRecord(text, it->second);
+  }
+  return &it->second;
+}
+
+// the records of an image checked by recordsWithin(), interned
+static void internRecords(const char *data, const ImageHeader *h,
+                          std::vector<IPResolver::LRUValueType> &records) {
+  const uint32_t *r = section<uint32_t>(data, h, kRecords);
+  const char *text  = section<char>(data, h, kText);
+  records.reserve(h->count_[kRecords]);
+  for (size_t i = 0; i < h->count_[kRecords]; ++i) {
+    records.push_back(r[2 * i] == UINT32_MAX
+                          ? IPResolver::UnknownResult
+                          : internRecord(boost::string_ref(text + r[2 * i],
+                                                           r[2 * i + 1])));
+  }
+}
+
+// the distinct records of an image, shared by the ranges with the same text
+class RecordTable {
+public:
+  uint32_t Intern(const char *s, size_t n) {
+    std::string text(s, n);
+    auto it = seen_.find(text);
+    if (it == seen_.end()) {
+      it = seen_.emplace(text, count()).first;
+      records_.push_back(static_cast<uint32_t>(text_.size()));
+      records_.push_back(static_cast<uint32_t>(n));
+      text_.append(s, n);
+    }
+    return it->second;
+  }
+
+  uint32_t Unknown() {
+    if (unknown_ == UINT32_MAX) {
+      unknown_ = count();
+      records_.push_back(UINT32_MAX);
+      records_.push_back(0);
+    }
+    return unknown_;
+  }
+
+  // the records, then their texts, the last sections
+  void AddTo(ImageWriter &image) const {
+    image.Add(kRecords, records_.data(), count(), 8);
+    image.Add(kText, text_.data(), text_.size(), 1);
+  }
+
+private:
+  uint32_t count() const { return static_cast<uint32_t>(records_.size() / 2); }
+
+  // the offset and the length of each text
+  std::vector<uint32_t> records_;
+  std::string text_;
+  std::unordered_map<std::string, uint32_t> seen_;
+  uint32_t unknown_ = UINT32_MAX;
+};
+
+std::string IPResolver::BuildIPv4(const char *db, size_t size) {
+  const byte *data = reinterpret_cast<const byte *>(db);
+  // the big-endian offset of the records, a 1024 byte prefix table, then
+  // entries of 8 bytes: the big-endian last address of the range, a 3 byte
+  // little-endian record offset and the record length
+  uint32_t offset = size >= 4 ? B2IU(data) : 0;
+  // the entries end and the records begin 1024 bytes before the offset
+  if (offset < 1028 + 1024 || offset - 1024 > size) {
+    logger->error("bad ip db, index of {} bytes in {}", offset, size);
+    return std::string();
+  }
+
+  size_t n            = (offset - 1028 - 1024) / 8;
+  const byte *entries = data + 4 + 1024;
+  const byte *records = data + offset - 1024;
+  const byte *end     = data + size;
+
+  RecordTable table;
+  std::vector<uint32_t> ends, ranges;
+  ends.reserve(n + 1);
+  ranges.reserve(n + 1);
+
+  for (size_t i = 0; i < n; ++i) {
+    const byte *entry = entries + i * 8;
+    uint32_t last     = B2IU(entry);
+    if (!ends.empty() && ends.back() > last) {
+      logger->error("bad ip db, range {} out of order", i);
+      return std::string();
+    }
+
+    const byte *record = records + (B2IL(entry + 4) & 0x00FFFFFF);
+    if (record + entry[7] > end) {
+      logger->error("ip record out of the db, range end: {}", last);
+      ends.push_back(last);
+      ranges.push_back(table.Unknown());
+      continue;
+    }
+
+    ends.push_back(last);
+    ranges.push_back(
+        table.Intern(reinterpret_cast<const char *>(record), entry[7]));
+  }
+
+  // addresses past the last range
+  if (ends.empty() || ends.back() != UINT32_MAX) {
+    ends.push_back(UINT32_MAX);
+    ranges.push_back(table.Unknown());
+  }
+
+  std::vector<uint32_t> jump(65537);
+  for (uint32_t prefix = 0; prefix < 65536; ++prefix) {
+    jump[prefix] = static_cast<uint32_t>(
+        std::lower_bound(ends.begin(), ends.end(), prefix << 16) -
+        ends.begin());
+  }
+  // the range ending at or after the last address
+  jump[65536] = static_cast<uint32_t>(ends.size() - 1);
+
+  ImageWriter image(kMagicIPv4);
+  image.Add(kEnds, ends);
+  image.Add(kJump, jump);
+  image.Add(kRanges, ranges);
+  table.AddTo(image);
+  return image.Finish();
+}
+
+IPResolver::IPv4Index *IPResolver::OpenIPv4(const char *data, size_t size,
+                                             const uint64_t *source) {
+  const ImageHeader *h =
+      imageHeader(data, size, kMagicIPv4, kWidthsIPv4, source);
+  if (h == nullptr) {
+    return nullptr;
+  }
+  // a range past every address, and searches staying in the image
+  size_t n = h->count_[kEnds];
+  if (n == 0 || h->count_[kJump] != 65537 || h->count_[kRanges] != n ||
+      !below(section<uint32_t>(data, h, kJump), 65537, n) ||
+      !below(section<uint32_t>(data, h, kRanges), n, h->count_[kRecords]) ||
+      !recordsWithin(data, h)) {
+    return nullptr;
+  }
+
+  IPv4Index *index = new IPv4Index(data, size);
+  index->ends_     = section<uint32_t>(data, h, kEnds);
+  index->jump_     = section<uint32_t>(data, h, kJump);
+  index->ranges_   = section<uint32_t>(data, h, kRanges);
+  index->size_     = n;
+  internRecords(data, h, index->records_);
+  logger->info("ip ranges: {}, distinct records: {}", n,
+               index->records_.size());
+  return index;
+}
+
+static IPv6 nextIPv6(IPv6 ip) {
+  if (++ip.lo_ == 0) {
+    ++ip.hi_;
   }
+  return ip;
+}
+
+static IPv6 prevIPv6(IPv6 ip) {
+  if (ip.lo_-- == 0) {
+    --ip.hi_;
+  }
+  return ip;
+}
+
+std::string IPResolver::BuildIPv6(const char *data, size_t size) {
+  const IPv6 last_ip = {UINT64_MAX, UINT64_MAX};
 
-  *result = fields.get();
-  lru_.insert(ip, std::move(fields));
+  RecordTable table;
+  std::vector<IPv6> ends;
+  std::vector<uint32_t> ranges;
+  // the first address no range covers yet
+  IPv6 next    = {0, 0};
+  bool covered = false;
+
+  const char *p = data, *end = data + size;
+  for (size_t line = 1; p < end; ++line) {
+    const char *s = p;
+    const char *e = static_cast<const char *>(memchr(s, '\n', end - s));
+    e = e ? e : end;
+    p = e + 1;
+    if (e > s && e[-1] == '\r') {
+      --e;
+    }
+    if (s == e || *s == '#') {
+      continue;
+    }
+
+    const char *t1 = std::find(s, e, '\t');
+    const char *t2 = std::find(std::min(t1 + 1, e), e, '\t');
+    IPv6 first, last;
+    if (t1 == e || !ParseIPv6(s, t1, first) ||
+        !ParseIPv6(t1 + 1, t2, last) || last < first || covered ||
+        first < next) {
+      logger->error("ipv6 db line {}: bad, unsorted or overlapping range",
+                    line);
+      return std::string();
+    }
+
+    if (next < first) {
+      ends.push_back(prevIPv6(first));
+      ranges.push_back(table.Unknown());
+    }
+    ends.push_back(last);
+    const char *record = std::min(t2 + 1, e);
+    ranges.push_back(table.Intern(record, e - record));
+
+    covered = last == last_ip;
+    next    = nextIPv6(last);
+  }
+
+  // addresses past the last range
+  if (!covered) {
+    ends.push_back(last_ip);
+    ranges.push_back(table.Unknown());
+  }
+
+  std::vector<uint32_t> jump(65537);
+  for (uint64_t prefix = 0; prefix < 65536; ++prefix) {
+    const IPv6 start = {prefix << 48, 0};
+    jump[prefix]     = static_cast<uint32_t>(
+        std::lower_bound(ends.begin(), ends.end(), start) - ends.begin());
+  }
+  jump[65536] = static_cast<uint32_t>(ends.size() - 1);
+
+  std::vector<uint32_t> dense(65536, UINT32_MAX), sub;
+  for (uint64_t prefix = 0; prefix < 65536; ++prefix) {
+    if (jump[prefix + 1] - jump[prefix] < 64) {
+      continue;
+    }
+    dense[prefix] = static_cast<uint32_t>(sub.size());
+    for (uint64_t next = 0; next < 4096; ++next) {
+      const IPv6 start = {prefix << 48 | next << 36, 0};
+      sub.push_back(static_cast<uint32_t>(
+          std::lower_bound(ends.begin() + jump[prefix],
+                           ends.begin() + jump[prefix + 1], start) -
+          ends.begin()));
+    }
+    sub.push_back(jump[prefix + 1]);
+  }
+
+  ImageWriter image(kMagicIPv6);
+  image.Add(kEnds, ends);
+  image.Add(kJump, jump);
+  image.Add(kDense, dense);
+  image.Add(kSub, sub);
+  image.Add(kRanges, ranges);
+  table.AddTo(image);
+  return image.Finish();
+}
+
+IPResolver::IPv6Index *IPResolver::OpenIPv6(const char *data, size_t size,
+                                             const uint64_t *source) {
+  const ImageHeader *h =
+      imageHeader(data, size, kMagicIPv6, kWidthsIPv6, source);
+  if (h == nullptr) {
+    return nullptr;
+  }
+  size_t n = h->count_[kEnds];
+  if (n == 0 || h->count_[kJump] != 65537 || h->count_[kDense] != 65536 ||
+      h->count_[kRanges] != n ||
+      !below(section<uint32_t>(data, h, kJump), 65537, n) ||
+      !below(section<uint32_t>(data, h, kSub), h->count_[kSub], n) ||
+      !below(section<uint32_t>(data, h, kRanges), n, h->count_[kRecords]) ||
+      !recordsWithin(data, h)) {
+    return nullptr;
+  }
+  // a dense prefix has 4097 entries in sub
+  const uint32_t *dense = section<uint32_t>(data, h, kDense);
+  for (size_t i = 0; i < 65536; ++i) {
+    if (dense[i] != UINT32_MAX &&
+        static_cast<uint64_t>(dense[i]) + 4097 > h->count_[kSub]) {
+      return nullptr;
+    }
+  }
+
+  IPv6Index *index = new IPv6Index(data, size);
+  index->ends_     = section<IPv6>(data, h, kEnds);
+  index->jump_     = section<uint32_t>(data, h, kJump);
+  index->dense_    = dense;
+  index->sub_      = section<uint32_t>(data, h, kSub);
+  index->ranges_   = section<uint32_t>(data, h, kRanges);
+  index->size_     = n;
+  internRecords(data, h, index->records_);
+  logger->info("ipv6 ranges: {}, distinct records: {}", n,
+               index->records_.size());
+  return index;
+}
 
+void IPResolver::Swap(IPv4Index *v4, IPv6Index *v6) {
+  if (v4) {
+    const IPv4Index *old = v4_.exchange(v4);
+    // a miss looks up and inserts under the stripe lock, what is inserted
+    // after the clear comes from the new index
+    for (auto &shard : cache_) {
+      std::lock_guard<std::mutex> lock(shard.mutex_);
+      shard.lru_.clear();
+    }
+    retire(old);
+  }
+  if (v6) {
+    retire(v6_.exchange(v6));
+  }
+}
+
+bool IPResolver::LoadIPv6(const char *db_path) {
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  IPv6Index *index = loadIndex(std::string(db_path), &BuildIPv6, &OpenIPv6);
+  if (index == nullptr) {
+    return false;
+  }
+
+  db6_path_ = db_path;
+  Swap(nullptr, index);
+  return true;
+}
+
+bool IPResolver::LoadIPv6(const char *db_data, const size_t db_size) {
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  IPv6Index *index = openCopy(BuildIPv6(db_data, db_size), &OpenIPv6);
+  if (index == nullptr) {
+    return false;
+  }
+
+  Swap(nullptr, index);
+  return true;
+}
+
+bool IPResolver::Reload() {
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  if (db_path_.empty()) {
+    return false;
+  }
+
+  std::unique_ptr<IPv4Index> v4(loadIndex(db_path_, &BuildIPv4, &OpenIPv4));
+  std::unique_ptr<IPv6Index> v6;
+  if (!db6_path_.empty()) {
+    v6.reset(loadIndex(db6_path_, &BuildIPv6, &OpenIPv6));
+  }
+
+  if (!v4 || (!db6_path_.empty() && !v6)) {
+    logger->error("ip db reload failed, the loaded ones stay");
+    return false;
+  }
+
+  Swap(v4.release(), v6.release());
+  logger->info("ip db reloaded");
   return true;
 }
 
-void IPResolver::Init() {
-  uint32_t length = B2IU(data_);
-  ASSERT(length > 0 && length < 16777216);
+void IPResolver::RequestReload() { reload_requested = true; }
 
-  offset_ = length;
-  index_  = data_ + 4;
-  flag_   = reinterpret_cast<uint32_t *>(index_);
+// what tells a database file was changed or replaced
+static std::string fileStamp(const std::string &path) {
+  struct stat st;
+  if (path.empty() || stat(path.c_str(), &st) != 0) {
+    return std::string();
+  }
+  return std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" +
+         std::to_string(st.st_mtim.tv_sec) + "." +
+         std::to_string(st.st_mtim.tv_nsec);
+}
+
+void IPResolver::Watch(int interval) {
+  if (watcher_.joinable()) {
+    return;
+  }
+
+  watcher_ = std::thread([this, interval]() {
+    std::unique_lock<std::mutex> lock(reload_mutex_);
+    std::string stamp = fileStamp(db_path_) + fileStamp(db6_path_);
+    int elapsed       = 0;
+
+    while (!stop_) {
+      stop_cond_.wait_for(lock, std::chrono::seconds(1));
+      if (stop_) {
+        break;
+      }
+
+      bool reload = reload_requested.exchange(false);
+      if (interval > 0 && ++elapsed >= interval) {
+        elapsed = 0;
+        reload  = reload || fileStamp(db_path_) + fileStamp(db6_path_) != stamp;
+      }
+      if (!reload) {
+        continue;
+      }
+
+      // a file half written fails to load, and is tried again next time as
+      // the stamp stays
+      std::string now = fileStamp(db_path_) + fileStamp(db6_path_);
+      lock.unlock();
+      bool ok = Reload();
+      lock.lock();
+      if (ok) {
+        stamp = now;
+      }
+    }
+  });
 }
 
 } // namespace util
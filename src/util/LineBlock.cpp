@@ -0,0 +1,50 @@
+#include <algorithm>
+
+#include "fluorine/util/LineBlock.hpp"
+
+namespace fluorine {
+namespace util {
+
+const size_t BlockQueue::kBlockSize;
+
+BlockQueue::BlockQueue(size_t bytes, size_t block_size)
+    : ready_(std::max<size_t>(bytes / block_size, 2)),
+      free_(std::max<size_t>(bytes / block_size, 2)) {
+  size_t n = std::max<size_t>(bytes / block_size, 2);
+  for (size_t i = 0; i < n; ++i) {
+    blocks_.emplace_back(new LineBlock(block_size));
+    free_.push(blocks_.back().get());
+  }
+}
+
+LineBlock *BlockQueue::Acquire() {
+  LineBlock *block;
+  if (!free_.pop(block)) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_.wait(lock, [this, &block]() { return free_.pop(block); });
+  }
+
+  block->Clear();
+  return block;
+}
+
+void BlockQueue::Push(LineBlock *block) {
+  // never full, there are no more blocks than slots
+  ready_.push(block);
+  wakeup_.Notify();
+}
+
+LineBlock *BlockQueue::Pop() {
+  LineBlock *block;
+  return ready_.pop(block) ? block : nullptr;
+}
+
+void BlockQueue::Release(LineBlock *block) {
+  free_.push(block);
+  // the lock orders the push with a producer between its check and its wait
+  std::lock_guard<std::mutex> lock(mutex_);
+  released_.notify_one();
+}
+
+} // namespace util
+} // namespace fluorine
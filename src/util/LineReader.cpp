@@ -0,0 +1,91 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "fluorine/util/LineReader.hpp"
+
+namespace fluorine {
+namespace util {
+
+const size_t LineScanner::kChunkSize;
+
+bool MappedFile::Open(const std::string &path) {
+  Close();
+
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    ::close(fd);
+    return false;
+  }
+
+  size_t size = static_cast<size_t>(st.st_size);
+  if (size > 0) {
+    void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      ::close(fd);
+      return false;
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+    data_ = static_cast<const char *>(addr);
+  }
+
+  fd_   = fd;
+  size_ = size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_) {
+    munmap(const_cast<char *>(data_), size_);
+    data_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  size_ = 0;
+}
+
+void LineScanner::Scan() {
+  if (chunk_ + kChunkSize <= end_) {
+#if defined(__SSE2__)
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i *p = reinterpret_cast<const __m128i *>(chunk_);
+
+    uint64_t m0 = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p), nl)));
+    uint64_t m1 = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 1), nl)));
+    uint64_t m2 = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), nl)));
+    uint64_t m3 = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 3), nl)));
+
+    mask_ = m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+    return;
+#endif
+  }
+
+  uint64_t m = 0;
+  size_t n   = std::min<size_t>(kChunkSize, end_ - chunk_);
+  for (size_t i = 0; i < n; ++i) {
+    if (chunk_[i] == '\n') {
+      m |= uint64_t(1) << i;
+    }
+  }
+  mask_ = m;
+}
+
+} // namespace util
+} // namespace fluorine
@@ -0,0 +1,556 @@
+#include <time.h>
+#include <string.h>
+#include <atomic>
+
+#include "fluorine/util/Fast.hpp"
+#include "fluorine/util/TimeFormat.hpp"
+
+namespace fluorine {
+namespace util {
+
+namespace {
+
+enum class Kind : uint8_t {
+  Literal,
+  Year,
+  Month,
+  Day,
+  DaySpaced,
+  MonthName,
+  Hour,
+  Minute,
+  Second,
+  Fraction,
+  Zone,
+  Epoch,
+  EpochMillis,
+  Clock, // %H:%M:%S
+  Date,  // %Y-%m-%d
+};
+
+// a conversion, or the characters matching themselves up to the next one
+struct Item {
+  Kind kind_;
+  std::string literal_;
+  char sep_ = 0;
+};
+
+// the width of an item read at fixed positions, 0 for a varying one
+size_t fixedWidth(const Item &item) {
+  size_t sep = item.sep_ != 0;
+  switch (item.kind_) {
+  case Kind::Literal:
+    return item.literal_.size();
+  case Kind::Year:
+    return 4 + sep;
+  case Kind::Month:
+  case Kind::Day:
+  case Kind::Hour:
+  case Kind::Minute:
+  case Kind::Second:
+    return 2 + sep;
+  case Kind::MonthName:
+    return 3 + sep;
+  case Kind::Clock:
+    return 8 + sep;
+  case Kind::Date:
+    return 10 + sep;
+  default:
+    return 0;
+  }
+}
+
+// a, the one character literal c, then b, from items[i]
+bool fusable(const std::vector<Item> &items, size_t i, Kind a, char c,
+             Kind b) {
+  return i + 2 < items.size() && items[i].kind_ == a &&
+         items[i + 1].kind_ == Kind::Literal &&
+         items[i + 1].literal_ == std::string(1, c) &&
+         items[i + 2].kind_ == b;
+}
+
+} // namespace
+
+// the n digits at p, moving past them
+static inline bool fixed(const char *&p, const char *end, int n, int &v) {
+  if (end - p < n) {
+    return false;
+  }
+  v = 0;
+  for (int i = 0; i < n; ++i) {
+    unsigned d = static_cast<unsigned char>(p[i]) - '0';
+    if (d > 9) {
+      return false;
+    }
+    v = v * 10 + d;
+  }
+  p += n;
+  return true;
+}
+
+// one to max digits at p, moving past them
+static inline bool varying(const char *&p, const char *end, int max,
+                           int64_t &v) {
+  const char *start = p;
+  v                 = 0;
+  unsigned d;
+  while (p < end && p - start < max &&
+         (d = static_cast<unsigned char>(*p) - '0') <= 9) {
+    v = v * 10 + d;
+    ++p;
+  }
+  return p > start;
+}
+
+static inline bool monthName(const char *&p, const char *end, int &mon) {
+  static const char names[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  if (end - p < 3) {
+    return false;
+  }
+  for (mon = 0; mon < 12; ++mon) {
+    if (p[0] == names[mon * 3] && p[1] == names[mon * 3 + 1] &&
+        p[2] == names[mon * 3 + 2]) {
+      p += 3;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Z, +hh, +hhmm or +hh:mm, east of UTC in seconds
+static inline bool zone(const char *&p, const char *end, int &offset) {
+  if (p < end && *p == 'Z') {
+    ++p;
+    offset = 0;
+    return true;
+  }
+  if (p == end || (*p != '+' && *p != '-')) {
+    return false;
+  }
+
+  bool west = *p++ == '-';
+  int hour, min = 0;
+  if (!fixed(p, end, 2, hour)) {
+    return false;
+  }
+  const char *q = p < end && *p == ':' ? p + 1 : p;
+  if (fixed(q, end, 2, min)) {
+    p = q;
+  }
+  offset = (hour * 3600 + min * 60) * (west ? -1 : 1);
+  return true;
+}
+
+// The readers of the ops, specialized for each conversion, whether it
+// checks the width of its run and whether a character follows it. Every
+// reader moves p past what it read and runs the next op.
+struct TimeSteps {
+  using Op     = TimeFormat::Op;
+  using Fields = TimeFormat::Fields;
+  using Run    = TimeFormat::Run;
+
+  // the N digits at p, known to be there
+  template <int N>
+  static inline bool digits(const char *p, int &v) {
+    v = 0;
+    for (int i = 0; i < N; ++i) {
+      unsigned d = static_cast<unsigned char>(p[i]) - '0';
+      if (d > 9) {
+        return false;
+      }
+      v = v * 10 + d;
+    }
+    return true;
+  }
+
+  template <bool Reserve>
+  static inline bool reserve(const Op &op, const char *p, const char *end) {
+    return !Reserve || end - p >= op.width_;
+  }
+
+  template <bool Sep>
+  static inline bool sep(const Op &op, const char *&p) {
+    return !Sep || *p++ == op.sep_;
+  }
+
+  template <int N, int tm::*M, int Bias, bool Reserve, bool Sep>
+  struct Number {
+    static bool Read(const char *, const Op &op, const char *&p,
+                     const char *end, Fields &f) {
+      int v;
+      if (!reserve<Reserve>(op, p, end) || !digits<N>(p, v)) {
+        return false;
+      }
+      f.tm_.*M = v - Bias;
+      p += N;
+      return sep<Sep>(op, p);
+    }
+  };
+
+  template <bool R, bool S>
+  using Year = Number<4, &tm::tm_year, 1900, R, S>;
+  template <bool R, bool S>
+  using Month = Number<2, &tm::tm_mon, 1, R, S>;
+  template <bool R, bool S>
+  using Day = Number<2, &tm::tm_mday, 0, R, S>;
+  template <bool R, bool S>
+  using Hour = Number<2, &tm::tm_hour, 0, R, S>;
+  template <bool R, bool S>
+  using Minute = Number<2, &tm::tm_min, 0, R, S>;
+  template <bool R, bool S>
+  using Second = Number<2, &tm::tm_sec, 0, R, S>;
+
+  template <bool Reserve, bool Sep>
+  struct MonthName {
+    static bool Read(const char *, const Op &op, const char *&p,
+                     const char *end, Fields &f) {
+      return reserve<Reserve>(op, p, end) && monthName(p, end, f.tm_.tm_mon) &&
+             sep<Sep>(op, p);
+    }
+  };
+
+  // hh:mm:ss
+  template <bool Reserve, bool Sep>
+  struct Clock {
+    static bool Read(const char *, const Op &op, const char *&p,
+                     const char *end, Fields &f) {
+      if (!reserve<Reserve>(op, p, end) || p[2] != ':' || p[5] != ':' ||
+          !digits<2>(p, f.tm_.tm_hour) || !digits<2>(p + 3, f.tm_.tm_min) ||
+          !digits<2>(p + 6, f.tm_.tm_sec)) {
+        return false;
+      }
+      p += 8;
+      return sep<Sep>(op, p);
+    }
+  };
+
+  // yyyy-mm-dd
+  template <bool Reserve, bool Sep>
+  struct Date {
+    static bool Read(const char *, const Op &op, const char *&p,
+                     const char *end, Fields &f) {
+      if (!reserve<Reserve>(op, p, end) || p[4] != '-' || p[7] != '-' ||
+          !digits<4>(p, f.tm_.tm_year) || !digits<2>(p + 5, f.tm_.tm_mon) ||
+          !digits<2>(p + 8, f.tm_.tm_mday)) {
+        return false;
+      }
+      f.tm_.tm_year -= 1900;
+      f.tm_.tm_mon -= 1;
+      p += 10;
+      return sep<Sep>(op, p);
+    }
+  };
+
+  template <bool Reserve, bool>
+  struct Literal {
+    static bool Read(const char *literals, const Op &op, const char *&p,
+                     const char *end, Fields &) {
+      if (!reserve<Reserve>(op, p, end) ||
+          memcmp(p, literals + op.pos_, op.len_) != 0) {
+        return false;
+      }
+      p += op.len_;
+      return true;
+    }
+  };
+
+  // the varying ones check as they read
+  struct DaySpaced {
+    static bool Read(const char *, const Op &, const char *&p,
+                     const char *end, Fields &f) {
+      int64_t v;
+      p += p < end && *p == ' ';
+      if (!varying(p, end, 2, v)) {
+        return false;
+      }
+      f.tm_.tm_mday = static_cast<int>(v);
+      return true;
+    }
+  };
+
+  struct Fraction {
+    static bool Read(const char *, const Op &, const char *&p,
+                     const char *end, Fields &) {
+      int64_t v;
+      return varying(p, end, 9, v);
+    }
+  };
+
+  struct Zone {
+    static bool Read(const char *, const Op &, const char *&p,
+                     const char *end, Fields &f) {
+      return zone(p, end, f.offset_);
+    }
+  };
+
+  template <int Divisor>
+  struct Epoch {
+    static bool Read(const char *, const Op &, const char *&p,
+                     const char *end, Fields &f) {
+      if (!varying(p, end, 18, f.ts_)) {
+        return false;
+      }
+      f.ts_ /= Divisor;
+      return true;
+    }
+  };
+
+  template <class F>
+  static bool chain(const char *literals, const Op *op, const char *p,
+                    const char *end, Fields &f) {
+    return F::Read(literals, *op, p, end, f) &&
+           op[1].run_(literals, op + 1, p, end, f);
+  }
+
+  static bool done(const char *, const Op *, const char *, const char *,
+                   Fields &) {
+    return true;
+  }
+
+  template <template <bool, bool> class F>
+  static Run pick(bool reserve, bool sep) {
+    if (reserve) {
+      return sep ? chain<F<true, true>> : chain<F<true, false>>;
+    }
+    return sep ? chain<F<false, true>> : chain<F<false, false>>;
+  }
+
+  static Run pick(const Item &item, bool reserve) {
+    bool s = item.sep_ != 0;
+    switch (item.kind_) {
+    case Kind::Literal:
+      return pick<Literal>(reserve, false);
+    case Kind::Year:
+      return pick<Year>(reserve, s);
+    case Kind::Month:
+      return pick<Month>(reserve, s);
+    case Kind::Day:
+      return pick<Day>(reserve, s);
+    case Kind::MonthName:
+      return pick<MonthName>(reserve, s);
+    case Kind::Hour:
+      return pick<Hour>(reserve, s);
+    case Kind::Minute:
+      return pick<Minute>(reserve, s);
+    case Kind::Second:
+      return pick<Second>(reserve, s);
+    case Kind::Clock:
+      return pick<Clock>(reserve, s);
+    case Kind::Date:
+      return pick<Date>(reserve, s);
+    case Kind::DaySpaced:
+      return chain<DaySpaced>;
+    case Kind::Fraction:
+      return chain<Fraction>;
+    case Kind::Zone:
+      return chain<Zone>;
+    case Kind::Epoch:
+      return chain<Epoch<1>>;
+    case Kind::EpochMillis:
+      return chain<Epoch<1000>>;
+    }
+    return done;
+  }
+};
+
+bool TimeFormat::Compile(const std::string &format, std::string &error) {
+  ops_.clear();
+  literals_.clear();
+  year_  = false;
+  zone_  = false;
+  epoch_ = false;
+
+  // %T and %F spelled out, conversions kept in pairs so %%T stays literal
+  std::string spelled;
+  for (size_t i = 0; i < format.size(); ++i) {
+    if (format[i] != '%' || i + 1 == format.size()) {
+      spelled += format[i];
+    } else if (format[++i] == 'T') {
+      spelled += "%H:%M:%S";
+    } else if (format[i] == 'F') {
+      spelled += "%Y-%m-%d";
+    } else {
+      spelled += '%';
+      spelled += format[i];
+    }
+  }
+  if (spelled.size() > UINT16_MAX) {
+    error = "format too long";
+    return false;
+  }
+
+  std::vector<Item> items;
+  bool day = false, month = false;
+  for (size_t i = 0; i < spelled.size(); ++i) {
+    bool literal = spelled[i] != '%' ||
+                   (i + 1 < spelled.size() && spelled[i + 1] == '%');
+    if (literal) {
+      i += spelled[i] == '%';
+      if (items.empty() || items.back().kind_ != Kind::Literal) {
+        items.emplace_back();
+        items.back().kind_ = Kind::Literal;
+      }
+      items.back().literal_ += spelled[i];
+      continue;
+    }
+
+    if (i + 1 == spelled.size()) {
+      error = "format ends in '%'";
+      return false;
+    }
+
+    Item item;
+    switch (spelled[++i]) {
+    case 'Y':
+      item.kind_ = Kind::Year;
+      year_      = true;
+      break;
+    case 'm':
+      item.kind_ = Kind::Month;
+      month      = true;
+      break;
+    case 'b':
+      item.kind_ = Kind::MonthName;
+      month      = true;
+      break;
+    case 'd':
+      item.kind_ = Kind::Day;
+      day        = true;
+      break;
+    case 'e':
+      item.kind_ = Kind::DaySpaced;
+      day        = true;
+      break;
+    case 'H':
+      item.kind_ = Kind::Hour;
+      break;
+    case 'M':
+      item.kind_ = Kind::Minute;
+      break;
+    case 'S':
+      item.kind_ = Kind::Second;
+      break;
+    case 'f':
+      item.kind_ = Kind::Fraction;
+      break;
+    case 'z':
+      item.kind_ = Kind::Zone;
+      zone_      = true;
+      break;
+    case 's':
+      item.kind_ = Kind::Epoch;
+      epoch_     = true;
+      break;
+    case 'Q':
+      item.kind_ = Kind::EpochMillis;
+      epoch_     = true;
+      break;
+    default:
+      error = std::string("unknown conversion %") + spelled[i];
+      return false;
+    }
+    items.push_back(item);
+  }
+
+  if (!epoch_ && (!day || !month)) {
+    error = "no %s, %Q or day and month in the format";
+    return false;
+  }
+
+  // %H:%M:%S and %Y-%m-%d read as one, a fixed conversion takes the first
+  // character of a literal after it
+  std::vector<Item> fused;
+  for (size_t i = 0; i < items.size(); ++i) {
+    if (fusable(items, i, Kind::Hour, ':', Kind::Minute) &&
+        fusable(items, i + 2, Kind::Minute, ':', Kind::Second)) {
+      fused.emplace_back();
+      fused.back().kind_ = Kind::Clock;
+      i += 4;
+    } else if (fusable(items, i, Kind::Year, '-', Kind::Month) &&
+               fusable(items, i + 2, Kind::Month, '-', Kind::Day)) {
+      fused.emplace_back();
+      fused.back().kind_ = Kind::Date;
+      i += 4;
+    } else if (items[i].kind_ == Kind::Literal && !fused.empty() &&
+               fused.back().kind_ != Kind::Literal &&
+               fused.back().sep_ == 0 && fixedWidth(fused.back()) > 0) {
+      fused.back().sep_ = items[i].literal_[0];
+      if (items[i].literal_.size() > 1) {
+        fused.push_back(items[i]);
+        fused.back().literal_.erase(0, 1);
+      }
+    } else {
+      fused.push_back(items[i]);
+    }
+  }
+
+  // the first of a run of fixed widths checks for the whole run
+  std::vector<Op> ops(fused.size() + 1);
+  for (size_t i = fused.size(); i-- > 0;) {
+    const Item &item = fused[i];
+    Op &op           = ops[i];
+    size_t width     = fixedWidth(item);
+    bool first = width > 0 && (i == 0 || fixedWidth(fused[i - 1]) == 0);
+    op.run_    = TimeSteps::pick(item, first);
+    op.pos_    = static_cast<uint16_t>(literals_.size());
+    op.len_    = static_cast<uint16_t>(item.literal_.size());
+    op.width_  = width > 0 ? static_cast<uint16_t>(width + ops[i + 1].width_)
+                           : 0;
+    op.sep_    = item.sep_;
+    literals_ += item.literal_;
+  }
+  ops.back().run_   = TimeSteps::done;
+  ops.back().pos_   = 0;
+  ops.back().len_   = 0;
+  ops.back().width_ = 0;
+  ops.back().sep_   = 0;
+  ops_.swap(ops);
+
+  static std::atomic<uint64_t> compiled(0);
+  id_ = ++compiled;
+  return true;
+}
+
+// the local year of now, looked up again once a minute
+static int thisYear(time_t now) {
+  thread_local time_t until = 0;
+  thread_local int year     = 0;
+  if (now >= until) {
+    struct tm tm;
+    localtime_r(&now, &tm);
+    year  = tm.tm_year;
+    until = now + 60;
+  }
+  return year;
+}
+
+bool TimeFormat::Parse(boost::string_ref s, int64_t &ts) const {
+  Fields f = {};
+  if (!ops_[0].run_(literals_.data(), ops_.data(), s.data(),
+                    s.data() + s.size(), f)) {
+    return false;
+  }
+  if (epoch_) {
+    ts = f.ts_;
+    return true;
+  }
+
+  struct tm &tm = f.tm_;
+  if (!year_) {
+    // a year back when that would be more than a day ahead
+    time_t now = time(nullptr);
+    tm.tm_year = thisYear(now);
+    ts         = zone_ ? civil_seconds(tm) - f.offset_ : cached_mktime(&tm);
+    if (ts > now + 86400) {
+      --tm.tm_year;
+    } else {
+      return ts >= 0;
+    }
+  }
+
+  ts = zone_ ? civil_seconds(tm) - f.offset_ : cached_mktime(&tm);
+  return ts >= 0;
+}
+
+} // namespace util
+} // namespace fluorine
@@ -0,0 +1,108 @@
+#include <stdlib.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "fluorine/log/Json.hpp"
+#include "fluorine/log/Parser.hpp"
+#include "fluorine/config/Parser.hpp"
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+// Heap allocations (operator new) per transformed line, with a log and a
+// document made for each line, and with both reused, and the bytes the
+// reused document takes from its pool per line, usage:
+//   t_alloc sample/access.config sample/access.log 17monipdb.dat
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    std::cout << "usage: " << argv[0] << " <config> <log> <ipdb>" << std::endl;
+    return 1;
+  }
+
+  config::Config cfg;
+  if (!config::ParseConfig(std::string(argv[1]), cfg)) {
+    return 1;
+  }
+  util::InitIPResolver(argv[3]);
+
+  json::Plan plan;
+  if (!json::CompilePlan(cfg, plan)) {
+    return 1;
+  }
+
+  std::vector<std::string> lines;
+  std::ifstream is(argv[2]);
+  for (std::string line; std::getline(is, line);) {
+    lines.push_back(line);
+  }
+
+  std::string out;
+  out.reserve(1 << 20);
+  auto fresh = [&](std::string &line) {
+    log::Log log;
+    if (log::ParseLog(line, log, cfg.field_number_, cfg.time_index_)) {
+      rapidjson::Document doc;
+      if (json::PopulateJsonDoc(&doc, log, plan)) {
+        out += json::JsonDocToString(&doc);
+      }
+    }
+  };
+
+  log::Log log;
+  static char buffer[64 * 1024];
+  size_t pooled = 0;
+  auto reused = [&](std::string &line) {
+    log.clear();
+    if (log::ParseLog(line, log, cfg.field_number_, cfg.time_index_)) {
+      rapidjson::Document::AllocatorType allocator(buffer, sizeof(buffer));
+      rapidjson::Document doc(&allocator);
+      if (json::PopulateJsonDoc(&doc, log, plan)) {
+        json::AppendJsonDoc(&doc, out);
+      }
+      pooled += allocator.Size();
+    }
+  };
+
+  const int kRounds = 100;
+  auto count = [&](const char *name, std::function<void(std::string &)> f) {
+    // the first pass fills the IP cache and the per-thread buffers
+    for (auto &line : lines) {
+      f(line);
+    }
+
+    out.clear();
+    pooled = 0;
+    size_t before = allocations;
+    for (int round = 0; round < kRounds; ++round) {
+      for (auto &line : lines) {
+        f(line);
+      }
+      out.clear();
+    }
+    std::cout << name << ": "
+              << double(allocations - before) / (kRounds * lines.size())
+              << " allocations per line" << std::endl;
+  };
+
+  count("fresh", fresh);
+  count("reused", reused);
+  std::cout << "reused: " << pooled / (kRounds * lines.size())
+            << " document bytes per line" << std::endl;
+
+  return 0;
+}
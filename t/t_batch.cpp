@@ -0,0 +1,223 @@
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include "snet/EventLoop.h"
+#include "snet/Timer.h"
+#include "fluorine/Forwarder.hpp"
+
+using namespace fluorine::forwarder;
+using Clock = std::chrono::steady_clock;
+
+// Sends records through SendBatch and BatchTimer to a Frontend connected to
+// a loopback TCP sink, and checks that the sink reads them back whole and in
+// order: small ones, ones of a batch and larger, some appended before the
+// backend listens, which the timer must hold until the frontend CanSend().
+// Then compares the throughput of a batch of 1 byte, a send per record, with
+// larger batches, usage:
+//   t_batch [record bytes [records]]
+
+// A thread reading what the frontend sends until it has expect bytes. The
+// port is bound first and listened on after listen_after, so the frontend
+// is refused and retries until then.
+class Sink {
+public:
+  Sink(size_t expect, bool keep, std::chrono::milliseconds listen_after)
+      : expect_(expect) {
+    listener_               = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family         = AF_INET;
+    addr.sin_addr.s_addr    = htonl(INADDR_LOOPBACK);
+    socklen_t len           = sizeof(addr);
+    bind(listener_, reinterpret_cast<struct sockaddr *>(&addr), len);
+    getsockname(listener_, reinterpret_cast<struct sockaddr *>(&addr), &len);
+    port_ = ntohs(addr.sin_port);
+    if (listen_after.count() == 0) {
+      listen(listener_, 1);
+    }
+
+    thread_ = std::thread([this, keep, listen_after]() {
+      if (listen_after.count() > 0) {
+        std::this_thread::sleep_for(listen_after);
+        listen(listener_, 1);
+      }
+      int fd = accept(listener_, nullptr, nullptr);
+      std::unique_ptr<char[]> buf(new char[1 << 20]);
+      ssize_t n;
+      while (read_ < expect_ && (n = read(fd, buf.get(), 1 << 20)) > 0) {
+        if (keep) {
+          data_.append(buf.get(), n);
+        }
+        read_ += n;
+      }
+      close(fd);
+    });
+  }
+
+  ~Sink() {
+    if (thread_.joinable()) {
+      thread_.join();
+    }
+    close(listener_);
+  }
+
+  unsigned short Port() const { return port_; }
+
+  const std::string &Wait() {
+    thread_.join();
+    return data_;
+  }
+
+private:
+  int listener_;
+  unsigned short port_;
+  size_t expect_;
+  size_t read_ = 0;
+  std::string data_;
+  std::thread thread_;
+};
+
+// Appends records through a batch of batch bytes while the frontend
+// CanSend(), the first early ones before it does, and returns once the sink
+// has them all, false when the timer sent while the frontend could not.
+static bool send(const std::vector<std::string> &records, size_t early,
+                 size_t batch_size, Sink &sink) {
+  auto loop = snet::CreateEventLoop(1024);
+  // the frontend drives its reconnects on a list of its own, as in main
+  snet::TimerList frontend_timers, timer_list;
+  snet::TimerDriver timer_driver(timer_list);
+  snet::Timer tick(&timer_list);
+  bool held = true;
+
+  {
+    Frontend frontend("127.0.0.1", sink.Port(), loop.get(), frontend_timers);
+    SendBatch batch(&frontend, batch_size);
+    BatchTimer batch_timer(&timer_list, &frontend, &batch, 1);
+
+    // the records the frontend cannot take yet stay in the batch, the
+    // timer polling it every millisecond
+    for (size_t i = 0; i < early; ++i) {
+      batch.Append(records[i]);
+    }
+    batch_timer.Arm();
+
+    size_t next = early;
+    tick.SetOnTimeout([&]() {
+      if (!frontend.CanSend()) {
+        held = held && (early == 0 || !batch.Empty());
+        tick.ExpireFromNow(snet::Milliseconds(1));
+        return;
+      }
+      for (size_t n = 0; n < 1024 && next < records.size() &&
+                         frontend.CanSend();
+           ++n) {
+        batch.Append(records[next++]);
+      }
+      batch_timer.Arm();
+      if (next == records.size()) {
+        batch_timer.Flush();
+        if (batch.Empty() && frontend.SendComplete()) {
+          loop->Stop();
+          return;
+        }
+      }
+      // polls for the sends to complete once all are appended
+      tick.ExpireFromNow(snet::Milliseconds(next == records.size() ? 1 : 0));
+    });
+    tick.ExpireFromNow(snet::Milliseconds(0));
+
+    loop->AddLoopHandler(&timer_driver);
+    loop->Ready();
+    loop->Loop();
+    loop->DelLoopHandler(&timer_driver);
+  }
+  return held;
+}
+
+static bool check(size_t batch_size) {
+  std::mt19937 rng(17);
+  std::vector<std::string> records;
+  std::string expect;
+  for (size_t i = 0; i < 20000; ++i) {
+    size_t size = 20 + rng() % 400;
+    switch (rng() % 100) {
+    case 0:
+      size = batch_size;
+      break;
+    case 1:
+      size = batch_size - 1;
+      break;
+    case 2:
+      size = batch_size * 3 + 7;
+      break;
+    }
+    std::string record = std::to_string(i) + ":";
+    record.resize(std::max(size, record.size() + 1), 'a' + i % 26);
+    record.back() = '\n';
+    records.push_back(record);
+    expect += record;
+  }
+
+  // listening after a few reconnects of the frontend, once a second
+  Sink sink(expect.size(), true, std::chrono::milliseconds(1500));
+  bool held              = send(records, 100, batch_size, sink);
+  const std::string &got = sink.Wait();
+  if (!held) {
+    std::cout << "batch " << batch_size
+              << ": the timer sent before the frontend could" << std::endl;
+    return false;
+  }
+  if (got != expect) {
+    size_t at = 0;
+    while (at < got.size() && at < expect.size() && got[at] == expect[at]) {
+      ++at;
+    }
+    std::cout << "batch " << batch_size << ": " << got.size() << " of "
+              << expect.size() << " bytes, otherwise from " << at
+              << std::endl;
+    return false;
+  }
+  std::cout << "  batch " << batch_size << ": " << records.size()
+            << " records whole and in order" << std::endl;
+  return true;
+}
+
+static void bench(size_t batch_size, size_t size, size_t n) {
+  std::string record(size - 1, 'x');
+  record += '\n';
+  std::vector<std::string> records(n, record);
+
+  Sink sink(size * n, false, std::chrono::milliseconds(0));
+  auto start = Clock::now();
+  send(records, 0, batch_size, sink);
+  sink.Wait();
+  std::chrono::duration<double> d = Clock::now() - start;
+  std::cout << "  batch " << batch_size << ": "
+            << static_cast<size_t>(n / d.count()) << " records/s, "
+            << n * size / d.count() / (1 << 20) << " MiB/s" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  size_t size    = argc > 1 ? std::stoul(argv[1]) : 300;
+  size_t records = argc > 2 ? std::stoul(argv[2]) : 1000000;
+
+  std::cout << "order:" << std::endl;
+  for (size_t batch : {256, 4096, 65536}) {
+    if (!check(batch)) {
+      return 1;
+    }
+  }
+
+  std::cout << "throughput, " << size << " byte records:" << std::endl;
+  for (size_t batch : {1, 4096, 16384, 65536, 262144}) {
+    bench(batch, size, records);
+  }
+  return 0;
+}
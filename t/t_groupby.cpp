@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "rapidjson/document.h"
+#include "fluorine/util/GroupBy.hpp"
+#include "fluorine/util/LRUCache.hpp"
+
+using namespace fluorine::util;
+using Document = rapidjson::Document;
+
+// Checks that groups are told apart by their whole key, all hashes equal
+// included, against a std::map, that windows are emitted whole once the
+// watermark passes them, and compares the memory and speed of the table
+// with documents kept under a hash of the terms, usage:
+//   t_groupby [lines [groups]]
+
+// every key in one probe sequence
+struct Colliding {
+  size_t operator()(const std::string &) const { return 42; }
+};
+
+struct Totals {
+  int64_t count_ = 0;
+  int64_t sum_   = 0;
+  double real_   = 0;
+  int64_t first_ = 0;
+};
+
+static std::string pack(const std::vector<std::string> &terms, int64_t n) {
+  std::string key;
+  KeyWriter writer(key);
+  for (auto &t : terms) {
+    writer.String(t);
+  }
+  writer.Int64(n);
+  return key;
+}
+
+// tuples that share their bytes once concatenated, or their text, differ
+static bool packing() {
+  std::string a, b;
+  KeyWriter wa(a), wb(b);
+  wa.String("ab");
+  wa.String("c");
+  wb.String("a");
+  wb.String("bc");
+  if (a == b) {
+    std::cout << "(ab, c) packs as (a, bc)" << std::endl;
+    return false;
+  }
+
+  std::vector<std::string> keys(5);
+  KeyWriter(keys[0]).Int64(1);
+  KeyWriter(keys[1]).Double(1.0);
+  KeyWriter(keys[2]).String("1");
+  KeyWriter(keys[3]).Null();
+  KeyWriter(keys[4]).String("");
+  for (size_t i = 0; i < keys.size(); ++i) {
+    for (size_t j = i + 1; j < keys.size(); ++j) {
+      if (keys[i] == keys[j]) {
+        std::cout << "keys " << i << " and " << j << " are equal" << std::endl;
+        return false;
+      }
+    }
+  }
+
+  std::string z, nz;
+  KeyWriter(z).Double(0.0);
+  KeyWriter(nz).Double(-0.0);
+  if (z != nz) {
+    std::cout << "-0.0 packs apart from 0.0" << std::endl;
+    return false;
+  }
+
+  std::string key;
+  KeyWriter writer(key);
+  writer.String(std::string("a\0b", 3));
+  writer.Int64(-7);
+  writer.Null();
+  writer.Double(2.5);
+  KeyReader reader(key);
+  Cell c[4];
+  boost::string_ref s[4];
+  for (int i = 0; i < 4; ++i) {
+    reader.Next(c[i], s[i]);
+  }
+  if (c[0].type_ != Type::String || s[0] != boost::string_ref("a\0b", 3) ||
+      c[1].type_ != Type::Int64 || c[1].int64_ != -7 ||
+      c[2].type_ != Type::Null || c[3].type_ != Type::Double ||
+      c[3].double_ != 2.5 || reader.Next(c[0], s[0])) {
+    std::cout << "terms read back otherwise" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// random lines over a few terms, the emitted groups adding up to what a
+// std::map of their keys counts, each group once while the table holds
+// them all
+template <class Hash>
+static bool exact(const char *name, size_t lines, size_t capacity) {
+  std::mt19937 rng(7);
+  const char *domains[] = {"a", "ab", "b", "", "abc"};
+  std::map<std::string, Totals> expect, got;
+  std::map<std::string, int> emitted;
+  bool twice = false;
+
+  GroupBy<Hash> groups({Fold::Sum, Fold::Sum, Fold::First}, capacity,
+                       [&](const std::string &key, int64_t count,
+                           const Cell *cells) {
+                         Totals &t = got[key];
+                         t.count_ += count;
+                         t.sum_ += cells[0].int64_;
+                         t.real_ += cells[1].double_;
+                         t.first_ = cells[2].int64_;
+                         twice    = twice || ++emitted[key] > 1;
+                       });
+  Cell cells[3];
+  for (size_t i = 0; i < lines; ++i) {
+    std::string key =
+        pack({domains[rng() % 5], domains[rng() % 5]}, rng() % 40);
+    cells[0] = Cell::Int64(rng() % 1000);
+    cells[1] = Cell::Double(0.5 * (rng() % 8));
+    cells[2] = Cell::Int64(i);
+    groups.Add(0, key, cells);
+
+    Totals &t = expect[key];
+    t.first_  = t.count_ ? t.first_ : i;
+    ++t.count_;
+    t.sum_ += cells[0].int64_;
+    t.real_ += cells[1].double_;
+  }
+  groups.Flush();
+
+  bool held = expect.size() <= capacity;
+  for (auto &e : expect) {
+    auto it = got.find(e.first);
+    if (it == got.end() || it->second.count_ != e.second.count_ ||
+        it->second.sum_ != e.second.sum_ ||
+        it->second.real_ != e.second.real_) {
+      std::cout << name << ": a group adds up otherwise" << std::endl;
+      return false;
+    }
+  }
+  if (got.size() != expect.size() || (held && twice)) {
+    std::cout << name << ": groups merged or split" << std::endl;
+    return false;
+  }
+  for (auto &e : expect) {
+    if (held && got[e.first].first_ != e.second.first_) {
+      std::cout << name << ": a group keeps another first line" << std::endl;
+      return false;
+    }
+  }
+  std::cout << "  " << name << ": " << expect.size() << " groups in "
+            << capacity << std::endl;
+  return true;
+}
+
+// lines of times running forward, each late by up to jitter seconds: with
+// the jitter within the lateness every group of a window is emitted once
+// and whole, past it the lines of closed windows are dropped and counted,
+// and the windows held stay bounded by the lateness
+static bool windows(const char *name, int64_t jitter, int64_t lateness) {
+  const int64_t interval = 10;
+  std::mt19937 rng(13);
+  std::map<std::string, Totals> expect, got;
+  bool twice  = false;
+  int64_t now = 1480391340, late = 0;
+  size_t held = 0, open = 0;
+
+  GroupBy<> groups({Fold::Sum}, 1 << 16,
+                   [&](const std::string &key, int64_t count,
+                       const Cell *cells) {
+                     Totals &t = got[key];
+                     twice     = twice || t.count_;
+                     t.count_  = count;
+                     t.sum_    = cells[0].int64_;
+                   },
+                   interval, lateness);
+  Cell cells[1];
+  for (size_t i = 0; i < 200000; ++i) {
+    now += rng() % 4 == 0;
+    int64_t time = now - static_cast<int64_t>(rng() % (jitter + 1));
+    std::string key;
+    KeyWriter writer(key);
+    writer.Int64(groups.WindowOf(time));
+    writer.Int64(rng() % 50);
+    cells[0] = Cell::Int64(rng() % 100);
+
+    if (!groups.Add(time, key, cells)) {
+      ++late;
+      continue;
+    }
+    Totals &t = expect[key];
+    ++t.count_;
+    t.sum_ += cells[0].int64_;
+    held = std::max(held, groups.Size());
+    open = std::max(open, groups.Windows());
+  }
+  groups.Flush();
+
+  if (twice || got.size() != expect.size() || groups.Early() ||
+      static_cast<int64_t>(groups.Late()) != late ||
+      (jitter <= lateness && late)) {
+    std::cout << name << ": a window emitted in parts, or lines dropped"
+              << std::endl;
+    return false;
+  }
+  for (auto &e : expect) {
+    if (got[e.first].count_ != e.second.count_ ||
+        got[e.first].sum_ != e.second.sum_) {
+      std::cout << name << ": a group adds up otherwise" << std::endl;
+      return false;
+    }
+  }
+  if (open > static_cast<size_t>(lateness / interval + 2)) {
+    std::cout << name << ": " << open << " windows held" << std::endl;
+    return false;
+  }
+  std::cout << "  " << name << ": " << expect.size() << " groups, " << late
+            << " late lines, at most " << open << " windows and " << held
+            << " groups held" << std::endl;
+  return true;
+}
+
+template <class T>
+inline void hash_combine(std::size_t &seed, const T &v) {
+  std::hash<T> hasher;
+  seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+}
+
+struct Line {
+  std::string domain_, uri_, country_;
+  int status_;
+  int64_t bytes_;
+};
+
+// a document per line, the first of a group kept under the hash of its
+// terms, as agg() had them
+static void documents(const std::vector<Line> &lines, size_t groups) {
+  using LRUType = LRUCache<size_t, std::unique_ptr<Document>>;
+  size_t emitted = 0, bytes = 0;
+  LRUType::OnAggregation oa = [](std::unique_ptr<Document> &lhs,
+                                 std::unique_ptr<Document> &rhs) {
+    rapidjson::Value &count = (*lhs)["count"];
+    count.SetInt64(count.GetInt64() + 1);
+    rapidjson::Value &l = (*lhs)["bytes"];
+    l.SetInt64(l.GetInt64() + (*rhs)["bytes"].GetInt64());
+  };
+  LRUType::OnInsert oi = [](std::unique_ptr<Document> &doc) {
+    doc->AddMember("count", int64_t(1), doc->GetAllocator());
+  };
+  LRUType::OnClear oc = [&](LRUType::map_type &m) {
+    for (auto &p : m) {
+      bytes += sizeof(Document) + p.second.first->GetAllocator().Capacity();
+      ++emitted;
+    }
+  };
+  LRUType lru(groups, oi, oa, nullptr, oc);
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto &line : lines) {
+    std::unique_ptr<Document> doc(new Document());
+    auto &a = doc->GetAllocator();
+    doc->SetObject();
+    doc->AddMember("domain", rapidjson::Value(line.domain_.c_str(), a), a);
+    doc->AddMember("uri", rapidjson::Value(line.uri_.c_str(), a), a);
+    doc->AddMember("country", rapidjson::Value(line.country_.c_str(), a), a);
+    doc->AddMember("status", line.status_, a);
+    doc->AddMember("bytes", line.bytes_, a);
+
+    size_t seed = 0;
+    hash_combine(seed, std::string((*doc)["domain"].GetString()));
+    hash_combine(seed, std::string((*doc)["uri"].GetString()));
+    hash_combine(seed, std::string((*doc)["country"].GetString()));
+    hash_combine(seed, (*doc)["status"].GetInt());
+    lru.insert(seed, std::move(doc));
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  lru.clear();
+
+  std::cout << "  documents: " << static_cast<size_t>(lines.size() / d.count())
+            << " lines/s, " << emitted << " groups, " << bytes / emitted
+            << " bytes a group" << std::endl;
+}
+
+static void table(const std::vector<Line> &lines, size_t groups) {
+  size_t emitted = 0;
+  GroupBy<> table(
+      {Fold::Sum}, groups,
+      [&](const std::string &, int64_t, const Cell *) { ++emitted; });
+
+  std::string key;
+  Cell cells[1];
+  auto start = std::chrono::steady_clock::now();
+  for (auto &line : lines) {
+    key.clear();
+    KeyWriter writer(key);
+    writer.String(line.domain_);
+    writer.String(line.uri_);
+    writer.String(line.country_);
+    writer.Int64(line.status_);
+    cells[0] = Cell::Int64(line.bytes_);
+    table.Add(0, key, cells);
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  size_t bytes = table.MemoryUsage();
+  table.Flush();
+
+  std::cout << "  exact keys: "
+            << static_cast<size_t>(lines.size() / d.count()) << " lines/s, "
+            << emitted << " groups, " << bytes / emitted << " bytes a group"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (!packing()) {
+    return 1;
+  }
+  std::cout << "exact groups:" << std::endl;
+  if (!exact<std::hash<std::string>>("hashed", 200000, 4096) ||
+      !exact<Colliding>("colliding", 20000, 4096) ||
+      !exact<std::hash<std::string>>("evicting", 200000, 50) ||
+      !exact<Colliding>("colliding and evicting", 20000, 50)) {
+    return 1;
+  }
+  std::cout << "windows:" << std::endl;
+  if (!windows("in order", 0, 0) || !windows("late within", 30, 30) ||
+      !windows("late past", 60, 20)) {
+    return 1;
+  }
+
+  size_t n      = argc > 1 ? std::stoul(argv[1]) : 2000000;
+  size_t groups = argc > 2 ? std::stoul(argv[2]) : 100000;
+
+  // uniform over the groups, most lines finding theirs
+  std::mt19937 rng(11);
+  std::vector<Line> lines(n);
+  for (auto &line : lines) {
+    uint32_t g    = rng() % groups;
+    line.domain_  = "www.example" + std::to_string(g % 97) + ".com";
+    line.uri_     = "/static/img/" + std::to_string(g) + ".png";
+    line.country_ = g % 3 ? "China" : "United States";
+    line.status_  = g % 5 ? 200 : 404;
+    line.bytes_   = rng() % 100000;
+  }
+
+  std::cout << groups << " groups, " << n << " lines:" << std::endl;
+  documents(lines, groups);
+  table(lines, groups);
+
+  return 0;
+}
@@ -0,0 +1,243 @@
+#include <zlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <iostream>
+
+#include "fluorine/util/Gzip.hpp"
+
+using namespace fluorine::util;
+
+// Checks GzipReader on gzip files made here, on 1 and 4 threads: the output
+// and what Read() returns for single, multi-member, BGZF, cut short and
+// corrupt files, and false member headers. Given a file, also compares it
+// with gzread on that file, usage:
+//   t_inflate [access.log.gz] [threads]
+
+// lines of base64 letters, deflating to about 3/4 of their size so the
+// multi-member files below make several chunks of GzipReader::kChunkSize
+static std::string text(size_t size) {
+  static const char letters[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out(size, '\n');
+  uint64_t x = 88172645463325252ull;
+  for (size_t i = 0; i < size; ++i) {
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    if (x % 97 != 0) {
+      out[i] = letters[x >> 58];
+    }
+  }
+  return out;
+}
+
+// a deflate stream of data, a gzip member when wbits asks for one, with a
+// full flush every flush bytes when flush is not 0
+static std::string deflated(const std::string &data, int level, int wbits,
+                            size_t flush) {
+  z_stream zs = z_stream();
+  deflateInit2(&zs, level, Z_DEFLATED, wbits, 8, Z_DEFAULT_STRATEGY);
+  std::string out(deflateBound(&zs, data.size()) + data.size() / 64 + 64,
+                  '\0');
+  zs.next_out  = reinterpret_cast<Bytef *>(&out[0]);
+  zs.avail_out = static_cast<uInt>(out.size());
+  size_t pos = 0;
+  do {
+    size_t n    = flush ? std::min(flush, data.size() - pos) : data.size();
+    zs.next_in  = reinterpret_cast<Bytef *>(const_cast<char *>(&data[pos]));
+    zs.avail_in = static_cast<uInt>(n);
+    pos += n;
+    deflate(&zs, pos == data.size() ? Z_FINISH : Z_FULL_FLUSH);
+  } while (pos < data.size());
+  out.resize(zs.total_out);
+  deflateEnd(&zs);
+  return out;
+}
+
+static std::string member(const std::string &data, int level = 1,
+                          size_t flush = 0) {
+  return deflated(data, level, 16 + MAX_WBITS, flush);
+}
+
+// members of data, each of part bytes
+static std::string members(const std::string &data, size_t part,
+                           size_t flush = 0) {
+  std::string out;
+  for (size_t pos = 0; pos < data.size(); pos += part) {
+    out += member(data.substr(pos, part), 1, flush);
+  }
+  return out;
+}
+
+static void little(std::string &out, uint32_t v, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    out += static_cast<char>(v >> (8 * i));
+  }
+}
+
+// the blocks bgzip writes: 0xff00 bytes per member, whose size is recorded
+// in a BC extra field, then the empty end of file member
+static std::string bgzf(const std::string &data) {
+  std::string out;
+  for (size_t pos = 0;; pos += 0xff00) {
+    std::string block = pos < data.size() ? data.substr(pos, 0xff00) : "";
+    std::string raw   = deflated(block, 1, -MAX_WBITS, 0);
+    out += std::string("\x1f\x8b\x08\x04\0\0\0\0\0\xff\x06\0BC\x02\0", 16);
+    little(out, static_cast<uint32_t>(18 + raw.size() + 8 - 1), 2);
+    out += raw;
+    little(out,
+           crc32(0, reinterpret_cast<const Bytef *>(block.data()),
+                 static_cast<uInt>(block.size())),
+           4);
+    little(out, static_cast<uint32_t>(block.size()), 4);
+    if (block.empty()) {
+      return out;
+    }
+  }
+}
+
+// Read() on a file holding gz, on 1 and 4 threads, has to return ok and
+// output expect, or only start with it when exact is false
+static bool check(const char *name, const std::string &gz,
+                  const std::string &expect, bool ok, bool exact = true) {
+  std::string path = "/tmp/t_inflate." + std::to_string(getpid()) + ".gz";
+  std::ofstream(path, std::ios_base::binary | std::ios_base::trunc) << gz;
+
+  bool passed = true;
+  for (size_t threads : {1, 4}) {
+    std::string output;
+    GzipReader reader(threads);
+    bool read = reader.Read(path, [&output](const char *data, size_t size) {
+      output.append(data, size);
+    });
+
+    bool same = exact ? output == expect
+                      : output.compare(0, expect.size(), expect) == 0;
+    if (read != ok || !same) {
+      std::cout << name << " on " << threads << " threads: Read() returned "
+                << read << ", " << output.size() << " bytes, expected " << ok
+                << ", " << expect.size() << " bytes" << std::endl;
+      passed = false;
+    }
+  }
+
+  unlink(path.c_str());
+  return passed;
+}
+
+// Compares gzread with GzipReader on a file
+static bool compare(const char *path, size_t threads) {
+  auto start = std::chrono::steady_clock::now();
+  gzFile in  = gzopen(path, "rb");
+  if (in == nullptr) {
+    std::cout << "cannot open: " << path << std::endl;
+    return false;
+  }
+  std::string expected(1 << 20, '\0');
+  size_t used = 0;
+  int n;
+  while ((n = gzread(in, &expected[used], expected.size() - used)) > 0) {
+    used += n;
+    if (used == expected.size()) {
+      expected.resize(expected.size() * 2);
+    }
+  }
+  gzclose(in);
+  expected.resize(used);
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << "gzread: " << expected.size() / d.count() / 1048576
+            << " MiB/s" << std::endl;
+
+  start = std::chrono::steady_clock::now();
+  GzipReader reader(threads);
+  std::string output;
+  bool ok = reader.Read(path, [&output](const char *data, size_t size) {
+    output.append(data, size);
+  });
+  d = std::chrono::steady_clock::now() - start;
+  std::cout << "GzipReader(" << threads
+            << "): " << output.size() / d.count() / 1048576 << " MiB/s"
+            << std::endl;
+
+  if (!ok || n < 0 || output != expected) {
+    std::cout << "output mismatch" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  bool passed = true;
+  std::string data = text(12 << 20);
+  std::string part = data.substr(0, 1 << 20);
+
+  passed &= check("single member", member(data), data, true);
+  passed &= check("single member, full flushes", member(data, 1, 65536),
+                  data, true);
+  passed &= check("members, full flushes", members(data, 1 << 20, 65536),
+                  data, true);
+  passed &= check("members of all sizes",
+                  member(part) + member("") + member(data.substr(0, 5 << 20)) +
+                      member("x") + member(data),
+                  part + data.substr(0, 5 << 20) + "x" + data, true);
+  passed &= check("trailing zeros", members(data, 1 << 20) + std::string(64, 0),
+                  data, true);
+
+  // headers for splits inside stored deflate data, after real members
+  std::string fake("\x1f\x8b\x08\0\0\0\0\0\0\x03", 10), faked = data;
+  for (size_t pos = 3 << 20; pos + 64 < faked.size(); pos += 300 << 10) {
+    faked.replace(pos, fake.size(), fake);
+  }
+  passed &= check("false member headers",
+                  members(data, 1 << 20) + member(faked, 0) +
+                      members(part, 256 << 10),
+                  data + faked + part, true);
+
+  std::string blocks = bgzf(data);
+  size_t found       = FindGzipMembers(
+                     reinterpret_cast<const unsigned char *>(blocks.data()),
+                     blocks.size())
+                     .size();
+  if (found != (data.size() + 0xff00 - 1) / 0xff00 + 1) {
+    std::cout << "bgzf: " << found << " members found" << std::endl;
+    passed = false;
+  }
+  passed &= check("bgzf", blocks, data, true);
+
+  std::string odd = members(data, 1 << 20);
+  odd[8] = 0x55;
+  odd[9] = static_cast<char>(0x80);
+  passed &= check("odd XFL and OS on the first member", odd, data, true);
+
+  // a file cut short fails after what its complete members hold
+  std::string whole = members(data, 1 << 20), last = member(part);
+  passed &= check("cut in the deflate data",
+                  whole + last.substr(0, last.size() / 2), data, false, false);
+  passed &= check("cut in the trailer", whole + last.substr(0, last.size() - 3),
+                  data + part, false);
+  passed &= check("cut in a header", whole + last.substr(0, 5), data, false);
+  passed &= check("cut in the first member", whole.substr(0, 1 << 20),
+                  std::string(), false, false);
+
+  std::string crc = whole + last;
+  crc[crc.size() - 6] ^= 1;
+  passed &= check("corrupt crc", crc, data + part, false);
+  std::string broken = whole + last;
+  for (size_t i = 0; i < 64; ++i) {
+    broken[whole.size() + 16 + i] = static_cast<char>(0xff);
+  }
+  passed &= check("corrupt deflate data", broken, data, false, false);
+
+  if (argc > 1) {
+    passed &= compare(argv[1], argc > 2 ? std::atoi(argv[2]) : 4);
+  }
+
+  if (!passed) {
+    return 1;
+  }
+  std::cout << "all gzip files read as expected" << std::endl;
+  return 0;
+}
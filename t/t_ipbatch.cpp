@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine::util;
+
+// Checks the batch Lookup and Resolve against one address at a time, and
+// compares their throughput on addresses spread over the whole space, no
+// two in a row near each other in the index, usage:
+//   t_ipbatch 17monipdb.dat [lookups]
+
+static std::string dotted(uint32_t ip) {
+  return std::to_string(ip >> 24) + "." + std::to_string((ip >> 16) & 0xFF) +
+         "." + std::to_string((ip >> 8) & 0xFF) + "." +
+         std::to_string(ip & 0xFF);
+}
+
+template <typename F>
+static double bench(const char *name, size_t n, F f) {
+  auto start = std::chrono::steady_clock::now();
+  size_t sum = f();
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << "  " << name << ": " << static_cast<size_t>(n / d.count())
+            << " lookups/s (" << sum << ")" << std::endl;
+  return n / d.count();
+}
+
+// batches of every size up to a few groups, of addresses, malformed text
+// and IPv6, each result the one Resolve() gives, or unknown where it fails
+static bool same(IPResolver &resolver, size_t cases) {
+  std::mt19937 rng(3);
+  const char *odd[] = {"", "1.2.3", "256.1.1.1", "::ffff:1.2.3.4", "::1",
+                       "1::2::3", "10.0.0.1 trailing"};
+  for (size_t c = 0; c < cases; ++c) {
+    size_t n = rng() % 150;
+    std::vector<std::string> texts;
+    for (size_t i = 0; i < n; ++i) {
+      texts.push_back(rng() % 8 ? dotted(rng())
+                                : odd[rng() % (sizeof(odd) / sizeof(odd[0]))]);
+    }
+
+    std::vector<boost::string_ref> ips(texts.begin(), texts.end());
+    std::vector<IPResolver::LRUValueType> got(n);
+    resolver.Resolve(ips.data(), n, got.data());
+    for (size_t i = 0; i < n; ++i) {
+      IPResolver::LRUValueType expect;
+      if (!resolver.Resolve(texts[i], expect)) {
+        expect = IPResolver::UnknownResult;
+      }
+      if (got[i] != expect) {
+        std::cout << "batch differs for [" << texts[i] << "]" << std::endl;
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0] << " <ipdb> [lookups]" << std::endl;
+    return 1;
+  }
+  size_t n = argc > 2 ? std::stoul(argv[2]) : 4000000;
+
+  IPResolver resolver(argv[1]);
+  if (!same(resolver, 20000)) {
+    return 1;
+  }
+  std::cout << "batches match" << std::endl;
+
+  std::mt19937 rng(5);
+  std::vector<uint32_t> ips(n);
+  std::vector<std::string> texts(n);
+  for (size_t i = 0; i < n; ++i) {
+    ips[i]   = rng();
+    texts[i] = dotted(ips[i]);
+  }
+
+  std::cout << resolver.Ranges() << " ranges, uniform addresses:" << std::endl;
+  double one = bench("Lookup", n, [&]() {
+    size_t sum = 0;
+    for (auto ip : ips) {
+      sum += (*resolver.Lookup(ip))[0].size();
+    }
+    return sum;
+  });
+  double batch = bench("batch Lookup", n, [&]() {
+    const size_t kBlock = 1024;
+    std::vector<IPResolver::LRUValueType> records(kBlock);
+    size_t sum = 0;
+    for (size_t i = 0; i < n; i += kBlock) {
+      size_t m = std::min(kBlock, n - i);
+      resolver.Lookup(ips.data() + i, m, records.data());
+      for (size_t j = 0; j < m; ++j) {
+        sum += (*records[j])[0].size();
+      }
+    }
+    return sum;
+  });
+  std::cout << "  " << batch / one << "x" << std::endl;
+
+  one = bench("Resolve", n, [&]() {
+    size_t sum = 0;
+    IPResolver::LRUValueType result;
+    for (auto &text : texts) {
+      resolver.Resolve(text, result);
+      sum += (*result)[0].size();
+    }
+    return sum;
+  });
+  batch = bench("batch Resolve", n, [&]() {
+    const size_t kBlock = 1024;
+    std::vector<boost::string_ref> block(kBlock);
+    std::vector<IPResolver::LRUValueType> results(kBlock);
+    size_t sum = 0;
+    for (size_t i = 0; i < n; i += kBlock) {
+      size_t m = std::min(kBlock, n - i);
+      std::copy(texts.begin() + i, texts.begin() + i + m, block.begin());
+      resolver.Resolve(block.data(), m, results.data());
+      for (size_t j = 0; j < m; ++j) {
+        sum += (*results[j])[0].size();
+      }
+    }
+    return sum;
+  });
+  std::cout << "  " << batch / one << "x" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include <boost/spirit/include/qi.hpp>
+
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine::util;
+namespace qi = boost::spirit::qi;
+
+// Checks the flattened IPv4 index and the address parser against the
+// resolver they replaced, and compares their speed on uniformly random and
+// on skewed address streams, usage:
+//   t_ipdb 17monipdb.dat [lookups]
+
+#define B2IL(b)                                                               \
+  (((b)[0] & 0xFF) | (((b)[1] << 8) & 0xFF00) | (((b)[2] << 16) & 0xFF0000) | \
+   (((b)[3] << 24) & 0xFF000000))
+
+#define B2IU(b)                                                               \
+  (((b)[3] & 0xFF) | (((b)[2] << 8) & 0xFF00) | (((b)[1] << 16) & 0xFF0000) | \
+   (((b)[0] << 24) & 0xFF000000))
+
+// the lookup IPResolver did on a cache miss: Spirit, a binary search over
+// the big-endian index and a record split into a new vector
+class Reference {
+public:
+  explicit Reference(const std::string &db) : data_(db) {
+    const unsigned char *d = bytes();
+    offset_ = B2IU(d);
+    index_  = d + 4;
+    flag_   = reinterpret_cast<const uint32_t *>(index_);
+  }
+
+  bool Parse(const std::string &ip, uint32_t &addr) {
+    std::vector<uint8_t> ips;
+    ips.reserve(4);
+    if (!qi::parse(ip.begin(), ip.end(), g_, ips)) {
+      return false;
+    }
+    addr = B2IU(ips);
+    return true;
+  }
+
+  bool Resolve(const std::string &ip, std::vector<std::string> &fields) {
+    uint32_t addr;
+    return Parse(ip, addr) && Resolve(addr, fields);
+  }
+
+  bool Resolve(uint32_t ip, std::vector<std::string> &fields) {
+    char buf[256];
+    uint32_t lo = flag_[ip >> 24] * 8 + 1024;
+    uint32_t hi = offset_ - 1028;
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 16 * 8;
+      if (B2IU(index_ + mid) < ip) {
+        lo = mid + 8;
+      } else {
+        hi = mid;
+      }
+    }
+
+    uint32_t offset = B2IL(index_ + lo + 4) & 0x00FFFFFF;
+    uint32_t length = index_[lo + 7];
+    memcpy(buf, bytes() + offset_ + offset - 1024, length);
+    buf[length] = '\0';
+
+    fields.clear();
+    char *s = buf, *e = buf;
+    while (*e && fields.size() < 5) {
+      if (*e == '\t') {
+        fields.emplace_back(s, e);
+        s = e + 1;
+      }
+      ++e;
+    }
+    if (fields.size() < 5) {
+      fields.emplace_back(s, e);
+    }
+    return true;
+  }
+
+  size_t Ranges() const { return (offset_ - 1028 - 1024) / 8; }
+  uint32_t End(size_t i) const { return B2IU(index_ + 1024 + i * 8); }
+
+private:
+  const unsigned char *bytes() const {
+    return reinterpret_cast<const unsigned char *>(data_.data());
+  }
+
+  struct Grammar : qi::grammar<std::string::const_iterator,
+                               std::vector<uint8_t>()> {
+    Grammar() : Grammar::base_type(ip) {
+      qi::uint_parser<uint8_t, 10, 1, 3> uint8_p;
+      ip = uint8_p >> '.' >> uint8_p >> '.' >> uint8_p >> '.' >> uint8_p;
+    }
+    qi::rule<std::string::const_iterator, std::vector<uint8_t>()> ip;
+  };
+
+  std::string data_;
+  uint32_t offset_;
+  const unsigned char *index_;
+  const uint32_t *flag_;
+  Grammar g_;
+};
+
+static std::string dotted(uint32_t ip) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", ip >> 24, (ip >> 16) & 0xFF,
+           (ip >> 8) & 0xFF, ip & 0xFF);
+  return buf;
+}
+
+// the fields of a record as strings
+static std::vector<std::string> strings(const IPResolver::ResultType &record) {
+  std::vector<std::string> out;
+  for (auto &field : record) {
+    out.push_back(field.to_string());
+  }
+  return out;
+}
+
+static bool same(Reference &ref, IPResolver &resolver, uint32_t ip) {
+  std::vector<std::string> expect;
+  ref.Resolve(ip, expect);
+  expect.resize(IPResolver::FieldNumber);
+  if (expect != strings(*resolver.Lookup(ip))) {
+    std::cout << "mismatch for " << dotted(ip) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// random text near dotted quads, parsed by the grammar and by ParseIPv4
+static bool parses(Reference &ref, size_t cases) {
+  const char alphabet[] = "0123456789...255x ";
+  std::mt19937 rng(3);
+  for (size_t i = 0; i < cases; ++i) {
+    std::string ip(rng() % 20, ' ');
+    for (auto &c : ip) {
+      c = alphabet[rng() % (sizeof(alphabet) - 1)];
+    }
+
+    uint32_t expect = 0, got = 0;
+    bool ok1 = ref.Parse(ip, expect);
+    bool ok2 = IPResolver::ParseIPv4(ip.data(), ip.data() + ip.size(), got);
+    if (ok1 != ok2 || expect != got) {
+      std::cout << "parse mismatch for [" << ip << "]" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename F>
+static void bench(const char *name, const std::vector<std::string> &ips,
+                  F f) {
+  auto start   = std::chrono::steady_clock::now();
+  size_t bytes = 0;
+  for (auto &ip : ips) {
+    bytes += f(ip);
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << "  " << name << ": "
+            << static_cast<size_t>(ips.size() / d.count()) << " lookups/s ("
+            << bytes << ")" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0] << " <ipdb> [lookups]" << std::endl;
+    return 1;
+  }
+  size_t n = argc > 2 ? std::stoul(argv[2]) : 2000000;
+
+  std::ifstream is(argv[1], std::ios::binary);
+  std::string db((std::istreambuf_iterator<char>(is)),
+                 std::istreambuf_iterator<char>());
+  Reference ref(db);
+  IPResolver resolver(db.data(), db.size());
+  std::cout << resolver.Ranges() << " ranges, " << resolver.Records()
+            << " distinct records" << std::endl;
+
+  // both sides of every range boundary, then random addresses
+  for (size_t i = 0; i < ref.Ranges(); ++i) {
+    uint32_t end = ref.End(i);
+    if (!same(ref, resolver, end) ||
+        (end != UINT32_MAX && !same(ref, resolver, end + 1))) {
+      return 1;
+    }
+  }
+  std::mt19937 rng(7);
+  for (size_t i = 0; i < 1000000; ++i) {
+    if (!same(ref, resolver, rng())) {
+      return 1;
+    }
+  }
+  std::cout << "flat index matches" << std::endl;
+
+  if (!parses(ref, 2000000)) {
+    return 1;
+  }
+  std::cout << "parser matches" << std::endl;
+
+  std::vector<std::string> uniform, skewed;
+  for (size_t i = 0; i < n; ++i) {
+    uniform.push_back(dotted(rng()));
+  }
+  // a few thousand hot clients, zipf-like
+  std::vector<uint32_t> hot(10000);
+  for (auto &ip : hot) {
+    ip = rng();
+  }
+  std::discrete_distribution<size_t> zipf(
+      hot.size(), 0, hot.size(), [](double x) { return 1 / (x + 1); });
+  for (size_t i = 0; i < n; ++i) {
+    skewed.push_back(dotted(hot[zipf(rng)]));
+  }
+
+  for (auto stream : {std::make_pair("uniform", &uniform),
+                      std::make_pair("skewed", &skewed)}) {
+    std::cout << stream.first << ":" << std::endl;
+    auto &ips = *stream.second;
+    bench("reference", ips, [&ref](const std::string &ip) {
+      std::vector<std::string> fields;
+      ref.Resolve(ip, fields);
+      return fields[0].size();
+    });
+
+    IPResolver cached(db.data(), db.size());
+    bench("Resolve", ips, [&cached](const std::string &ip) {
+      IPResolver::LRUValueType result;
+      cached.Resolve(ip, result);
+      return (*result)[0].size();
+    });
+
+    std::vector<uint32_t> ints;
+    for (auto &ip : ips) {
+      std::vector<std::string> fields;
+      unsigned a, b, c, d;
+      sscanf(ip.c_str(), "%u.%u.%u.%u", &a, &b, &c, &d);
+      ints.push_back(a << 24 | b << 16 | c << 8 | d);
+    }
+    auto start   = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (auto ip : ints) {
+      bytes += (*resolver.Lookup(ip))[0].size();
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    std::cout << "  Lookup: " << static_cast<size_t>(ints.size() / d.count())
+              << " lookups/s (" << bytes << ")" << std::endl;
+  }
+
+  return 0;
+}
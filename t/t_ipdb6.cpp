@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine::util;
+
+// Generates an IPv6 range database, checks the resolver's index against a
+// plain search of the ranges and its parser against inet_pton, and compares
+// IPv4 and IPv6 lookups, usage:
+//   t_ipdb6 17monipdb.dat [ranges [lookups [out.db6]]]
+// the generated database is written to out.db6 when given, for --db6
+
+struct Range {
+  IPv6 first_;
+  IPv6 last_;
+  std::string record_;
+};
+
+static std::string text(const IPv6 &ip) {
+  unsigned char bytes[16];
+  for (int i = 0; i < 8; ++i) {
+    bytes[i]     = static_cast<unsigned char>(ip.hi_ >> (56 - 8 * i));
+    bytes[i + 8] = static_cast<unsigned char>(ip.lo_ >> (56 - 8 * i));
+  }
+  char buf[INET6_ADDRSTRLEN];
+  inet_ntop(AF_INET6, bytes, buf, sizeof(buf));
+  return buf;
+}
+
+// prefixes of /29 to /64 in the blocks the registries allocate from, with
+// a few hundred distinct records
+static std::vector<Range> generate(size_t n, std::mt19937_64 &rng) {
+  const uint64_t blocks[] = {0x2001, 0x2400, 0x2401, 0x2402, 0x2403, 0x2404,
+                             0x2600, 0x2601, 0x2602, 0x2603, 0x2604, 0x2605,
+                             0x2800, 0x2a00, 0x2a01, 0x2a02, 0x2a03, 0x2c0f};
+  std::vector<Range> ranges;
+  for (size_t i = 0; i < n * 2; ++i) {
+    int length  = 29 + rng() % 36;
+    uint64_t hi = blocks[rng() % (sizeof(blocks) / sizeof(blocks[0]))] << 48 |
+                  (rng() & 0xFFFFFFFFFFFFULL);
+    uint64_t host = length == 64 ? 0 : UINT64_MAX >> length;
+    Range r;
+    r.first_  = {hi & ~host, 0};
+    r.last_   = {hi | host, UINT64_MAX};
+    size_t id = rng() % 300;
+    r.record_ = "country" + std::to_string(id % 40) + "\tprovince" +
+                std::to_string(id % 90) + "\tcity" + std::to_string(id) +
+                "\t\tisp" + std::to_string(id % 7);
+    ranges.push_back(r);
+  }
+
+  // nested and overlapping prefixes are dropped
+  std::sort(ranges.begin(), ranges.end(), [](const Range &a, const Range &b) {
+    return a.first_ < b.first_;
+  });
+  std::vector<Range> disjoint;
+  for (auto &r : ranges) {
+    if (disjoint.empty() || disjoint.back().last_ < r.first_) {
+      disjoint.push_back(r);
+    }
+  }
+  if (disjoint.size() > n) {
+    disjoint.resize(n);
+  }
+  return disjoint;
+}
+
+// the fields of a record as strings
+static std::vector<std::string> strings(const IPResolver::ResultType &record) {
+  std::vector<std::string> out;
+  for (auto &field : record) {
+    out.push_back(field.to_string());
+  }
+  return out;
+}
+
+static std::vector<std::string> fields(const std::vector<Range> &ranges,
+                                       const IPv6 &ip) {
+  auto it = std::upper_bound(
+      ranges.begin(), ranges.end(), ip,
+      [](const IPv6 &ip, const Range &r) { return ip < r.first_; });
+  if (it == ranges.begin() || (--it)->last_ < ip) {
+    return strings(*IPResolver::UnknownResult);
+  }
+
+  std::vector<std::string> out;
+  size_t start = 0, tab;
+  while ((tab = it->record_.find('\t', start)) != std::string::npos) {
+    out.push_back(it->record_.substr(start, tab - start));
+    start = tab + 1;
+  }
+  out.push_back(it->record_.substr(start));
+  out.resize(IPResolver::FieldNumber);
+  return out;
+}
+
+static bool same(const std::vector<Range> &ranges, IPResolver &resolver,
+                 const IPv6 &ip) {
+  if (fields(ranges, ip) != strings(*resolver.Lookup(ip))) {
+    std::cout << "mismatch for " << text(ip) << std::endl;
+    return false;
+  }
+
+  IPResolver::LRUValueType result;
+  if (!resolver.Resolve(text(ip), result) || result != resolver.Lookup(ip)) {
+    std::cout << "Resolve differs for " << text(ip) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static IPv6 inside(const Range &r, std::mt19937_64 &rng) {
+  uint64_t span = r.last_.hi_ - r.first_.hi_;
+  return {r.first_.hi_ + (span == UINT64_MAX ? rng() : rng() % (span + 1)),
+          rng()};
+}
+
+// random text and edited addresses, parsed by inet_pton and by ParseIPv6
+static bool parses(const std::vector<Range> &ranges, size_t cases,
+                   std::mt19937_64 &rng) {
+  const char alphabet[] = "0123456789abcdefABCDEF::::...g";
+  for (size_t i = 0; i < cases; ++i) {
+    std::string ip;
+    if (i % 2) {
+      ip.resize(rng() % 48);
+      for (auto &c : ip) {
+        c = alphabet[rng() % (sizeof(alphabet) - 1)];
+      }
+    } else {
+      ip = text(ranges[rng() % ranges.size()].first_);
+      if (rng() % 4 == 0) {
+        ip = "::ffff:" + std::to_string(rng() % 300) + ".1.02.3";
+      }
+      for (int edits = rng() % 3; edits > 0 && !ip.empty(); --edits) {
+        ip[rng() % ip.size()] = alphabet[rng() % (sizeof(alphabet) - 1)];
+      }
+    }
+
+    unsigned char bytes[16] = {0};
+    IPv6 expect = {0, 0}, got = {0, 0};
+    bool ok1 = inet_pton(AF_INET6, ip.c_str(), bytes) == 1;
+    for (int j = 0; j < 8; ++j) {
+      expect.hi_ = expect.hi_ << 8 | bytes[j];
+      expect.lo_ = expect.lo_ << 8 | bytes[j + 8];
+    }
+    bool ok2 = IPResolver::ParseIPv6(ip.data(), ip.data() + ip.size(), got);
+    if (ok1 != ok2 || (ok1 && !(expect == got))) {
+      std::cout << "parse mismatch for [" << ip << "]" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T, typename F>
+static void bench(const char *name, const std::vector<T> &ips, F f) {
+  auto start   = std::chrono::steady_clock::now();
+  size_t bytes = 0;
+  for (auto &ip : ips) {
+    bytes += f(ip);
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << "  " << name << ": "
+            << static_cast<size_t>(ips.size() / d.count()) << " lookups/s ("
+            << bytes << ")" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0]
+              << " <ipdb> [ranges [lookups [out.db6]]]" << std::endl;
+    return 1;
+  }
+  size_t count = argc > 2 ? std::stoul(argv[2]) : 200000;
+  size_t n     = argc > 3 ? std::stoul(argv[3]) : 2000000;
+
+  std::mt19937_64 rng(11);
+  std::vector<Range> ranges = generate(count, rng);
+  std::string db = "# first\tlast\tcountry\tprovince\tcity\t\tisp\n";
+  for (auto &r : ranges) {
+    db += text(r.first_) + "\t" + text(r.last_) + "\t" + r.record_ + "\n";
+  }
+  if (argc > 4) {
+    std::ofstream(argv[4], std::ios::binary) << db;
+  }
+
+  IPResolver resolver(argv[1]);
+  if (!resolver.LoadIPv6(db.data(), db.size())) {
+    return 1;
+  }
+  std::cout << ranges.size() << " generated ranges, " << resolver.Ranges6()
+            << " in the index" << std::endl;
+
+  // both sides of every range boundary, inside the ranges and anywhere
+  for (auto &r : ranges) {
+    const IPv6 before = {r.first_.lo_ ? r.first_.hi_ : r.first_.hi_ - 1,
+                         r.first_.lo_ - 1};
+    const IPv6 after  = {r.last_.lo_ == UINT64_MAX ? r.last_.hi_ + 1
+                                                   : r.last_.hi_,
+                        r.last_.lo_ + 1};
+    if (!same(ranges, resolver, r.first_) || !same(ranges, resolver, before) ||
+        !same(ranges, resolver, r.last_) || !same(ranges, resolver, after) ||
+        !same(ranges, resolver, inside(r, rng))) {
+      return 1;
+    }
+  }
+  for (size_t i = 0; i < 200000; ++i) {
+    if (!same(ranges, resolver, {rng(), rng()})) {
+      return 1;
+    }
+  }
+
+  // IPv4-mapped addresses resolve as IPv4, malformed ones fail
+  IPResolver::LRUValueType result;
+  if (!resolver.Resolve("::ffff:1.2.3.4", result) ||
+      result != resolver.Lookup(0x01020304) ||
+      resolver.Resolve("1::2::3", result) ||
+      resolver.Resolve("2001:db8::1 ", result)) {
+    std::cout << "mapped or malformed address differs" << std::endl;
+    return 1;
+  }
+
+  // a line out of order is rejected, the loaded index stays
+  std::string bad = db + text(ranges[0].first_) + "\t" +
+                    text(ranges[0].last_) + "\tx\n";
+  if (resolver.LoadIPv6(bad.data(), bad.size()) ||
+      !same(ranges, resolver, ranges[1].first_)) {
+    std::cout << "unsorted database accepted" << std::endl;
+    return 1;
+  }
+  std::cout << "ipv6 index matches" << std::endl;
+
+  if (!parses(ranges, 2000000, rng)) {
+    return 1;
+  }
+  std::cout << "parser matches" << std::endl;
+
+  std::vector<uint32_t> v4;
+  std::vector<IPv6> v6;
+  for (size_t i = 0; i < n; ++i) {
+    v4.push_back(static_cast<uint32_t>(rng()));
+    v6.push_back(inside(ranges[rng() % ranges.size()], rng));
+  }
+
+  bench("IPv4 Lookup", v4, [&resolver](uint32_t ip) {
+    return (*resolver.Lookup(ip))[0].size();
+  });
+  bench("IPv6 Lookup", v6, [&resolver](const IPv6 &ip) {
+    return (*resolver.Lookup(ip))[0].size();
+  });
+
+  std::vector<std::string> v4text, v6text;
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t ip = v4[i];
+    v4text.push_back(std::to_string(ip >> 24) + "." +
+                     std::to_string((ip >> 16) & 0xFF) + "." +
+                     std::to_string((ip >> 8) & 0xFF) + "." +
+                     std::to_string(ip & 0xFF));
+    v6text.push_back(text(v6[i]));
+  }
+  bench("IPv4 Resolve", v4text, [&resolver](const std::string &ip) {
+    IPResolver::LRUValueType result;
+    resolver.Resolve(ip, result);
+    return (*result)[0].size();
+  });
+  bench("IPv6 Resolve", v6text, [&resolver](const std::string &ip) {
+    IPResolver::LRUValueType result;
+    resolver.Resolve(ip, result);
+    return (*result)[0].size();
+  });
+
+  return 0;
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine::util;
+
+// Resolves addresses through one resolver from 1 up to threads threads,
+// checking every result against Lookup(), and prints how lookups/s scale,
+// usage:
+//   t_ipthreads 17monipdb.dat [threads [lookups]]
+
+static std::string dotted(uint32_t ip) {
+  return std::to_string(ip >> 24) + "." + std::to_string((ip >> 16) & 0xFF) +
+         "." + std::to_string((ip >> 8) & 0xFF) + "." +
+         std::to_string(ip & 0xFF);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0] << " <ipdb> [threads [lookups]]"
+              << std::endl;
+    return 1;
+  }
+  int threads = argc > 2 ? std::stoi(argv[2]) : 8;
+  size_t n    = argc > 3 ? std::stoul(argv[3]) : 1000000;
+
+  IPResolver resolver(argv[1]);
+
+  // a hot set the cache holds and a tail missing it, per thread
+  std::vector<std::vector<uint32_t>> ips(threads);
+  std::vector<std::vector<std::string>> texts(threads);
+  for (int t = 0; t < threads; ++t) {
+    std::mt19937 rng(t);
+    std::geometric_distribution<uint32_t> skew(1.0 / 20000);
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t ip = i % 4 ? 0x0A000000 + skew(rng) : rng();
+      ips[t].push_back(ip);
+      texts[t].push_back(dotted(ip));
+    }
+  }
+
+  double single = 0;
+  for (int k = 1; k <= threads; k *= 2) {
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < k; ++t) {
+      workers.emplace_back([&, t]() {
+        IPResolver::LRUValueType result;
+        for (size_t i = 0; i < n; ++i) {
+          if (!resolver.Resolve(texts[t][i], result) ||
+              result != resolver.Lookup(ips[t][i])) {
+            failed = true;
+            return;
+          }
+        }
+      });
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+
+    if (failed) {
+      std::cout << "a result differs from Lookup() with " << k << " threads"
+                << std::endl;
+      return 1;
+    }
+    double rate = k * n / d.count();
+    single      = k == 1 ? rate : single;
+    std::cout << "  " << k << " threads: " << static_cast<size_t>(rate)
+              << " lookups/s, " << rate / single << "x" << std::endl;
+  }
+
+  std::cout << std::thread::hardware_concurrency() << " hardware threads"
+            << std::endl;
+  return 0;
+}
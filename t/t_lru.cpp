@@ -0,0 +1,236 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+#include <memory>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include <boost/optional.hpp>
+
+#include "fluorine/util/LRUCache.hpp"
+
+using namespace fluorine::util;
+
+// Checks the open-addressing LRUCache against the std::map and std::list
+// cache it replaced and compares their speed on the resolver's get/insert
+// pattern and on the aggregation's insert pattern, usage:
+//   t_lru [operations]
+
+// the cache LRUCache was before
+template <class Key, class Value>
+class Reference {
+public:
+  typedef std::list<Key> list_type;
+  typedef std::map<Key, std::pair<Value, typename list_type::iterator>>
+      map_type;
+
+  Reference(size_t capacity, std::function<void(Value &)> oe = nullptr,
+            std::function<void(Value &, Value &)> oa = nullptr)
+      : capacity_(capacity), oe_(oe), oa_(oa) {}
+
+  void insert(const Key &key, Value value) {
+    auto i = map_.find(key);
+    if (i == map_.end()) {
+      if (map_.size() >= capacity_) {
+        auto j = --list_.end();
+        if (oe_) {
+          oe_(map_[*j].first);
+        }
+        map_.erase(*j);
+        list_.erase(j);
+      }
+      list_.push_front(key);
+      map_[key] = std::make_pair(std::move(value), list_.begin());
+    } else if (oa_) {
+      oa_(i->second.first, value);
+    }
+  }
+
+  boost::optional<Value> get(const Key &key) {
+    auto i = map_.find(key);
+    if (i == map_.end()) {
+      return boost::none;
+    }
+    auto j = i->second.second;
+    if (j != list_.begin()) {
+      list_.erase(j);
+      list_.push_front(key);
+      j                  = list_.begin();
+      const Value &value = i->second.first;
+      map_[key]          = std::make_pair(value, j);
+      return value;
+    }
+    return i->second.first;
+  }
+
+  map_type &map() { return map_; }
+
+private:
+  map_type map_;
+  list_type list_;
+  size_t capacity_;
+  std::function<void(Value &)> oe_;
+  std::function<void(Value &, Value &)> oa_;
+};
+
+// random inserts and gets over a few key ranges and capacities, comparing
+// every get, eviction and aggregation and the entries left at the end
+static bool same(size_t cases) {
+  std::mt19937 rng(7);
+  for (size_t capacity : {1, 2, 3, 7, 64, 1000}) {
+    std::vector<int> expect, got;
+    Reference<int, int> ref(capacity, [&](int &v) { expect.push_back(v); },
+                            [&](int &l, int &r) { l += r; });
+    LRUCache<int, int> lru(capacity, nullptr,
+                           [&](int &l, int &r) { l += r; },
+                           [&](int &v) { got.push_back(v); });
+
+    std::uniform_int_distribution<int> key(0, static_cast<int>(capacity * 3));
+    for (size_t i = 0; i < cases; ++i) {
+      int k = key(rng);
+      if (rng() % 2) {
+        ref.insert(k, k * 1000);
+        lru.insert(k, k * 1000);
+      } else if (ref.get(k) != lru.get(k)) {
+        std::cout << "get " << k << " differs at capacity " << capacity
+                  << std::endl;
+        return false;
+      }
+    }
+
+    bool kept = lru.size() == ref.map().size();
+    for (auto &p : ref.map()) {
+      kept = kept && lru.contains(p.first);
+    }
+    if (expect != got || !kept) {
+      std::cout << "evictions or entries differ at capacity " << capacity
+                << std::endl;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// clear() hands over the entries from the least to the most recently used
+// and releases them
+static bool cleared() {
+  std::vector<int> order;
+  std::shared_ptr<int> value = std::make_shared<int>(0);
+  LRUCache<int, std::shared_ptr<int>> lru(
+      4, nullptr, nullptr, nullptr,
+      [&](LRUCache<int, std::shared_ptr<int>>::map_type &m) {
+        for (auto &p : m) {
+          order.push_back(p.first);
+        }
+      });
+  for (int k : {1, 2, 3, 4}) {
+    lru.insert(k, value);
+  }
+  lru.get(2);
+  lru.insert(5, value); // evicts 1
+  lru.clear();
+
+  std::vector<int> expect = {3, 4, 2, 5};
+  if (order != expect || !lru.empty() || value.use_count() != 1) {
+    std::cout << "clear order or release differs" << std::endl;
+    return false;
+  }
+  for (int k = 0; k < 10; ++k) {
+    lru.insert(k, value);
+  }
+  if (lru.size() != 4 || !lru.contains(9) || lru.contains(5)) {
+    std::cout << "reuse after clear differs" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+static std::string dotted(uint32_t ip) {
+  return std::to_string(ip >> 24) + "." + std::to_string((ip >> 16) & 0xFF) +
+         "." + std::to_string((ip >> 8) & 0xFF) + "." +
+         std::to_string(ip & 0xFF);
+}
+
+template <typename F>
+static void bench(const char *name, size_t n, F f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << "  " << name << ": " << static_cast<size_t>(n / d.count())
+            << " ops/s" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (!same(200000) || !cleared()) {
+    return 1;
+  }
+  std::cout << "random operations match" << std::endl;
+
+  size_t n = argc > 1 ? std::stoul(argv[1]) : 2000000;
+  std::mt19937 rng(42);
+
+  // client addresses, as IPResolver sees them: a hot set within its 32768
+  // entries and a tail missing it
+  using Record = std::shared_ptr<std::vector<std::string>>;
+  Record record(new std::vector<std::string>(4, "x"));
+  for (uint32_t distinct : {20000u, 200000u}) {
+    std::vector<std::string> ips;
+    std::geometric_distribution<uint32_t> skew(8.0 / distinct);
+    for (size_t i = 0; i < n; ++i) {
+      ips.push_back(dotted(0x0A000000 + skew(rng) % distinct));
+    }
+
+    std::cout << "resolver, " << distinct << " distinct addresses:"
+              << std::endl;
+    bench("std::map", n, [&]() {
+      Reference<std::string, Record> ref(32768);
+      for (auto &ip : ips) {
+        if (!ref.get(ip)) {
+          ref.insert(ip, record);
+        }
+      }
+    });
+
+    LRUCache<std::string, Record> lru(32768);
+    bench("open addressing", n, [&]() {
+      for (auto &ip : ips) {
+        if (!lru.lookup(ip)) {
+          lru.insert(ip, record);
+        }
+      }
+    });
+    std::cout << "  hits " << lru.hits() << ", misses " << lru.misses()
+              << std::endl;
+  }
+
+  // aggregation keys: hashed group terms, each inserted many times
+  std::vector<size_t> keys;
+  std::uniform_int_distribution<size_t> group(0, 5000);
+  for (size_t i = 0; i < n; ++i) {
+    keys.push_back(std::hash<size_t>()(group(rng)) * 0x9E3779B97F4A7C15ULL);
+  }
+  std::cout << "aggregation, 5000 groups in 3600 entries:" << std::endl;
+  size_t sum = 0;
+  auto oa    = [](size_t &lhs, size_t &rhs) { lhs += rhs; };
+  auto oe    = [&sum](size_t &v) { sum += v; };
+  bench("std::map", n, [&]() {
+    Reference<size_t, size_t> ref(3600, oe, oa);
+    for (auto key : keys) {
+      ref.insert(key, 1);
+    }
+  });
+  bench("open addressing", n, [&]() {
+    LRUCache<size_t, size_t> lru(3600, nullptr, oa, oe);
+    for (auto key : keys) {
+      lru.insert(key, 1);
+    }
+  });
+
+  return sum == 0;
+}
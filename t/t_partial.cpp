@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+
+#include "fluorine/util/GroupBy.hpp"
+#include "fluorine/util/PartialGroupBy.hpp"
+
+using namespace fluorine::util;
+
+// Checks that lines grouped on several threads, in partial tables merged as
+// their windows close, add up to what one table emits for them in order:
+// the rows, their order and first lines while no table fills, the totals
+// of every key and the late lines dropped always. Then times the fold of
+// the same lines on 1 to 8 threads, usage:
+//   t_partial [lines [groups]]
+
+struct Line {
+  int64_t time_;
+  int64_t term_;
+  int64_t value_;
+};
+
+struct Row {
+  std::string key_;
+  int64_t count_, sum_, min_, max_, first_;
+
+  bool operator==(const Row &o) const {
+    return key_ == o.key_ && count_ == o.count_ && sum_ == o.sum_ &&
+           min_ == o.min_ && max_ == o.max_ && first_ == o.first_;
+  }
+};
+
+static const std::vector<Fold> kFolds = {Fold::Sum, Fold::Min, Fold::Max,
+                                         Fold::First};
+static const int64_t kInterval        = 10;
+static const int64_t kLateness        = 5;
+
+// about rate lines a second, each late by up to jitter seconds, past the
+// lateness for some
+static std::vector<Line> generate(size_t n, size_t rate, size_t groups,
+                                  int64_t jitter) {
+  std::mt19937 rng(11);
+  std::vector<Line> lines(n);
+  int64_t now = 1480391340;
+  for (size_t i = 0; i < n; ++i) {
+    now += rng() % rate == 0;
+    lines[i].time_  = now - static_cast<int64_t>(rng() % (jitter + 1));
+    lines[i].term_  = rng() % groups;
+    lines[i].value_ = rng() % 1000;
+  }
+  return lines;
+}
+
+// the key and cells of line i, as a worker stages them
+static void stage(const Line &line, size_t i, int64_t window, std::string &key,
+                  Cell *cells) {
+  key.clear();
+  KeyWriter writer(key);
+  writer.Int64(window);
+  writer.Int64(line.term_);
+  cells[0] = Cell::Int64(line.value_);
+  cells[1] = cells[0];
+  cells[2] = cells[0];
+  cells[3] = Cell::Int64(i);
+}
+
+static void record(std::vector<Row> &rows, const std::string &key,
+                   int64_t count, const Cell *cells) {
+  rows.push_back(Row{key, count, cells[0].int64_, cells[1].int64_,
+                     cells[2].int64_, cells[3].int64_});
+}
+
+static std::vector<Row> single(const std::vector<Line> &lines, size_t capacity,
+                               uint64_t &late) {
+  std::vector<Row> rows;
+  GroupBy<> groups(kFolds, capacity,
+                   [&](const std::string &key, int64_t count,
+                       const Cell *cells) { record(rows, key, count, cells); },
+                   kInterval, kLateness);
+  std::string key;
+  Cell cells[4];
+  for (size_t i = 0; i < lines.size(); ++i) {
+    stage(lines[i], i, groups.WindowOf(lines[i].time_), key, cells);
+    groups.Add(lines[i].time_, key, cells);
+  }
+  groups.Flush();
+  late = groups.Late();
+  return rows;
+}
+
+// blocks of block lines, worker w folding the blocks w, w + workers, ... in
+// turn, as a pool dispatching them round-robin does, and this thread
+// closing the windows as the blocks come back in order
+static std::vector<Row> partial(const std::vector<Line> &lines,
+                                size_t workers, size_t capacity, size_t block,
+                                uint64_t &late) {
+  std::vector<Row> rows;
+  PartialGroupBy<> groups(
+      workers, kFolds, capacity,
+      [&](const std::string &key, int64_t count, const Cell *cells) {
+        record(rows, key, count, cells);
+      },
+      kInterval, kLateness);
+
+  size_t blocks = (lines.size() + block - 1) / block;
+  std::vector<int64_t> latest(blocks);
+  std::vector<std::atomic<bool>> folded(blocks);
+  for (auto &f : folded) {
+    f = false;
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w < workers; ++w) {
+    threads.emplace_back([&, w]() {
+      PartialGroupBy<>::Block staged(kFolds.size());
+      for (size_t b = w; b < blocks; b += workers) {
+        staged.Clear();
+        for (size_t i = b * block; i < std::min(lines.size(), (b + 1) * block);
+             ++i) {
+          stage(lines[i], i, groups.WindowOf(lines[i].time_), staged.Key(),
+                staged.Cells());
+          staged.Add(lines[i].time_);
+        }
+        latest[b] = groups.Add(w, b, staged);
+        folded[b] = true;
+      }
+    });
+  }
+
+  int64_t closed = INT64_MIN;
+  for (size_t b = 0; b < blocks; ++b) {
+    while (!folded[b]) {
+      std::this_thread::yield();
+    }
+    if (groups.ClosedBy(latest[b]) > closed) {
+      closed = groups.ClosedBy(latest[b]);
+      groups.Close(latest[b]);
+    }
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  groups.Flush();
+  late = groups.Late();
+  return rows;
+}
+
+// the rows of each key added up
+static std::map<std::string, Row> totals(const std::vector<Row> &rows) {
+  std::map<std::string, Row> t;
+  for (auto &r : rows) {
+    auto it = t.find(r.key_);
+    if (it == t.end()) {
+      t[r.key_] = r;
+      continue;
+    }
+    Row &s = it->second;
+    s.count_ += r.count_;
+    s.sum_ += r.sum_;
+    s.min_   = std::min(s.min_, r.min_);
+    s.max_   = std::max(s.max_, r.max_);
+    s.first_ = std::min(s.first_, r.first_);
+  }
+  return t;
+}
+
+static bool exact(const std::vector<Line> &lines, size_t capacity,
+                  bool held) {
+  uint64_t expect_late;
+  std::vector<Row> expect = single(lines, capacity, expect_late);
+  for (size_t workers : {1, 2, 3, 4, 8}) {
+    for (size_t block : {1, 97, 4096}) {
+      uint64_t late;
+      std::vector<Row> got = partial(lines, workers, capacity, block, late);
+      if (late != expect_late) {
+        std::cout << workers << " workers, blocks of " << block << ": " << late
+                  << " late lines, " << expect_late << " in one table"
+                  << std::endl;
+        return false;
+      }
+      if (held ? got != expect : totals(got) != totals(expect)) {
+        std::cout << workers << " workers, blocks of " << block
+                  << ": rows otherwise, " << got.size() << " of "
+                  << expect.size() << std::endl;
+        return false;
+      }
+    }
+  }
+  printf("  %zu groups held: %zu rows, %llu late lines\n", capacity,
+         expect.size(), static_cast<unsigned long long>(expect_late));
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  size_t n      = argc > 1 ? std::stoul(argv[1]) : 2000000;
+  size_t groups = argc > 2 ? std::stoul(argv[2]) : 500;
+
+  std::cout << "exact:" << std::endl;
+  std::vector<Line> lines = generate(200000, 64, 300, 20);
+  // every group held, then tables filling and emitting early
+  if (!exact(lines, 1 << 16, true) || !exact(lines, 256, false)) {
+    return 1;
+  }
+
+  lines = generate(n, 1024, groups, 3);
+  std::cout << "folds of " << n << " lines, " << groups
+            << " groups a window:" << std::endl;
+  double one = 0;
+  for (size_t workers : {1, 2, 4, 8}) {
+    uint64_t late;
+    auto start = std::chrono::steady_clock::now();
+    partial(lines, workers, 1 << 16, 4096, late);
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    double rate = n / d.count();
+    one         = one ? one : rate;
+    printf("  %zu workers: %zu lines/s, %.2fx\n", workers,
+           static_cast<size_t>(rate), rate / one);
+  }
+  return 0;
+}
@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <new>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "fluorine/log/Json.hpp"
+#include "fluorine/log/Parser.hpp"
+#include "fluorine/config/Parser.hpp"
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine;
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+  ++allocations;
+  if (void *p = malloc(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+// Checks that the members an aggregation reads come out of the projected
+// steps as they come out of a whole document, counts the heap allocations
+// (operator new) per projected line and compares the speed of both, usage:
+//   t_project sample/access.agg sample/access.log 17monipdb.dat
+
+static bool same(const json::Projection &a, const json::Projection &b) {
+  for (size_t i = 0; i < a.Size(); ++i) {
+    log::Field sa, sb;
+    const util::Cell &ca = a.Get(i, sa);
+    const util::Cell &cb = b.Get(i, sb);
+    if (ca.type_ != cb.type_ ||
+        (ca.type_ == util::Type::String && sa != sb) ||
+        (ca.type_ == util::Type::Int64 && ca.int64_ != cb.int64_) ||
+        (ca.type_ == util::Type::Double && ca.double_ != cb.double_)) {
+      std::cout << a.Name(i) << " projects otherwise" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    std::cout << "usage: " << argv[0] << " <config> <log> <ipdb>" << std::endl;
+    return 1;
+  }
+
+  config::Config cfg;
+  if (!config::ParseConfig(std::string(argv[1]), cfg) || !cfg.aggregation_) {
+    return 1;
+  }
+  util::InitIPResolver(argv[3]);
+
+  json::Plan plan, projected;
+  if (!json::CompilePlan(cfg, plan)) {
+    return 1;
+  }
+
+  auto &agg = *cfg.aggregation_;
+  std::vector<std::string> members{agg.time_};
+  if (agg.terms_) {
+    members.insert(members.end(), agg.terms_->begin(), agg.terms_->end());
+  }
+  for (auto &key : agg.keys_) {
+    members.push_back(key.name_);
+  }
+  if (!json::CompileProjection(plan, members, projected)) {
+    std::cout << "the plan reads documents back" << std::endl;
+    return 1;
+  }
+  std::cout << projected.steps_.size() << " of " << plan.steps_.size()
+            << " steps for " << members.size() << " members" << std::endl;
+
+  std::vector<std::string> lines;
+  std::ifstream is(argv[2]);
+  for (std::string line; std::getline(is, line);) {
+    lines.push_back(line);
+  }
+
+  log::Log log;
+  json::Projection direct(members), through(members);
+  static char buffer[64 * 1024];
+  size_t checked = 0;
+  for (auto &line : lines) {
+    log.clear();
+    if (!log::ParseLog(line, log, cfg.field_number_, cfg.time_index_)) {
+      continue;
+    }
+    rapidjson::Document::AllocatorType allocator(buffer, sizeof(buffer));
+    rapidjson::Document doc(&allocator);
+    bool a = json::ProjectLog(log, projected, direct);
+    bool b = json::PopulateJsonDoc(&doc, log, plan);
+    if (a != b) {
+      std::cout << "[" << line << "] " << (a ? "projects" : "drops")
+                << ", its document " << (b ? "does not" : "drops")
+                << std::endl;
+      return 1;
+    }
+    if (b) {
+      json::ProjectJsonDoc(doc, through);
+      if (!same(direct, through)) {
+        return 1;
+      }
+      ++checked;
+    }
+  }
+  std::cout << checked << " lines project as their documents" << std::endl;
+  if (checked == 0) {
+    std::cout << "no line of the log was checked" << std::endl;
+    return 1;
+  }
+
+  // each field of a line in turn unreadable to a typed step, read into the
+  // aggregation or not, drops the line both ways alike
+  for (auto &line : lines) {
+    log.clear();
+    if (!log::ParseLog(line, log, cfg.field_number_, cfg.time_index_)) {
+      continue;
+    }
+    for (size_t i = 0; i < log.size(); ++i) {
+      log::Log bad;
+      for (size_t j = 0; j < log.size(); ++j) {
+        bad.push_back(j == i ? log::Field("-x-") : log[j]);
+      }
+      rapidjson::Document::AllocatorType allocator(buffer, sizeof(buffer));
+      rapidjson::Document doc(&allocator);
+      if (json::ProjectLog(bad, projected, direct) !=
+          json::PopulateJsonDoc(&doc, bad, plan)) {
+        std::cout << "field " << i << " unreadable drops one way only"
+                  << std::endl;
+        return 1;
+      }
+    }
+    break;
+  }
+
+  const int kRounds = 100;
+  auto run = [&](const char *name, std::function<void(std::string &)> f) {
+    // the first pass fills the IP cache and the per-thread buffers
+    for (auto &line : lines) {
+      f(line);
+    }
+
+    size_t before = allocations;
+    auto start    = std::chrono::steady_clock::now();
+    for (int round = 0; round < kRounds; ++round) {
+      for (auto &line : lines) {
+        f(line);
+      }
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    std::cout << name << ": "
+              << static_cast<size_t>(kRounds * lines.size() / d.count())
+              << " lines/s, "
+              << double(allocations - before) / (kRounds * lines.size())
+              << " allocations per line" << std::endl;
+  };
+
+  run("document", [&](std::string &line) {
+    log.clear();
+    if (log::ParseLog(line, log, cfg.field_number_, cfg.time_index_)) {
+      rapidjson::Document::AllocatorType allocator(buffer, sizeof(buffer));
+      rapidjson::Document doc(&allocator);
+      if (json::PopulateJsonDoc(&doc, log, plan)) {
+        json::ProjectJsonDoc(doc, through);
+      }
+    }
+  });
+  run("projected", [&](std::string &line) {
+    log.clear();
+    if (log::ParseLog(line, log, cfg.field_number_, cfg.time_index_)) {
+      json::ProjectLog(log, projected, direct);
+    }
+  });
+
+  return 0;
+}
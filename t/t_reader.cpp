@@ -0,0 +1,59 @@
+#include <chrono>
+#include <string>
+#include <fstream>
+#include <iostream>
+
+#include "fluorine/util/LineReader.hpp"
+
+using namespace fluorine::util;
+
+// Compares the getline producer with the mapped line scanner, usage:
+//   t_reader access.log
+template <typename F>
+void bench(const char *name, F f) {
+  auto start             = std::chrono::steady_clock::now();
+  unsigned long long n   = 0;
+  unsigned long long sum = f(n);
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << n << " lines, " << sum << " bytes, "
+            << static_cast<unsigned long long>(n / d.count()) << " lines/s"
+            << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0] << " <file>" << std::endl;
+    return 1;
+  }
+
+  bench("getline", [&](unsigned long long &n) {
+    std::ifstream is(argv[1]);
+    std::string line;
+    unsigned long long sum = 0;
+    while (std::getline(is, line)) {
+      std::string copy(line); // the string pushed into the queue
+      sum += copy.size();
+      ++n;
+    }
+    return sum;
+  });
+
+  bench("mapped", [&](unsigned long long &n) {
+    MappedFile file;
+    if (!file.Open(argv[1])) {
+      std::cout << "open failed: " << argv[1] << std::endl;
+      exit(1);
+    }
+
+    LineScanner scanner(file.Data(), file.Size());
+    boost::string_ref line;
+    unsigned long long sum = 0;
+    while (scanner.Next(line)) {
+      sum += line.size();
+      ++n;
+    }
+    return sum;
+  });
+
+  return 0;
+}
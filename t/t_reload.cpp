@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine::util;
+
+// Checks that processes loading a database share the index file one of
+// them built. Then swaps two IPv4 databases under a resolver while threads
+// resolve through it, by Reload(), by RequestReload() and by replacing the
+// file, checking every result comes from one of them, usage:
+//   t_reload 17monipdb.dat other.dat [reloads]
+
+static std::string read(const char *path) {
+  std::ifstream is(path, std::ios::binary);
+  return std::string((std::istreambuf_iterator<char>(is)),
+                     std::istreambuf_iterator<char>());
+}
+
+// replaced by a rename, as a database should be updated under a resolver
+static void install(const std::string &db, const std::string &path) {
+  std::string tmp = path + ".tmp";
+  std::ofstream(tmp, std::ios::binary) << db;
+  rename(tmp.c_str(), path.c_str());
+}
+
+static std::string dotted(uint32_t ip) {
+  return std::to_string(ip >> 24) + "." + std::to_string((ip >> 16) & 0xFF) +
+         "." + std::to_string((ip >> 8) & 0xFF) + "." +
+         std::to_string(ip & 0xFF);
+}
+
+static ino_t inode(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_ino : 0;
+}
+
+// Processes loading db at once, from no index, all map the index file built
+// for it. A later resolver maps that one as it is, a broken one is built
+// again.
+static bool shares(const std::string &db, const IPResolver &expect,
+                   const std::string &path) {
+  std::string index = path + ".idx1";
+  install(db, path);
+  unlink(index.c_str());
+
+  std::vector<pid_t> children;
+  for (int i = 0; i < 4; ++i) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      IPResolver resolver(path.c_str());
+      _exit(resolver.Ranges() == expect.Ranges() ? 0 : 1);
+    }
+    children.push_back(pid);
+  }
+  bool loaded = true;
+  for (pid_t pid : children) {
+    int status;
+    loaded = waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+             WEXITSTATUS(status) == 0 && loaded;
+  }
+  ino_t built = inode(index);
+  if (!loaded || built == 0) {
+    std::cout << "processes loading at once failed, or left no index"
+              << std::endl;
+    return false;
+  }
+
+  {
+    IPResolver resolver(path.c_str());
+    if (inode(index) != built || resolver.Ranges() != expect.Ranges() ||
+        *resolver.Lookup(0x01020304) != *expect.Lookup(0x01020304)) {
+      std::cout << "the index was not mapped as it is" << std::endl;
+      return false;
+    }
+  }
+
+  install("broken", index);
+  IPResolver resolver(path.c_str());
+  if (inode(index) == built || resolver.Ranges() != expect.Ranges()) {
+    std::cout << "a broken index was not built again" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// the resolver serves db within tries tenths of a second
+static bool serves(IPResolver &resolver, IPResolver &db, int tries) {
+  for (int i = 0; i < tries; ++i) {
+    if (resolver.Ranges() == db.Ranges()) {
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  return false;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0] << " <ipdb> <other ipdb> [reloads]"
+              << std::endl;
+    return 1;
+  }
+  int reloads = argc > 3 ? std::stoi(argv[3]) : 20;
+
+  std::string dbs[2] = {read(argv[1]), read(argv[2])};
+  IPResolver a(dbs[0].data(), dbs[0].size());
+  IPResolver b(dbs[1].data(), dbs[1].size());
+  if (a.Ranges() == b.Ranges()) {
+    std::cout << "the databases should differ in size" << std::endl;
+    return 1;
+  }
+
+  std::string path = "/tmp/t_reload." + std::to_string(getpid()) + ".dat";
+  if (!shares(dbs[0], a, path)) {
+    return 1;
+  }
+  IPResolver resolver(path.c_str());
+
+  std::atomic<bool> done(false), failed(false);
+  std::atomic<size_t> resolved(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      while (!done) {
+        uint32_t ip = rng() >> (rng() % 2 ? 0 : 12);
+        IPResolver::LRUValueType result;
+        resolver.Resolve(dotted(ip), result);
+        if (*result != *a.Lookup(ip) && *result != *b.Lookup(ip)) {
+          std::cout << "no database gives this for " << dotted(ip)
+                    << std::endl;
+          failed = true;
+        }
+        ++resolved;
+      }
+    });
+  }
+
+  double longest = 0;
+  for (int i = 1; i <= reloads && !failed; ++i) {
+    install(dbs[i % 2], path);
+    auto start = std::chrono::steady_clock::now();
+    if (!resolver.Reload()) {
+      failed = true;
+      break;
+    }
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    longest = std::max(longest, d.count());
+    if (resolver.Ranges() != (i % 2 ? b : a).Ranges()) {
+      std::cout << "reload " << i << " kept the old database" << std::endl;
+      failed = true;
+    }
+  }
+
+  // a broken file is refused, the loaded database stays
+  IPResolver *current = reloads % 2 ? &b : &a;
+  IPResolver *other   = reloads % 2 ? &a : &b;
+  install("broken", path);
+  if (resolver.Reload() || resolver.Ranges() != current->Ranges()) {
+    std::cout << "broken database swapped in" << std::endl;
+    failed = true;
+  }
+
+  // the watcher reloads on request within a second, and on a replaced file
+  // within its interval
+  install(dbs[other == &a ? 0 : 1], path);
+  resolver.Watch(3);
+  IPResolver::RequestReload();
+  if (!serves(resolver, *other, 15)) {
+    std::cout << "RequestReload() did not reload" << std::endl;
+    failed = true;
+  }
+  install(dbs[current == &a ? 0 : 1], path);
+  if (!serves(resolver, *current, 50)) {
+    std::cout << "replacing the file did not reload" << std::endl;
+    failed = true;
+  }
+
+  done = true;
+  for (auto &t : readers) {
+    t.join();
+  }
+  unlink(path.c_str());
+  unlink((path + ".idx1").c_str());
+
+  if (failed) {
+    return 1;
+  }
+  std::cout << reloads << " reloads, the longest " << longest * 1000
+            << " ms, " << resolved << " addresses resolved meanwhile"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,220 @@
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include "fluorine/config/Parser.hpp"
+#include "fluorine/util/GroupBy.hpp"
+#include "fluorine/util/Sketch.hpp"
+
+using namespace fluorine;
+using namespace fluorine::util;
+
+// Loads the functions of aggregation keys, checks the distinct counts and
+// quantiles of the sketches, merged ones included, against exact ones, the
+// folds of a table against a std::map, and times the sketches, usage:
+//   t_sketch [values]
+
+static bool functions() {
+  const char *text = "log(2, 0, 0) { a: [int, 1]; b: [string, 1]; }\n"
+                     "([a, max(a), p99(\"a\"), avg(a), distinct(b)], a, 10)";
+  config::Config cfg;
+  if (!config::ParseConfig(text, cfg)) {
+    std::cout << "keys with functions do not load" << std::endl;
+    return false;
+  }
+  std::vector<std::string> keys      = {"a", "a", "a", "a", "b"};
+  std::vector<std::string> functions = {"sum", "max", "p99", "avg",
+                                        "distinct"};
+  std::vector<std::string> loaded_keys, loaded_functions;
+  for (auto &key : cfg.aggregation_->keys_) {
+    loaded_keys.push_back(key.name_);
+    loaded_functions.push_back(key.function_);
+  }
+  if (loaded_keys != keys || loaded_functions != functions ||
+      config::Aggregation::Percentile("p99") != 99 ||
+      config::Aggregation::Percentile("p05") ||
+      config::Aggregation::Percentile("p100")) {
+    std::cout << "keys load with other functions" << std::endl;
+    return false;
+  }
+
+  const char *unknown = "log(1, 0, 0) { a: [int, 1]; } (median(a), a, 10)";
+  if (config::ParseConfig(unknown, cfg)) {
+    std::cout << "an unknown function loads" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// within 4 standard errors, 1.04 / sqrt(registers) each
+static bool distinct() {
+  const double bound = 4 * 1.04 / sqrt(HyperLogLog::kRegisters);
+  std::mt19937_64 rng(3);
+  for (size_t n : {10, 100, 1000, 10000, 100000, 1000000}) {
+    HyperLogLog all, odd, even;
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t v = rng();
+      // every value twice, counted once
+      all.Add(v);
+      all.Add(v);
+      (i % 2 ? odd : even).Add(v);
+    }
+    odd.Merge(even);
+
+    double error  = fabs(all.Estimate() - n) / n;
+    double merged = fabs(odd.Estimate() - n) / n;
+    printf("  %7zu distinct: %.4f error, %.4f merged\n", n, error, merged);
+    if (error > bound || merged > bound) {
+      std::cout << "distinct count out of bound " << bound << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// the quantiles of values, each sketch within its relative error of the
+// exact value, or of its neighbours in the sorted values
+static bool quantiles(const char *name, std::vector<double> values) {
+  const double error = 0.01;
+  DDSketch all, low, high;
+  for (size_t i = 0; i < values.size(); ++i) {
+    all.Add(values[i]);
+    (i % 3 ? low : high).Add(values[i]);
+  }
+  low.Merge(high);
+  std::sort(values.begin(), values.end());
+
+  double worst = 0;
+  for (double q : {0.01, 0.25, 0.5, 0.75, 0.9, 0.95, 0.99, 0.999}) {
+    double exact = values[static_cast<size_t>(q * (values.size() - 1))];
+    for (auto sketch : {&all, &low}) {
+      double got = sketch->Quantile(q);
+      double e   = exact ? fabs(got - exact) / exact : fabs(got);
+      worst      = std::max(worst, e);
+      if (e > error * 1.0001) {
+        std::cout << name << ": p" << q * 100 << " is " << got
+                  << ", exactly " << exact << std::endl;
+        return false;
+      }
+    }
+  }
+  if (all.Min() != values.front() || all.Max() != values.back() ||
+      low.Count() != values.size()) {
+    std::cout << name << ": min, max or count otherwise" << std::endl;
+    return false;
+  }
+  printf("  %s: %.4f worst relative error, %zu bytes\n", name, worst,
+         all.MemoryUsage());
+  return true;
+}
+
+// the folds of random lines against the exact values of their groups
+static bool folds() {
+  struct Exact {
+    int64_t sum_ = 0, min_ = INT64_MAX, max_ = INT64_MIN, n_ = 0;
+    std::vector<double> values_;
+    std::map<int64_t, int> distinct_;
+  };
+  std::map<std::string, Exact> expect;
+  std::mt19937 rng(5);
+  bool ok = true;
+
+  GroupBy<> groups(
+      {Fold::Sum, Fold::Min, Fold::Max, Fold::Count, Fold::Distinct,
+       Fold::Quantile},
+      64,
+      [&](const std::string &key, int64_t count, const Cell *cells) {
+        Exact &e = expect[key];
+        std::sort(e.values_.begin(), e.values_.end());
+        double p90 = e.values_[static_cast<size_t>(0.9 * (e.n_ - 1))];
+        double d   = cells[4].distinct_->Estimate();
+        ok = ok && cells[0].int64_ == e.sum_ && cells[1].int64_ == e.min_ &&
+             cells[2].int64_ == e.max_ && cells[3].int64_ == e.n_ &&
+             fabs(d - e.distinct_.size()) <= 0.05 * e.distinct_.size() &&
+             fabs(cells[5].quantile_->Quantile(0.9) - p90) <= 0.01 * p90;
+      });
+
+  for (int round = 0; round < 2; ++round) {
+    expect.clear();
+    for (size_t i = 0; i < 100000; ++i) {
+      std::string key;
+      KeyWriter(key).Int64(rng() % 16);
+      // some lines without the value
+      bool none = rng() % 10 == 0;
+      int64_t v = 1 + rng() % 5000;
+      Cell value = none ? Cell() : Cell::Int64(v);
+      Cell cells[6] = {value, value, value, value,
+                       none ? Cell() : Cell::Int64(v % 700), value};
+      groups.Add(0, key, cells);
+      if (!none) {
+        Exact &e = expect[key];
+        e.sum_ += v;
+        e.min_ = std::min(e.min_, v);
+        e.max_ = std::max(e.max_, v);
+        ++e.n_;
+        e.values_.push_back(v);
+        ++e.distinct_[v % 700];
+      }
+    }
+    // the sketches come back cleared for the next round
+    groups.Flush();
+  }
+  if (!ok) {
+    std::cout << "a group folds otherwise" << std::endl;
+  }
+  return ok;
+}
+
+template <class F>
+static double rate(size_t n, F f) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    f(i);
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  return n / d.count();
+}
+
+int main(int argc, char *argv[]) {
+  if (!functions()) {
+    return 1;
+  }
+  std::cout << "distinct counts:" << std::endl;
+  if (!distinct()) {
+    return 1;
+  }
+
+  std::mt19937 rng(9);
+  std::vector<double> uniform(200000), lognormal(200000), ints(200000);
+  std::uniform_real_distribution<double> u(0.001, 10);
+  std::lognormal_distribution<double> ln(3, 2);
+  for (size_t i = 0; i < uniform.size(); ++i) {
+    uniform[i]   = u(rng);
+    lognormal[i] = ln(rng);
+    ints[i]      = rng() % 100; // zeros included
+  }
+  std::cout << "quantiles:" << std::endl;
+  if (!quantiles("uniform", uniform) || !quantiles("lognormal", lognormal) ||
+      !quantiles("integers", ints) || !folds()) {
+    return 1;
+  }
+
+  size_t n = argc > 1 ? std::stoul(argv[1]) : 10000000;
+  HyperLogLog hll;
+  DDSketch dd;
+  double adds = rate(n, [&](size_t i) { hll.Add(i); });
+  double adds_dd =
+      rate(n, [&](size_t i) { dd.Add(lognormal[i % lognormal.size()]); });
+  std::cout << "hyperloglog: " << static_cast<size_t>(adds)
+            << " adds/s, estimate " << static_cast<size_t>(hll.Estimate())
+            << " of " << n << std::endl;
+  std::cout << "ddsketch: " << static_cast<size_t>(adds_dd)
+            << " adds/s, p99 " << dd.Quantile(0.99) << std::endl;
+  return 0;
+}
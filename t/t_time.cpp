@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "fluorine/log/Json.hpp"
+
+using namespace fluorine::json;
+
+// Checks the fixed position time parsers against the grammars, the
+// days-from-civil conversion against timegm() and the handlers' offsets,
+// and compares the handlers with the grammar and mktime() path they
+// replaced, usage:
+//   t_time [lines]
+
+static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static std::string two(int v) {
+  return std::string(1, '0' + v / 10) + std::string(1, '0' + v % 10);
+}
+
+static std::string timeLocal(time_t ts, int offset) {
+  struct tm tm;
+  time_t local = ts + offset;
+  gmtime_r(&local, &tm);
+  int tz = offset < 0 ? -offset : offset;
+  return two(tm.tm_mday) + "/" + months[tm.tm_mon] + "/" +
+         std::to_string(tm.tm_year + 1900) + ":" + two(tm.tm_hour) + ":" +
+         two(tm.tm_min) + ":" + two(tm.tm_sec) + " " +
+         (offset < 0 ? "-" : "+") + two(tz / 3600) + two(tz % 3600 / 60);
+}
+
+static std::string timeDate(time_t ts) {
+  struct tm tm;
+  localtime_r(&ts, &tm);
+  return std::to_string(tm.tm_year + 1900) + "-" + two(tm.tm_mon + 1) + "-" +
+         two(tm.tm_mday) + " " + two(tm.tm_hour) + ":" + two(tm.tm_min) +
+         ":" + two(tm.tm_sec);
+}
+
+// what the handler writes, -1 when it fails
+template <typename Handler>
+static int64_t run(Handler handler, const std::string &v) {
+  Step step;
+  step.key_ = Key("t");
+  std::string out;
+  JsonWriter writer(out);
+  if (!handler(writer, step, v)) {
+    return -1;
+  }
+  return std::stoll(out.substr(out.find(':') + 1));
+}
+
+static bool sameTm(const struct tm &a, const struct tm &b) {
+  return a.tm_year == b.tm_year && a.tm_mon == b.tm_mon &&
+         a.tm_mday == b.tm_mday && a.tm_hour == b.tm_hour &&
+         a.tm_min == b.tm_min && a.tm_sec == b.tm_sec;
+}
+
+// random times and edits of them: where the fixed parser reads one, the
+// grammar reads the same, and the handlers give what the text means
+static bool parses(size_t cases) {
+  std::mt19937_64 rng(17);
+  const char alphabet[] = "0123456789/:- +Nov";
+  for (size_t i = 0; i < cases; ++i) {
+    time_t ts  = rng() % 4000000000ULL;
+    int offset = (static_cast<int>(rng() % 57) - 28) * 1800;
+    std::string tl = timeLocal(ts, offset), td = timeDate(ts);
+    bool edited    = rng() % 3 == 0;
+    if (edited) {
+      tl[rng() % tl.size()] = alphabet[rng() % (sizeof(alphabet) - 1)];
+      td[rng() % td.size()] = alphabet[rng() % (sizeof(alphabet) - 1)];
+    }
+
+    struct tm fixed = {}, loose = {};
+    int offset1 = 0, offset2 = 0;
+    if (parse_time_local(tl, fixed, offset1)) {
+      TimeLocalGrammar<> g;
+      TimeLocal parsed;
+      if (!qi::parse(tl.data(), tl.data() + tl.size(), g, parsed) ||
+          !time_local_fields(tl, loose, offset2) || !sameTm(fixed, loose) ||
+          offset1 != offset2) {
+        std::cout << "time_local parsed differently [" << tl << "]"
+                  << std::endl;
+        return false;
+      }
+    }
+    if (parse_time_date(td, fixed)) {
+      TimeDateGrammar<> g;
+      TimeDate parsed;
+      if (!qi::parse(td.data(), td.data() + td.size(), g, parsed) ||
+          !time_date_fields(td, loose) || !sameTm(fixed, loose)) {
+        std::cout << "time_date parsed differently [" << td << "]"
+                  << std::endl;
+        return false;
+      }
+    }
+
+    // an hour repeated when daylight saving ends reads as mktime() has it
+    struct tm local = {};
+    time_date_fields(td, local);
+    local.tm_isdst = -1;
+    if (!edited && (run(time_local_handler<JsonWriter>, tl) != ts ||
+                    run(time_date_handler<JsonWriter>, td) != mktime(&local))) {
+      std::cout << "handlers give another time for [" << tl << "], [" << td
+                << "]" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// dates with fields out of range carry over as timegm() carries them
+static bool civil(size_t cases) {
+  std::mt19937 rng(19);
+  for (size_t i = 0; i < cases; ++i) {
+    struct tm tm = {};
+    tm.tm_year   = 60 + rng() % 150;
+    tm.tm_mon    = static_cast<int>(rng() % 40) - 14;
+    tm.tm_mday   = static_cast<int>(rng() % 70) - 5;
+    tm.tm_hour   = rng() % 30;
+    tm.tm_min    = rng() % 70;
+    tm.tm_sec    = rng() % 70;
+
+    struct tm copy = tm;
+    if (civil_seconds(tm) != timegm(&copy)) {
+      std::cout << "civil_seconds differs from timegm for " << tm.tm_year
+                << "/" << tm.tm_mon << "/" << tm.tm_mday << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// the handler before, the grammar, the month map and mktime()
+static bool reference(JsonWriter &out, const Step &s, Field v) {
+  static std::map<std::string, unsigned short> month = {
+      {"Jan", 0}, {"Feb", 1}, {"Mar", 2}, {"Apr", 3}, {"May", 4},  {"Jun", 5},
+      {"Jul", 6}, {"Aug", 7}, {"Sep", 8}, {"Oct", 9}, {"Nov", 10}, {"Dec", 11}};
+  static TimeLocalGrammar<> g;
+  TimeLocal tl;
+  if (!qi::parse(v.begin(), v.end(), g, tl)) {
+    return false;
+  }
+  auto it = month.find(tl.mon_);
+  if (it == month.end()) {
+    return false;
+  }
+
+  struct tm tm = {};
+  tm.tm_mday = tl.day_;
+  tm.tm_mon  = it->second;
+  tm.tm_year = tl.year_ - 1900;
+  tm.tm_hour = tl.hour_;
+  tm.tm_min  = tl.min_;
+  tm.tm_sec  = tl.sec_;
+  time_t ts  = cached_mktime(&tm);
+  if (ts < 0) {
+    return false;
+  }
+  add_int64(out, s.key_, ts);
+  return true;
+}
+
+static void bench(const char *name, const std::vector<std::string> &times,
+                  Emitter handler) {
+  Step step;
+  step.key_ = Key("t");
+  std::string out;
+  size_t bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto &t : times) {
+    JsonWriter writer(out);
+    handler(writer, step, t);
+    bytes += out.size();
+    out.clear();
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << "  " << name << ": "
+            << static_cast<size_t>(times.size() / d.count()) << " lines/s ("
+            << bytes << ")" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  // a zone with daylight saving, for time_date
+  setenv("TZ", "America/New_York", 1);
+  tzset();
+
+  if (!parses(500000) || !civil(500000)) {
+    return 1;
+  }
+  std::cout << "parsers and conversions match" << std::endl;
+
+  size_t n = argc > 1 ? std::stoul(argv[1]) : 4000000;
+  std::mt19937 rng(23);
+  time_t now = 1480391340;
+  for (int rate : {50, 1}) {
+    // rate lines a second on average, in order
+    std::vector<std::string> times;
+    for (size_t i = 0; i < n; ++i) {
+      now += rng() % (2 * rate) == 0;
+      times.push_back(timeLocal(now, 8 * 3600));
+    }
+
+    std::cout << "time_local, " << rate << " lines a second:" << std::endl;
+    bench("grammar and mktime", times, reference);
+    bench("fixed positions", times, time_local_handler<JsonWriter>);
+  }
+
+  return 0;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "fluorine/log/Json.hpp"
+#include "fluorine/config/Parser.hpp"
+
+using namespace fluorine;
+using namespace fluorine::json;
+
+// Loads a config with time formats, checks the formats on known times and
+// against the built-in time_local and time_date handlers, and compares a
+// compiled format with those handlers, usage:
+//   t_timeformat [lines]
+
+static const char *months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static std::string two(int v) {
+  return std::string(1, '0' + v / 10) + std::string(1, '0' + v % 10);
+}
+
+static std::string timeLocal(time_t ts, int offset) {
+  struct tm tm;
+  time_t local = ts + offset;
+  gmtime_r(&local, &tm);
+  int tz = offset < 0 ? -offset : offset;
+  return two(tm.tm_mday) + "/" + months[tm.tm_mon] + "/" +
+         std::to_string(tm.tm_year + 1900) + ":" + two(tm.tm_hour) + ":" +
+         two(tm.tm_min) + ":" + two(tm.tm_sec) + " " +
+         (offset < 0 ? "-" : "+") + two(tz / 3600) + two(tz % 3600 / 60);
+}
+
+static std::string timeDate(time_t ts) {
+  struct tm tm;
+  localtime_r(&ts, &tm);
+  return std::to_string(tm.tm_year + 1900) + "-" + two(tm.tm_mon + 1) + "-" +
+         two(tm.tm_mday) + " " + two(tm.tm_hour) + ":" + two(tm.tm_min) +
+         ":" + two(tm.tm_sec);
+}
+
+static Step step(const std::string &format) {
+  Step s;
+  s.key_ = Key("t");
+  std::string error;
+  if (!s.format_.Compile(format, error)) {
+    std::cout << "[" << format << "] does not compile: " << error
+              << std::endl;
+    exit(1);
+  }
+  return s;
+}
+
+// what the handler writes, -1 when it fails
+static int64_t run(Emitter handler, const Step &s, const std::string &v) {
+  std::string out;
+  JsonWriter writer(out);
+  if (!handler(writer, s, v)) {
+    return -1;
+  }
+  return std::stoll(out.substr(out.find(':') + 1));
+}
+
+static bool loads() {
+  const char *text = "log(3, 0, 0) {\n"
+                     "    a: [time \"%Y-%m-%dT%H:%M:%S.%f%z\", 1];\n"
+                     "    b: [time_local, 1];\n"
+                     "    c: [time \"%s\", 1];\n"
+                     "}\n";
+  config::Config cfg;
+  Plan plan;
+  if (!config::ParseConfig(text, cfg) || !CompilePlan(cfg, plan) ||
+      cfg.attributes_[0].type_ != "time" ||
+      cfg.attributes_[0].format_ != "%Y-%m-%dT%H:%M:%S.%f%z" ||
+      !cfg.attributes_[1].format_.empty() ||
+      cfg.attributes_[2].format_ != "%s") {
+    std::cout << "a config with formats does not load" << std::endl;
+    return false;
+  }
+
+  const char *bad[] = {
+      "log(1, 0, 0) { a: [time \"%Y-%q\", 1]; }",
+      "log(1, 0, 0) { a: [time \"%H:%M\", 1]; }",
+      "log(1, 0, 0) { a: [time, 1]; }",
+      "log(1, 0, 0) { a: [int \"%s\", 1]; }",
+  };
+  for (auto b : bad) {
+    config::Config fresh;
+    if (config::ParseConfig(b, fresh) && CompilePlan(fresh, plan)) {
+      std::cout << "[" << b << "] loads" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool known() {
+  struct Case {
+    const char *format, *text;
+    int64_t ts;
+  } cases[] = {
+      {"%Y-%m-%dT%H:%M:%S.%f%z", "2016-11-29T03:49:00.123456+08:00",
+       1480362540},
+      {"%Y-%m-%dT%H:%M:%S.%f%z", "2016-11-28T19:49:00.1Z", 1480362540},
+      {"%Y-%m-%dT%H:%M:%S%z", "2016-11-28T14:49:00-0500", 1480362540},
+      {"%FT%T%z", "2016-11-28T14:49:00-05", 1480362540},
+      {"%Q", "1480362540999", 1480362540},
+      {"%s", "1480362540", 1480362540},
+      {"[%d/%b/%Y:%T %z]", "[29/Nov/2016:03:49:00 +0800]", 1480362540},
+      {"100%% %s", "100% 1480362540", 1480362540},
+      {"%Y-%m-%dT%H:%M:%S%z", "2016-11-28T14:49:00", -1},
+      {"%Y-%m-%dT%H:%M:%S%z", "2016-11-28 14:49:00Z", -1},
+      {"%Y-%m-%d", "2016-1-28", -1},
+      {"%b %e %T%z", "Nov  9 14:49:00 Z", -1},
+      {"%s", "", -1},
+      {"%d.%m.%Y %H.%M", "29.11.2016 03.49", 1480409340},
+      {"%Y%m%d%H%M%S%z", "20161128194900Z", 1480362540},
+      {"x%Y-%m-%d %Hh%Mm%Ss%z", "x2016-11-28 19h49m00sZ", 1480362540},
+      {"%d/%b/%Y:%H:%M:%S %z", "29/Nov/2016:03:49:0", -1},
+  };
+  for (auto &c : cases) {
+    Step s = step(c.format);
+    if (run(time_handler<JsonWriter>, s, c.text) != c.ts) {
+      std::cout << "[" << c.text << "] in [" << c.format << "] reads as "
+                << run(time_handler<JsonWriter>, s, c.text) << std::endl;
+      return false;
+    }
+  }
+
+  // syslog's times have no year, the last one up to a day from now is taken
+  Step s     = step("%b %e %H:%M:%S");
+  time_t now = time(nullptr);
+  for (time_t ts : {now - 86400 * 200, now - 3600, now + 3600}) {
+    struct tm tm;
+    localtime_r(&ts, &tm);
+    std::string text = std::string(months[tm.tm_mon]) + " " +
+                       (tm.tm_mday < 10 ? " " : "") +
+                       std::to_string(tm.tm_mday) + " " + two(tm.tm_hour) +
+                       ":" + two(tm.tm_min) + ":" + two(tm.tm_sec);
+    if (run(time_handler<JsonWriter>, s, text) != ts) {
+      std::cout << "[" << text << "] reads as "
+                << run(time_handler<JsonWriter>, s, text) << ", not " << ts
+                << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// the formats of the built-in handlers read what they read
+static bool same(size_t cases) {
+  Step local = step("%d/%b/%Y:%H:%M:%S %z");
+  Step date  = step("%Y-%m-%d %H:%M:%S");
+  Step plain;
+  plain.key_ = Key("t");
+  std::mt19937_64 rng(29);
+  for (size_t i = 0; i < cases; ++i) {
+    time_t ts  = rng() % 4000000000ULL;
+    int offset = (static_cast<int>(rng() % 57) - 28) * 1800;
+    std::string tl = timeLocal(ts, offset), td = timeDate(ts);
+    if (run(time_handler<JsonWriter>, local, tl) !=
+            run(time_local_handler<JsonWriter>, plain, tl) ||
+        run(time_handler<JsonWriter>, date, td) !=
+            run(time_date_handler<JsonWriter>, plain, td)) {
+      std::cout << "a format reads [" << tl << "] or [" << td
+                << "] otherwise" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+static void bench(const char *name, const std::vector<std::string> &times,
+                  const Step &step, Emitter handler) {
+  std::string out;
+  size_t bytes = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (auto &t : times) {
+    JsonWriter writer(out);
+    handler(writer, step, t);
+    bytes += out.size();
+    out.clear();
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << "  " << name << ": "
+            << static_cast<size_t>(times.size() / d.count()) << " lines/s ("
+            << bytes << ")" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  // a zone with daylight saving, for the formats without %z
+  setenv("TZ", "America/New_York", 1);
+  tzset();
+
+  if (!loads() || !known() || !same(200000)) {
+    return 1;
+  }
+  std::cout << "formats read as expected" << std::endl;
+
+  size_t n = argc > 1 ? std::stoul(argv[1]) : 4000000;
+  std::mt19937 rng(31);
+  Step plain;
+  plain.key_ = Key("t");
+  Step local = step("%d/%b/%Y:%H:%M:%S %z");
+  Step date  = step("%Y-%m-%d %H:%M:%S");
+  for (int rate : {50, 1}) {
+    // rate lines a second on average, in order
+    time_t now = 1480391340;
+    std::vector<std::string> tl, td;
+    for (size_t i = 0; i < n; ++i) {
+      now += rng() % (2 * rate) == 0;
+      tl.push_back(timeLocal(now, 8 * 3600));
+      td.push_back(timeDate(now));
+    }
+
+    std::cout << rate << " lines a second:" << std::endl;
+    bench("time_local", tl, plain, time_local_handler<JsonWriter>);
+    bench("time \"%d/%b/%Y:%H:%M:%S %z\"", tl, local,
+          time_handler<JsonWriter>);
+    bench("time_date", td, plain, time_date_handler<JsonWriter>);
+    bench("time \"%Y-%m-%d %H:%M:%S\"", td, date, time_handler<JsonWriter>);
+  }
+
+  return 0;
+}
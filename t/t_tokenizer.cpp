@@ -0,0 +1,168 @@
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "fluorine/log/Parser.hpp"
+#include "fluorine/log/Tokenizer.hpp"
+
+using namespace fluorine::log;
+
+// Checks that the tokenizer splits lines exactly like the Spirit grammar and
+// compares their speed, usage:
+//   t_tokenizer [access.log [field_number time_index]]
+
+using Fields = std::vector<std::string>;
+
+static bool spirit(const Grammar<const char *> &g, const std::string &line,
+                   Fields &fields) {
+  const char *begin = line.data(), *end = line.data() + line.size();
+  return qi::phrase_parse(begin, end, g, qi::space, fields);
+}
+
+static std::string show(bool ok, const Fields &fields) {
+  std::string s = ok ? "ok" : "failed";
+  for (auto &f : fields) {
+    s += " <" + f + ">";
+  }
+  return s;
+}
+
+static bool same(const std::string &line, unsigned int fn, unsigned int ti) {
+  Grammar<const char *> g(fn, ti);
+  Tokenizer t(fn, ti);
+
+  Fields expect, got;
+  Log log;
+  bool ok1 = spirit(g, line, expect);
+  bool ok2 = t.Tokenize(line.data(), line.data() + line.size(), log);
+  for (auto &field : log) {
+    got.push_back(field.to_string());
+  }
+  // a failed parse leaves a partial log, only success is compared
+  if (ok1 != ok2 || (ok1 && expect != got)) {
+    std::cout << "mismatch fn=" << fn << " ti=" << ti << " line: [" << line
+              << "]\n  spirit:    " << show(ok1, expect)
+              << "\n  tokenizer: " << show(ok2, got) << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+static const char *corpus[] = {
+    "",
+    "   ",
+    "a",
+    " a b  c ",
+    "a\tb\nc",
+    "a\rb \x0b c\x0c",
+    "\"abc\" d",
+    "\"abc",
+    "\"a\\\"",
+    "\"a\\\"b\" c",
+    "\"a\"\"b\" c",
+    "\"\"\"",
+    "\"\" x",
+    "\"x\" \"y",
+    "\"a\" b\"c\" \"d e\"",
+    "\"a\"\\\"b\" c",
+    "x [ab c y",
+    "x [] y",
+    "x [a[b] y",
+    "x [a b]c d",
+    "x [\"a\"] d",
+    "[abc def",
+    "[10/Oct/2000:13:55:36 -0700] GET",
+    "127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] \"GET /apache_pb.gif "
+    "HTTP/1.0\" 200 2326 \"-\" \"Mozilla/4.08 [en] (Win98; I ;Nav)\"",
+};
+
+static bool fuzz(size_t cases) {
+  const char alphabet[] = "ab \t\n\r\x0b\"\\[]";
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<size_t> len(0, 80);
+  std::uniform_int_distribution<size_t> pick(0, sizeof(alphabet) - 2);
+  std::uniform_int_distribution<unsigned int> index(0, 4);
+
+  for (size_t i = 0; i < cases; ++i) {
+    std::string line(len(rng), ' ');
+    for (auto &c : line) {
+      c = alphabet[pick(rng)];
+    }
+    if (!same(line, index(rng), index(rng))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+template <typename F>
+static void bench(const char *name, const std::vector<std::string> &lines,
+                  F f) {
+  auto start    = std::chrono::steady_clock::now();
+  size_t fields = 0;
+  for (int round = 0; round < 5; ++round) {
+    for (auto &line : lines) {
+      fields += f(line);
+    }
+  }
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << fields << " fields, "
+            << static_cast<unsigned long long>(lines.size() * 5 / d.count())
+            << " lines/s" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  std::cout << "isa: " << Tokenizer::Isa() << std::endl;
+
+  for (auto line : corpus) {
+    for (unsigned int fn = 0; fn < 5; ++fn) {
+      for (unsigned int ti = 0; ti < 5; ++ti) {
+        if (!same(line, fn, ti)) {
+          return 1;
+        }
+      }
+    }
+  }
+
+  if (!fuzz(200000)) {
+    return 1;
+  }
+  std::cout << "corpus and fuzz cases match" << std::endl;
+
+  if (argc < 2) {
+    return 0;
+  }
+
+  unsigned int fn = argc > 3 ? std::stoi(argv[2]) : 0;
+  unsigned int ti = argc > 3 ? std::stoi(argv[3]) : 0;
+
+  std::vector<std::string> lines;
+  std::ifstream is(argv[1]);
+  for (std::string line; std::getline(is, line);) {
+    if (!same(line, fn, ti)) {
+      return 1;
+    }
+    lines.push_back(line);
+  }
+  std::cout << lines.size() << " lines match" << std::endl;
+
+  Grammar<const char *> g(fn, ti);
+  Tokenizer t(fn, ti);
+  bench("spirit", lines, [&](const std::string &line) {
+    Fields fields;
+    spirit(g, line, fields);
+    return fields.size();
+  });
+  bench("tokenizer", lines, [&](const std::string &line) {
+    Log log;
+    t.Tokenize(line.data(), line.data() + line.size(), log);
+    return log.size();
+  });
+
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <memory>
+#include <fstream>
+#include <iostream>
+
+#include "fluorine/log/Json.hpp"
+#include "fluorine/log/Parser.hpp"
+#include "fluorine/config/Parser.hpp"
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine;
+
+// the line through a reused document, as transform() in Fluorine.cpp does
+static bool document(const log::Log &log, const json::Plan &plan,
+                     std::string &out) {
+  static char buffer[64 * 1024];
+  rapidjson::Document::AllocatorType allocator(buffer, sizeof(buffer));
+  rapidjson::Document doc(&allocator);
+  if (!json::PopulateJsonDoc(&doc, log, plan)) {
+    return false;
+  }
+  if (!doc.HasMember("path")) {
+    doc.AddMember("path", rapidjson::Value("bench", doc.GetAllocator()),
+                  doc.GetAllocator());
+  }
+  json::AppendJsonDoc(&doc, out);
+  return true;
+}
+
+// the members of a flat object, sorted
+static std::vector<std::string> members(const std::string &json) {
+  std::vector<std::string> out;
+  bool quoted = false;
+  size_t start = 1;
+  for (size_t i = 1; i + 1 < json.size(); ++i) {
+    if (quoted && json[i] == '\\') {
+      ++i;
+    } else if (json[i] == '"') {
+      quoted = !quoted;
+    } else if (!quoted && json[i] == ',') {
+      out.push_back(json.substr(start, i - start));
+      start = i + 1;
+    }
+  }
+  out.push_back(json.substr(start, json.size() - 1 - start));
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+template <typename F>
+static void bench(const char *name, const config::Config &cfg,
+                  const std::vector<std::string> &sample, size_t n, F f) {
+  log::Log log;
+  std::string out;
+  size_t bytes = 0, ok = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; ++i) {
+    const std::string &line = sample[i % sample.size()];
+    log.clear();
+    if (!log::ParseLog(line.data(), line.data() + line.size(), log,
+                       cfg.field_number_, cfg.time_index_)) {
+      continue;
+    }
+
+    if (f(log, out)) {
+      out += '\n';
+      ++ok;
+    }
+
+    if (out.size() > (1 << 20)) {
+      bytes += out.size();
+      out.clear();
+    }
+  }
+  bytes += out.size();
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << ok << " lines, " << bytes << " bytes, "
+            << static_cast<size_t>(n / d.count()) << " lines/s" << std::endl;
+}
+
+// lines in blocks of 1024, parsed first and their addresses resolved
+// ahead, as the transform workers in Fluorine.cpp do
+template <typename F>
+static void blocks(const char *name, const config::Config &cfg,
+                   const json::Plan &plan,
+                   const std::vector<std::string> &sample, size_t n, F f) {
+  const size_t kBlock = 1024;
+  std::vector<std::unique_ptr<log::Log>> logs;
+  for (size_t i = 0; i < kBlock; ++i) {
+    logs.emplace_back(new log::Log());
+  }
+  std::vector<const log::Log *> parsed;
+  std::string out;
+  size_t bytes = 0, ok = 0;
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < n; i += kBlock) {
+    parsed.clear();
+    for (size_t j = 0; j < kBlock && i + j < n; ++j) {
+      const std::string &line = sample[(i + j) % sample.size()];
+      logs[j]->clear();
+      if (log::ParseLog(line.data(), line.data() + line.size(), *logs[j],
+                        cfg.field_number_, cfg.time_index_)) {
+        parsed.push_back(logs[j].get());
+      }
+    }
+
+    json::ResolveAhead(parsed, plan);
+    for (auto log : parsed) {
+      if (f(*log, out)) {
+        out += '\n';
+        ++ok;
+      }
+    }
+    json::DropResolved();
+
+    bytes += out.size();
+    out.clear();
+  }
+
+  std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+  std::cout << name << ": " << ok << " lines, " << bytes << " bytes, "
+            << static_cast<size_t>(n / d.count()) << " lines/s" << std::endl;
+}
+
+// Single thread throughput of the transform stage, parsing lines and
+// writing their JSON through a document and, when the config allows it,
+// streamed, one line at a time and in blocks. Streamed lines must be the
+// same bytes, or the same members when a constant is replaced, usage:
+//   t_transform sample/access.config sample/access.log 17monipdb.dat [lines]
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    std::cout << "usage: " << argv[0] << " <config> <log> <ipdb> [lines]"
+              << std::endl;
+    return 1;
+  }
+
+  config::Config cfg;
+  if (!config::ParseConfig(std::string(argv[1]), cfg)) {
+    return 1;
+  }
+  util::InitIPResolver(argv[3]);
+
+  json::Plan plan;
+  if (!json::CompilePlan(cfg, plan)) {
+    return 1;
+  }
+
+  std::vector<std::string> sample;
+  std::ifstream is(argv[2]);
+  for (std::string line; std::getline(is, line);) {
+    sample.push_back(line);
+  }
+  if (sample.empty()) {
+    return 1;
+  }
+
+  size_t n = argc > 4 ? std::stoul(argv[4]) : 2000000;
+  bench("document", cfg, sample, n,
+        [&](log::Log &log, std::string &out) {
+          return document(log, plan, out);
+        });
+
+  // a block resolved ahead gives what each line resolving its own does
+  std::string single, ahead;
+  for (auto &line : sample) {
+    log::Log log;
+    if (log::ParseLog(line.data(), line.data() + line.size(), log,
+                      cfg.field_number_, cfg.time_index_)) {
+      document(log, plan, single);
+    }
+  }
+  blocks("document blocks", cfg, plan, sample, sample.size(),
+         [&](const log::Log &log, std::string &) {
+           return document(log, plan, ahead);
+         });
+  if (ahead != single) {
+    std::cout << "a block resolved ahead differs" << std::endl;
+    return 1;
+  }
+
+  if (!json::CompileStream(plan, "bench")) {
+    std::cout << "config not streamable" << std::endl;
+    return 0;
+  }
+
+  // replacing a constant moves a member in the document
+  bool reordered = false;
+  for (auto &step : plan.steps_) {
+    reordered = reordered || step.action_ == json::Action::Replace;
+  }
+
+  log::Log log;
+  for (auto &line : sample) {
+    log.clear();
+    if (!log::ParseLog(line.data(), line.data() + line.size(), log,
+                       cfg.field_number_, cfg.time_index_)) {
+      continue;
+    }
+
+    std::string expect, got;
+    bool ok1 = document(log, plan, expect);
+    bool ok2 = json::EmitJson(log, plan, got);
+    bool same = reordered ? members(expect) == members(got) : expect == got;
+    if (ok1 != ok2 || (ok1 && !same)) {
+      std::cout << "mismatch: " << line << "\n  document: " << expect
+                << "\n  streamed: " << got << std::endl;
+      return 1;
+    }
+  }
+
+  bench("streamed", cfg, sample, n, [&](log::Log &log, std::string &out) {
+    return json::EmitJson(log, plan, out);
+  });
+  blocks("streamed blocks", cfg, plan, sample, n,
+         [&](const log::Log &log, std::string &out) {
+           return json::EmitJson(log, plan, out);
+         });
+
+  return 0;
+}
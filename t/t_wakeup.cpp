@@ -0,0 +1,99 @@
+#include <time.h>
+#include <poll.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <iostream>
+#include <algorithm>
+
+#include "fluorine/util/LineBlock.hpp"
+
+using namespace fluorine::util;
+using Clock = std::chrono::steady_clock;
+
+// Latency from Push to the consumer seeing a block, and the consumer's CPU
+// time while the queue is idle, for a consumer polling every 1 ms as the
+// send loop used to and for one sleeping in poll on the queue's eventfd,
+// usage:
+//   t_wakeup [blocks]
+
+static double threadCpu() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static long long now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now().time_since_epoch())
+      .count();
+}
+
+// the consumer, taking a function that waits for the queue
+template <typename Wait>
+static void run(const char *name, size_t blocks, Wait wait) {
+  BlockQueue queue(1 << 20, 4096);
+  std::vector<long long> latency;
+  std::atomic<bool> stop(false);
+  double idle_cpu = 0;
+
+  std::thread consumer([&]() {
+    // idle first, nothing is pushed for a second
+    double start = threadCpu();
+    auto until   = Clock::now() + std::chrono::seconds(1);
+    while (Clock::now() < until) {
+      wait(queue, until);
+    }
+    idle_cpu = threadCpu() - start;
+
+    while (latency.size() < blocks) {
+      LineBlock *block;
+      while ((block = queue.Pop())) {
+        long long sent = std::stoll(block->Line(0).to_string());
+        latency.push_back(now() - sent);
+        queue.Release(block);
+      }
+      wait(queue, Clock::now() + std::chrono::milliseconds(100));
+    }
+    stop = true;
+  });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  for (size_t i = 0; i < blocks && !stop; ++i) {
+    // spaced out so every block finds the consumer asleep
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+    LineBlock *block = queue.Acquire();
+    std::string sent = std::to_string(now());
+    block->Append(sent.data(), sent.size());
+    queue.Push(block);
+  }
+  consumer.join();
+
+  std::sort(latency.begin(), latency.end());
+  std::cout << name << ": p50 " << latency[latency.size() / 2] / 1000
+            << " us, p99 " << latency[latency.size() * 99 / 100] / 1000
+            << " us, idle cpu " << idle_cpu * 1000 << " ms/s" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+  size_t blocks = argc > 1 ? std::stoul(argv[1]) : 2000;
+
+  run("poll", blocks, [](BlockQueue &queue, Clock::time_point) {
+    if (queue.Empty()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+
+  run("eventfd", blocks, [](BlockQueue &queue, Clock::time_point until) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+        until - Clock::now());
+    struct pollfd fd = {queue.Fd(), POLLIN, 0};
+    if (left.count() > 0 && poll(&fd, 1, left.count()) > 0) {
+      queue.Drain();
+    }
+  });
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "fluorine/WorkerPool.hpp"
+#include "fluorine/log/Json.hpp"
+#include "fluorine/log/Parser.hpp"
+#include "fluorine/config/Parser.hpp"
+#include "fluorine/util/IPResolver.hpp"
+
+using namespace fluorine;
+
+using Batch = std::vector<std::string>;
+using Pool  = WorkerPool<Batch, std::string>;
+
+// Transform throughput by worker count, usage:
+//   t_workers sample/access.config sample/access.log 17monipdb.dat [workers]
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    std::cout << "usage: " << argv[0] << " <config> <log> <ipdb> [workers]"
+              << std::endl;
+    return 1;
+  }
+
+  config::Config cfg;
+  if (!config::ParseConfig(std::string(argv[1]), cfg)) {
+    return 1;
+  }
+  util::InitIPResolver(argv[3]);
+
+  json::Plan plan;
+  if (!json::CompilePlan(cfg, plan)) {
+    return 1;
+  }
+
+  std::vector<std::string> sample;
+  std::ifstream is(argv[2]);
+  std::string line;
+  while (std::getline(is, line)) {
+    sample.push_back(line);
+  }
+  if (sample.empty()) {
+    return 1;
+  }
+
+  const size_t kLines = 1000000, kBatch = 256;
+  int max_workers     = argc > 4 ? std::atoi(argv[4]) : 8;
+
+  for (int n = 1; n <= max_workers; n *= 2) {
+    Pool pool(n, true, [&cfg, &plan](Batch &batch, std::string &out) {
+      std::unique_ptr<Batch> owned(&batch);
+      for (auto &line : batch) {
+        log::Log log;
+        std::string json;
+        if (log::ParseLog(line, log, cfg.field_number_, cfg.time_index_) &&
+            json::LogToJsonString(log, json, plan)) {
+          out += json;
+          out += '\n';
+        }
+      }
+    });
+
+    auto start   = std::chrono::steady_clock::now();
+    size_t sent  = 0;
+    size_t bytes = 0;
+    while (sent < kLines || !pool.Idle()) {
+      while (sent < kLines && pool.CanDispatch()) {
+        std::unique_ptr<Batch> batch(new Batch());
+        for (size_t i = 0; i < kBatch; ++i, ++sent) {
+          batch->push_back(sample[sent % sample.size()]);
+        }
+        pool.Dispatch(batch.release());
+      }
+      while (auto out = pool.Collect()) {
+        bytes += out->size();
+      }
+    }
+
+    std::chrono::duration<double> d = std::chrono::steady_clock::now() - start;
+    std::cout << n << " workers: " << static_cast<size_t>(sent / d.count())
+              << " lines/s, " << bytes << " bytes" << std::endl;
+  }
+
+  return 0;
+}